@@ -0,0 +1,34 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "common.h"
+
+#define ARENA_ALIGN 16 // Alignment of every arena allocation.
+
+typedef struct ArenaBlock
+{
+    struct ArenaBlock *next; // Previously filled block, or NULL.
+    size_t size;             // Usable bytes in data.
+    size_t used;             // Bytes handed out from data.
+    uint8_t data[];
+} ArenaBlock;
+
+typedef struct
+{
+    ArenaBlock *head; // Block allocations are currently taken from.
+    size_t total;     // Usable bytes across every block.
+} Arena;
+
+Status arena_init(Arena *arena, size_t size);
+// Prepares an arena with one block of `size` bytes.
+
+void *arena_alloc(Arena *arena, size_t size);
+// Returns `size` bytes from the arena, adding a block when the current one is full; NULL if out of memory.
+
+void arena_reset(Arena *arena);
+// Releases every allocation at once, keeping a single block large enough for the peak usage.
+
+void arena_free(Arena *arena);
+// Returns all of the arena's memory to the heap.
+
+#endif
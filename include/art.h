@@ -0,0 +1,27 @@
+#ifndef ART_H
+#define ART_H
+
+#include "common.h"
+#include "cache.h"
+#include <pthread.h>
+
+#define ART_CHUNK_SIZE (64 << 10)        // Chunk in which pictures left in the file are copied, per worker.
+#define ART_MANIFEST_NAME "manifest.tsv" // Manifest written into the store, one "image<TAB>track" line per picture.
+
+typedef struct
+{
+    const char *store;        // Directory the images are stored in, named by content hash.
+    FILE *manifest;           // Temporary manifest, renamed into place when the export finishes.
+    TagCache cache;           // Tag cache, used when caching is turned on.
+    int caching;
+    pthread_mutex_t lock;     // Guards the manifest and the counts below.
+    long files;               // Files visited.
+    long pictures;            // Files with a picture.
+    long unique;              // Pictures written to the store by this export.
+    long long bytes_written;  // Bytes of the pictures written to the store.
+} ArtExport;
+
+Status export_art(const char *root, const char *store);
+// Stores the APIC picture of every file under root once per distinct content and writes a manifest mapping tracks to images.
+
+#endif
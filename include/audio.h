@@ -0,0 +1,51 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include "common.h"
+
+#define AUDIO_BLOCK_SIZE (1 << 20)    // Bytes read at a time by the full frame scan.
+#define AUDIO_PROBE_SIZE (64 << 10)   // Bytes read to find the first frame and its Xing/VBRI header.
+#define AUDIO_SAMPLE_WINDOWS 16       // Windows read across the audio by the estimate.
+#define AUDIO_SAMPLE_FRAMES 64        // Frames measured in each estimate window.
+#define AUDIO_CHECK_SIZE (4 << 10)    // Bytes read at a time to check that a file holds MPEG audio.
+
+typedef enum
+{
+    e_audio_xing, // Xing or Info header of a VBR or CBR encoder.
+    e_audio_vbri, // Fraunhofer VBRI header.
+    e_audio_scan, // Every frame header was read.
+    e_audio_estimate // Frames sampled across the file, the rest extrapolated.
+} AudioMethod;
+
+typedef struct
+{
+    long long duration_ms;    // Length of the audio in milliseconds.
+    unsigned int bitrate;     // Average bitrate in kbit/s.
+    unsigned int sample_rate; // Samples per second.
+    int channel_mode;         // 0 stereo, 1 joint stereo, 2 dual channel, 3 mono.
+    int version;              // 10 for MPEG-1, 20 for MPEG-2, 25 for MPEG-2.5.
+    int layer;                // 1, 2 or 3.
+    long frames;              // Number of audio frames.
+    long long audio_bytes;    // Bytes of audio, from the first frame to any tag at the end.
+    AudioMethod method;       // How the figures were obtained.
+} AudioInfo;
+
+Status scan_audio(int fd, long offset, int estimate, AudioInfo *info);
+// Finds the first MPEG audio frame at or after offset and works out the duration and bitrate of the stream.
+
+long audio_data_end(int fd, long start, long size);
+// Returns the offset where the audio of a file ends, before any ID3v1, appended ID3v2 or APEv2 tag.
+
+int audio_starts_with_frame(int fd, long start, long end);
+// Returns non-zero if a valid MPEG audio frame, confirmed by the header after it, is found within AUDIO_PROBE_SIZE bytes of start.
+
+void display_audio(const AudioInfo *info, FILE *out);
+// Prints the duration, bitrate, sample rate, channel mode and MPEG version of a stream.
+
+const char *audio_method_name(AudioMethod method);
+// Returns a printable name for the way audio figures were obtained.
+
+Status audio_details(const char *file_name, int estimate, int set_tlen);
+// Prints the audio figures of an MP3 file in MP3_FILES_PATH, storing the duration in its TLEN tag if set_tlen is non-zero.
+
+#endif
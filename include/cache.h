@@ -0,0 +1,107 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "common.h"
+#include "tag_index.h"
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define TAG_CACHE_PATH "data/tag_cache.bin" // Default location of the metadata cache.
+#define TAG_CACHE_ENV "TAG_CACHE"           // Environment variable overriding the cache path ("off" disables it).
+#define TAG_CACHE_MAGIC "OTC1"              // First four bytes of a cache file.
+#define TAG_CACHE_VERSION 4                 // Bumped when the parser changes what a record holds.
+#define CACHE_INLINE_LIMIT 4096             // Frames up to this size are stored in full.
+#define CACHE_PREFIX_LIMIT 128              // Larger frames keep only this prefix (enough for an APIC header).
+#define CACHE_ENTRY_TAGGED 1                // Entry flag: the file has an ID3v2 tag.
+#define CACHE_ENTRY_TRUNCATED 2             // Entry flag: a frame other than APIC (or any frame of a decoded tag) was truncated.
+#define CACHE_ENTRY_DELETED 4               // Pending entry flag: drop the file from the cache.
+#define CACHE_ENTRY_DECODED 8               // Entry flag: the stored frames were decoded from unsynchronisation.
+
+/*
+ * Cache file layout (native byte order, every field 4- or 8-byte aligned):
+ *   CacheHeader
+ *   records: per file, frame_count CacheFrame entries followed by their stored data
+ *   index:   entry_count CacheEntry entries sorted by (dev, ino), at header.records_end
+ */
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t reserved;
+    uint64_t records_end; // Offset of the index; records run from the end of the header to here.
+    uint64_t live_bytes;  // Record bytes still referenced by the index.
+} CacheHeader;
+
+typedef struct
+{
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;         // File size the entry was built from.
+    int64_t mtime_ns;      // File modification time the entry was built from.
+    uint64_t record_offset;
+    uint32_t record_len;
+    uint32_t flags;        // CACHE_ENTRY_* flags.
+    uint32_t header_size;
+    uint32_t frame_count;
+    uint64_t frames_end;
+    uint64_t audio_offset;
+    uint32_t version;      // ID3v2 major version of the tag.
+    uint32_t reserved;
+} CacheEntry;
+
+typedef struct
+{
+    char id[4];
+    uint8_t flags[2];
+    uint8_t header_len; // Bytes in the frame header.
+    uint8_t reserved;
+    uint32_t size;   // Full size of the frame data.
+    uint32_t stored; // Bytes of the data kept in the record.
+    uint32_t offset; // File offset of the frame header.
+} CacheFrame;
+
+typedef struct CachePending
+{
+    struct CachePending *next;
+    CacheEntry entry;
+    uint8_t record[]; // entry.record_len bytes.
+} CachePending;
+
+typedef struct
+{
+    char path[MAX_PATH_LENGTH];
+    uint8_t *map;          // Read-only mapping of the cache file, or NULL if there is none yet.
+    size_t map_len;
+    const CacheHeader *header;
+    const CacheEntry *entries;
+    CachePending *pending; // Entries parsed since the cache was opened, newest first.
+    int pending_count;
+    pthread_mutex_t lock;  // Guards pending.
+} TagCache;
+
+Status open_tag_cache(TagCache *cache);
+// Maps the cache named by TAG_CACHE (default TAG_CACHE_PATH); fails if caching is turned off.
+
+const CacheEntry *cache_lookup(const TagCache *cache, const struct stat *st);
+// Finds the entry of a file, or NULL if it is missing or stale (size or mtime changed).
+
+Status cache_load_index(const TagCache *cache, const CacheEntry *entry, int fd, TagIndex *index, Arena *arena);
+// Rebuilds a tag index from a cache entry; with fd >= 0 truncated text frames are read and pictures streamed from the file.
+
+Status cache_put(TagCache *cache, const struct stat *st, const TagIndex *index);
+// Records the parsed tag of a file (index NULL for a file without a tag); safe to call from several threads.
+
+Status cache_forget(TagCache *cache, uint64_t dev, uint64_t ino);
+// Drops a file from the cache at the next save.
+
+Status save_tag_cache(TagCache *cache);
+// Writes the pending entries to the cache file, replacing it atomically.
+
+Status cached_tag_index(TagCache *cache, int fd, TagIndex *index);
+// Indexes a file's tag from the cache when it is fresh, parsing and caching it otherwise.
+
+void close_tag_cache(TagCache *cache);
+// Unmaps the cache and drops any unsaved entries.
+
+#endif
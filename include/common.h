@@ -10,6 +10,10 @@
 
 #define NUM_TAGS 84
 
+#define TAG_TABLE_BITS 8                          // log2 of the number of slots in the frame ID table.
+#define TAG_TABLE_SIZE (1 << TAG_TABLE_BITS)
+#define TAG_HASH_MULTIPLIER 0x4FE87F05u           // Found by search: gives every ID in tagMappings its own slot.
+
 #define MAX_PATH_LENGTH 256 // Define a maximum length for file paths
 
 #define IMAGE_INPUT_PATH "data/image_input/"
@@ -24,12 +28,27 @@ typedef struct
 
 extern ID3TagMapping tagMappings[NUM_TAGS];
 
+typedef enum
+{
+    e_frame_text,    // Text information frames (T***).
+    e_frame_url,     // URL link frames (W***).
+    e_frame_apic,    // Attached picture.
+    e_frame_comment, // Language-tagged text: COMM, USLT and USER.
+    e_frame_binary   // Every other frame.
+} FrameKind;
+
 typedef enum
 {
     e_success,
     e_failure
 } Status;
 
+int tag_lookup(const char *tag);
+// Looks up a 4-byte frame ID in a hash table keyed by its 32-bit value; returns its index in `tagMappings` or -1.
+
+FrameKind tag_kind(int tag_index);
+// Returns the frame kind of a tag index returned by tag_lookup.
+
 Status is_valid_tag_W_index(const char *tag, int *tag_index);
 // Checks if a tag is valid and returns its index.
 
@@ -57,13 +76,13 @@ int size_of_the_file(FILE *file);
 char *is_valid_image(const char *image_name);
 // Checks if an image filename has a valid extension and returns its MIME type.
 
-char *convert_size(int);
+void convert_size(int num, uint8_t bytes[4]);
 // Converts an integer size to a 4-byte array (standard ID3v2 encoding).
 
 int end_of_header(FILE *mp3);
 // Determines the file offset marking the end of the ID3v2 header.
 
-char *convert_header_size(int num);
+void convert_header_size(int num, uint8_t bytes[4]);
 // Converts an integer size to a 4-byte array (ID3v2 header size encoding).
 
 #endif
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef COPY_H
+#define COPY_H
+
+#include "common.h"
+
+#define COPY_BUFFER_SIZE (1 << 20) // Size of the aligned buffer used by the read/write fallback.
+#define COPY_BUFFER_ALIGN 4096     // Alignment of the fallback buffer.
+
+typedef enum
+{
+    e_copy_none,
+    e_copy_file_range,
+    e_copy_sendfile,
+    e_copy_splice,
+    e_copy_buffered
+} CopyStrategy;
+
+typedef struct
+{
+    long long bytes;       // Number of bytes moved.
+    CopyStrategy strategy; // Strategy that moved the last bytes.
+} CopyResult;
+
+Status copy_fd(int in_fd, int out_fd, long long length, CopyResult *result);
+// Copies `length` bytes (or everything up to end of file if negative) between the current offsets of two descriptors.
+
+const char *copy_strategy_name(CopyStrategy strategy);
+// Returns a printable name for a copy strategy.
+
+#endif
@@ -3,18 +3,20 @@
 #define EDIT_H
 
 #include "common.h"
+#include "tag_index.h"
+#include "transaction.h"
 
-int check_tag(FILE *mp3, const char *tag);
-// Checks if a specific ID3v2 tag exists in the MP3 file and returns its offset.
+int check_tag(const TagIndex *index, const char *tag);
+// Checks if a specific ID3v2 tag exists in the tag index and returns its offset.
 
 Status edit_tags(FILE *mp3, FILE *new_mp3, const char *tag_name, const char *data, const char *file_name);
 // Edits an existing ID3v2 tag or adds it if it's missing.
 
-int final_header_offset(FILE *mp3);
-// Determines the file offset marking the end of the ID3v2 header.
+Status edit_batch(FILE *mp3, FILE *new_mp3, const TagEdit *edits, int count, const char *file_name);
+// Applies several tag edits (text tags and APIC) in a single rewrite of the MP3 file.
 
-Status change_Header_size(FILE *mp3, FILE *new_mp3, int final_offset);
-// Updates the size field within the ID3v2 header of the new MP3 file.
+Status edit_stream(int in_fd, int out_fd, const TagEdit *edits, int count);
+// Applies several tag edits to MP3 data read from in_fd, writing the edited data to out_fd.
 
 Status replace_file(const char *file_name); // Replaces the original file with the contents of the temporary "new.mp3" file.
 
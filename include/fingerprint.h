@@ -0,0 +1,23 @@
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include "common.h"
+
+#define FINGERPRINT_CHUNK (1 << 20) // Bytes read at a time while hashing audio.
+#define FINGERPRINT_SEED 0          // Seed of the XXH64 audio hash.
+
+typedef struct
+{
+    char *path;
+    uint64_t hash;      // XXH64 of the audio bytes.
+    long long bytes;    // Number of audio bytes hashed.
+    int error;          // errno of a failed open or read, or 0.
+} AudioHash;
+
+Status hash_audio(int fd, uint8_t *chunk, AudioHash *result);
+// Hashes the bytes between the end of the ID3v2 tag and any ID3v1 or APEv2 trailer, reading FINGERPRINT_CHUNK bytes at a time into chunk; fails with no error if they do not start with an MPEG audio frame.
+
+Status hash_library(const char *root, int duplicates);
+// Hashes the audio of every file under root on a pool of worker threads; prints every hash, or only the groups of files with identical audio.
+
+#endif
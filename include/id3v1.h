@@ -0,0 +1,43 @@
+#ifndef ID3V1_H
+#define ID3V1_H
+
+#include "common.h"
+#include "text.h"
+
+#define ID3V1_SIZE 128            // The "TAG" trailer in the last bytes of the file.
+#define ID3V1_EXTENDED_SIZE 227   // An extended "TAG+" block, just before the trailer.
+#define ID3V1_NO_GENRE 255        // Genre byte of a tag without a genre.
+#define ID3V1_FIELD_MAX (90 * TEXT_EXPANSION + 1) // Longest field (an extended title) as UTF-8.
+
+typedef struct
+{
+    int extended;                        // A "TAG+" block extends the title, artist and album.
+    int track;                           // ID3v1.1 track number, or 0.
+    int genre;                           // Genre byte, or ID3V1_NO_GENRE.
+    int speed;                           // Extended speed: 0 unset, 1 slow, 2 medium, 3 fast, 4 hardcore.
+    char title[ID3V1_FIELD_MAX];         // The text fields, as NUL-terminated UTF-8 without padding.
+    char artist[ID3V1_FIELD_MAX];
+    char album[ID3V1_FIELD_MAX];
+    char year[4 * TEXT_EXPANSION + 1];
+    char comment[30 * TEXT_EXPANSION + 1];
+    char genre_name[30 * TEXT_EXPANSION + 1]; // Extended free-text genre.
+    char start_time[6 * TEXT_EXPANSION + 1]; // Extended "mmm:ss" start and end of the music.
+    char end_time[6 * TEXT_EXPANSION + 1];
+} Id3v1Tag;
+
+Status read_id3v1(int fd, Id3v1Tag *tag);
+// Decodes the ID3v1 or v1.1 trailer of a file, and an extended "TAG+" block before it, from one pread of the file's tail.
+
+long id3v1_offset(int fd, long start, long size);
+// Returns where the ID3v1 tag at the end of a file (and an extended block before it) starts, or size if there is none.
+
+const char *id3v1_genre_name(int genre);
+// Returns the name of an ID3v1 genre byte, or NULL if it is not a known genre.
+
+Status display_id3v1(const Id3v1Tag *tag, FILE *out);
+// Prints every field of an ID3v1 tag under the ID3v2 frame ID it corresponds to.
+
+Status read_one_id3v1(const Id3v1Tag *tag, const char *given_tag, FILE *out);
+// Displays the ID3v1 field that corresponds to an ID3v2 frame ID.
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "common.h"
+#include "arena.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define POOL_MAX_WORKERS 256      // Upper bound on the number of worker threads.
+#define POOL_DEQUE_SIZE 256       // Initial number of task slots in each worker's deque.
+#define POOL_ARENA_SIZE (64 << 10) // Initial size of each worker's arena.
+#define POOL_IDLE_SPINS 64         // Empty steal rounds before an idle worker parks until new work is queued.
+#define POOL_RETRY_SLEEP_US 100    // Sleep before retrying to inject a task when the inbox cannot grow.
+
+typedef struct Worker Worker;
+typedef void (*TaskFn)(Worker *worker, void *arg);
+
+typedef struct
+{
+    TaskFn fn;
+    void *arg;
+} Task;
+
+typedef struct
+{
+    Task *tasks; // Ring buffer; the owner works at the bottom, thieves take from the top.
+    int top;
+    int count;
+    int capacity;
+    pthread_mutex_t lock;
+} TaskDeque;
+
+typedef struct
+{
+    Worker *workers;
+    int worker_count;
+    TaskDeque inbox;     // Tasks injected from threads outside the pool.
+    atomic_long pending; // Tasks submitted but not yet finished.
+    atomic_ulong queued; // Bumped whenever a task is queued, so a parking worker can tell it missed one.
+    atomic_int parked;   // Workers waiting on work_ready.
+    pthread_mutex_t idle_lock;
+    pthread_cond_t work_ready; // Signalled when a task is queued, broadcast when none is pending.
+    void *ctx;           // Shared state for the tasks.
+} WorkPool;
+
+struct Worker
+{
+    WorkPool *pool;
+    int id;
+    pthread_t thread;
+    TaskDeque deque;
+    Arena arena; // Scratch memory for the running task, reset after every task.
+    void *local; // Per-worker state for the tasks.
+};
+
+Status init_pool(WorkPool *pool, int worker_count, void *ctx);
+// Creates the workers of a pool, each with its own deque and arena.
+
+void submit_task(Worker *worker, TaskFn fn, void *arg);
+// Queues a task on a worker's own deque.
+
+void reserve_task(WorkPool *pool);
+// Counts a task that will be injected later, keeping the pool running until it arrives.
+
+void inject_task(WorkPool *pool, TaskFn fn, void *arg);
+// Hands a task reserved with reserve_task to the pool from any thread.
+
+Status run_pool(WorkPool *pool, TaskFn fn, void *arg);
+// Runs a root task and everything it spawns on the pool, returning once every task has finished.
+
+void free_pool(WorkPool *pool);
+// Releases the workers of a pool.
+
+int pool_thread_count(void);
+// Returns the default number of workers (one per online core).
+
+#endif
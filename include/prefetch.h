@@ -0,0 +1,84 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include "common.h"
+#include "pool.h"
+
+#define PREFETCH_DEPTH 256           // Files being opened, read or parsed at once.
+#define PREFETCH_WINDOW (64 << 10)   // Bytes read with the header; covers most tags in one request.
+#define PREFETCH_THREADS 32          // Blocking I/O threads used when io_uring is unavailable.
+#define PREFETCH_ENV "TAG_PREFETCH"  // Environment variable selecting the backend: uring, threads or off.
+
+typedef enum
+{
+    e_prefetch_off,
+    e_prefetch_uring,
+    e_prefetch_threads
+} PrefetchBackend;
+
+typedef struct PrefetchRequest
+{
+    struct PrefetchRequest *next; // Next request waiting for a slot.
+    const char *path;             // File to read; must stay valid until the slot is released.
+    void *arg;                    // Caller's data for the completion task.
+} PrefetchRequest;
+
+typedef struct PrefetchSlot
+{
+    struct PrefetchSlot *next; // Next free slot.
+    PrefetchRequest *request;  // Request being served.
+    uint8_t *buffer;           // The first `length` bytes of the file.
+    long length;
+    int error;                 // errno of a failed open or read, or 0.
+    int large;                 // Non-zero if the tag is over TAG_READ_LIMIT: only the window was read and fd is left open.
+    uint8_t *window;           // Preallocated PREFETCH_WINDOW-byte buffer of this slot.
+    int fd;                    // Closed before the slot reaches the pool, unless `large` is set.
+    int state;                 // Stage of the request (io_uring backend).
+} PrefetchSlot;
+
+typedef struct
+{
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    unsigned to_submit; // SQEs prepared since the last io_uring_enter.
+} Uring;
+
+typedef struct
+{
+    PrefetchBackend backend;
+    WorkPool *pool;
+    TaskFn done;                         // Task run on the pool with each filled slot.
+    PrefetchSlot slots[PREFETCH_DEPTH];
+    uint8_t *windows;                    // Backing memory of every slot window.
+    PrefetchSlot *free_slots;
+    PrefetchRequest *queue_head, *queue_tail;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;                 // Signalled on new requests, freed slots and shutdown.
+    int closing;
+    Uring ring;
+    pthread_t threads[PREFETCH_THREADS];
+    int thread_count;
+} Prefetcher;
+
+Status start_prefetcher(Prefetcher *prefetcher, WorkPool *pool, TaskFn done);
+// Starts the I/O backend chosen by TAG_PREFETCH (io_uring by default, falling back to I/O threads).
+
+void prefetch_file(Prefetcher *prefetcher, PrefetchRequest *request);
+// Queues a file; its header and tag are read asynchronously and `done` is run on the pool with the slot.
+
+void release_prefetch_slot(Prefetcher *prefetcher, PrefetchSlot *slot);
+// Returns a slot to the prefetcher once its buffer has been parsed, closing the file of a large tag.
+
+void stop_prefetcher(Prefetcher *prefetcher);
+// Stops the I/O backend once every queued file has been handed to the pool.
+
+const char *prefetch_backend_name(PrefetchBackend backend);
+// Returns a printable name for a prefetch backend.
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "common.h"
+#include "pool.h"
+#include "prefetch.h"
+#include <sys/stat.h>
+
+typedef struct ScanBatch ScanBatch;
+
+typedef struct
+{
+    ScanBatch *batch; // Block the entry lives in.
+    const char *path;
+    int is_dir;
+    int has_stat;            // Non-zero if st holds the file's status (when stat_files is set).
+    struct stat st;
+    PrefetchRequest request; // Read-ahead of the file's tag.
+} ScanEntry;
+
+typedef struct
+{
+    void (*visit_file)(Worker *worker, ScanEntry *entry); // Run by the worker listing a directory for each regular file in it.
+    int stat_files;                                      // Non-zero to stat every file while listing.
+    const char *skip_dir;                                // Directory left out of the walk, or NULL.
+} ScanWalk;
+
+Status walk_library(WorkPool *pool, const ScanWalk *walk, const char *root);
+// Walks the tree under root on the pool, handing every regular file to walk->visit_file; returns once every task has finished.
+
+void release_entry(ScanEntry *entry);
+// Drops a file handed to visit_file once the task serving it is done; the path is freed with the last entry of its directory.
+
+Status scan_library(const char *root, const char *const *tags, int tag_count);
+// Walks a directory tree and prints the tags of every file, on a work-stealing pool of worker threads.
+
+int scan_thread_count(void);
+// Returns the number of worker threads used by scan_library (one per online core).
+
+#endif
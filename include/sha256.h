@@ -0,0 +1,28 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include "common.h"
+
+#define SHA256_DIGEST_SIZE 32 // Bytes in a SHA-256 digest.
+
+typedef struct
+{
+    uint32_t state[8];
+    uint64_t length;    // Bytes hashed so far.
+    uint8_t block[64];  // Partial block waiting for more data.
+    size_t block_len;
+} Sha256;
+
+void sha256_init(Sha256 *ctx);
+// Starts a new SHA-256 digest.
+
+void sha256_update(Sha256 *ctx, const void *data, size_t len);
+// Adds data to the digest; may be called any number of times.
+
+void sha256_final(Sha256 *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+// Pads the message and writes the digest.
+
+void sha256_hex(const uint8_t digest[SHA256_DIGEST_SIZE], char hex[2 * SHA256_DIGEST_SIZE + 1]);
+// Formats a digest as lowercase hexadecimal.
+
+#endif
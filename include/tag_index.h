@@ -0,0 +1,73 @@
+#ifndef TAG_INDEX_H
+#define TAG_INDEX_H
+
+#include "common.h"
+#include "arena.h"
+
+#define TAG_READ_LIMIT (1 << 20)          // Tags up to this size are read whole with a single pread.
+#define TAG_FRAME_LOAD_LIMIT (256 << 10)  // Frames of a larger tag above this size stay in the file...
+#define TAG_FRAME_PREFIX 4096             // ...except for this prefix, which covers an APIC header.
+#define TAG_FLAG_UNSYNC 0x80              // Header flag: the tag (v2.2, v2.3) or every frame (v2.4) is unsynchronised.
+#define TAG_FLAG_EXTENDED 0x40            // Header flag: an extended header follows (v2.3, v2.4).
+#define TAG_FLAG_FOOTER 0x10              // Header flag: a 10-byte footer follows the tag (v2.4).
+#define FRAME_FLAG_UNSYNC 0x02            // v2.4 frame format flag (second flag byte): the data is unsynchronised.
+#define FRAME_FLAG_LENGTH 0x01            // v2.4 frame format flag: the data starts with a 4-byte data length indicator.
+#define PADDING_FRAME_OWNER "padding"     // Owner of the PRIV frames that fill the slots frames left when edited in place.
+
+typedef struct
+{
+    char id[5];         // NUL-terminated frame ID (e.g. "TIT2"); ID3v2.2 IDs are mapped to their v2.3 equivalent.
+    long offset;        // File offset of the 10-byte frame header.
+    unsigned int size;  // Size of the frame data, excluding the frame header.
+    unsigned int available; // Bytes of data in memory; less than size for a large frame left in the file or truncated by the cache.
+    uint8_t flags[2];   // The two frame flag bytes (zero for ID3v2.2).
+    uint8_t header_len; // Bytes in the frame header: 6 for ID3v2.2, 10 otherwise; the data starts at offset + header_len.
+    uint8_t *data;      // Frame data, pointing into the index buffer.
+} FrameEntry;
+
+typedef struct
+{
+    uint8_t *buffer;          // Tag bytes, starting at file offset 0.
+    long buffer_len;          // Number of valid bytes in buffer.
+    int borrowed;             // Non-zero if buffer belongs to the caller and is not freed with the index.
+    unsigned int header_size; // Tag size declared in bytes 6-9 of the header.
+    uint8_t version;          // Major version from byte 3 of the header: 2, 3 or 4.
+    long frames_end;          // Offset just past the last frame.
+    long audio_offset;        // Offset where the audio data begins (after any padding).
+    FrameEntry *frames;
+    int frame_count;
+    Arena *arena;             // Arena the frame list is allocated from, or NULL for the heap.
+    int fd;                   // Descriptor the rest of partly loaded frames is read from, or -1.
+    int decoded;              // Non-zero if unsynchronisation was removed: the frames are all in memory and
+                              // their offsets and sizes no longer match the bytes in the file.
+    long appended_offset;     // Offset of a v2.4 tag appended to the file and merged into the frame list, or 0.
+    long appended_end;        // Offset just past the appended tag and its footer.
+    uint8_t *appended;        // Loaded frame data of the appended tag, owned by the index or its arena.
+} TagIndex;
+
+Status build_tag_index(FILE *mp3, TagIndex *index);
+// Reads the ID3v2 tag once and records the offset, size, flags and data of every frame.
+
+Status read_tag_index(int fd, TagIndex *index, Arena *arena);
+// Indexes the ID3v2 tag from one pread of exactly the declared tag, never reading the audio; the buffer and frame list come from `arena` if given.
+// Tags over TAG_READ_LIMIT are read frame by frame, leaving large frames in the file (see index->fd).
+
+Status read_appended_tag(int fd, TagIndex *index);
+// Follows the SEEK frame of a v2.4 tag to a tag appended to the file and merges its frames into the index.
+
+Status stream_tag_index(int fd, TagIndex *index);
+// Reads the tag from a forward-only stream (e.g. stdin), leaving fd at the first byte after the declared tag.
+
+Status index_tag_buffer(uint8_t *buffer, long length, TagIndex *index, Arena *arena);
+// Indexes a tag that the caller has already read into memory, starting at file offset 0.
+
+const FrameEntry *find_frame(const TagIndex *index, const char *tag);
+// Looks up the first frame with the given ID in the index.
+
+int is_padding_frame(const FrameEntry *frame);
+// Returns non-zero if the frame is a PRIV frame owned by PADDING_FRAME_OWNER, i.e. free space in the tag.
+
+void free_tag_index(TagIndex *index);
+// Releases the memory held by a tag index.
+
+#endif
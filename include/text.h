@@ -0,0 +1,30 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+#include "common.h"
+
+#define TEXT_LATIN1 0x00   // ISO-8859-1.
+#define TEXT_UTF16 0x01    // UTF-16 with a byte order mark.
+#define TEXT_UTF16BE 0x02  // UTF-16 big endian without a byte order mark (ID3v2.4).
+#define TEXT_UTF8 0x03     // UTF-8 (ID3v2.4).
+#define TEXT_LEGACY 0xFF   // No encoding byte: UTF-8 where valid, ISO-8859-1 otherwise.
+#define TEXT_EXPANSION 3   // Largest number of UTF-8 bytes written per input byte.
+
+typedef struct
+{
+    uint8_t encoding; // One of the TEXT_* encodings.
+    int big_endian;   // UTF-16 byte order; switched by every byte order mark.
+    int separate;     // A NUL was seen since the last character; "/" is written before the next one.
+    int started;      // A character has been written; leading NULs are dropped.
+} TextDecoder;
+
+void text_decoder_init(TextDecoder *dec, uint8_t encoding);
+// Starts decoding text in an ID3v2 encoding; an unknown encoding byte is treated as TEXT_LEGACY.
+
+size_t text_to_utf8(TextDecoder *dec, const uint8_t *src, size_t len, int final, uint8_t *dst, size_t *consumed);
+// Converts src to UTF-8 in dst (TEXT_EXPANSION * len bytes); stops before a character cut off by the end of src unless final. Returns the UTF-8 length.
+
+size_t text_terminator(uint8_t encoding, const uint8_t *src, size_t len);
+// Returns the length of the string at src up to and including its NUL terminator, or len if it has none.
+
+#endif
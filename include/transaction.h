@@ -0,0 +1,72 @@
+#ifndef TRANSACTION_H
+#define TRANSACTION_H
+
+#include "common.h"
+#include "tag_index.h"
+
+#define DEFAULT_TAG_PADDING 1024      // Padding reserved after the frames when a tag is rewritten.
+#define MAX_TAG_PADDING (1 << 24)     // Largest padding accepted from the environment.
+#define TAG_PADDING_ENV "TAG_PADDING" // Environment variable overriding DEFAULT_TAG_PADDING.
+#define TAG_APPEND_ENV "TAG_APPEND"   // Environment variable: "on" moves frames that outgrow a v2.4 tag to a tag appended to the file.
+#define PADDING_FRAME_MIN (10 + (long)sizeof(PADDING_FRAME_OWNER)) // Smallest slot a padding frame fills.
+#define SEEK_FRAME_SIZE 4             // Data of the SEEK frame: offset from the end of the tag to the appended one.
+
+typedef struct
+{
+    const char *tag;  // 4-byte tag identifier.
+    const char *data; // New tag data, or the image file name for APIC.
+} TagEdit;
+
+typedef struct
+{
+    char id[5];       // NUL-terminated frame ID.
+    uint8_t flags[2]; // Frame flags.
+    uint8_t *data;    // First size - tail_size bytes of the data, in the source index buffer or owned by the transaction.
+    size_t size;      // Size of the frame data.
+    long src_offset;  // Offset of the frame in the source file, or -1 for a new frame.
+    int owned;        // Non-zero if data was allocated by the transaction.
+    int changed;      // Non-zero if the data differs from the source frame.
+    int tail_fd;      // Descriptor the last tail_size bytes are copied from (source file or image).
+    long tail_offset; // Offset of those bytes in tail_fd.
+    size_t tail_size; // Bytes of the data never held in memory, or 0.
+    int owns_tail;    // Non-zero if tail_fd was opened by the transaction (an image file).
+    int appended;     // Non-zero if the frame goes to the tag appended to the file.
+    long dst_offset;  // Offset the frame is written at by an in-place update, set by plan_in_place.
+} TxnFrame;
+
+typedef struct
+{
+    TagIndex index;   // Index of the source tag.
+    TxnFrame *frames; // Frames of the tag being built, in output order.
+    int frame_count;
+    int capacity;
+} TagTransaction;
+
+Status begin_transaction(TagTransaction *txn, FILE *mp3);
+// Indexes the source tag and starts a transaction holding its frames.
+
+Status begin_stream_transaction(TagTransaction *txn, int in_fd);
+// Reads the source tag from a forward-only stream and starts a transaction holding its frames.
+
+Status set_text_frame(TagTransaction *txn, const char *tag_name, const char *data);
+// Replaces the first frame with the given ID, or appends a new one.
+
+Status set_image_frame(TagTransaction *txn, FILE *img, const char *MIME, const char *image_name);
+// Replaces the APIC frame with the given image, or appends a new one.
+
+Status commit_transaction(TagTransaction *txn, FILE *mp3, FILE *new_mp3, const char *file_name);
+// Writes the new tag in place if it fits, in place plus a tag appended to the file if allowed, otherwise rewrites the file in one pass; closes both files.
+
+Status commit_stream(TagTransaction *txn, int in_fd, int out_fd);
+// Writes the new tag to out_fd, then passes the rest of in_fd through unbuffered.
+
+void free_transaction(TagTransaction *txn);
+// Releases the memory held by a transaction.
+
+int tag_padding_size(void);
+// Returns the number of padding bytes reserved when a tag is rewritten.
+
+int tag_append_enabled(void);
+// Returns non-zero if TAG_APPEND_ENV asks for frames that no longer fit a v2.4 tag to be appended to the file.
+
+#endif
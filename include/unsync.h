@@ -0,0 +1,20 @@
+#ifndef UNSYNC_H
+#define UNSYNC_H
+
+#include "common.h"
+
+#define UNSYNC_CHUNK (64 << 10) // Bytes callers encode at a time when streaming.
+
+size_t unsync_decode(uint8_t *buf, size_t len);
+// Removes the 0x00 stuffed after every 0xFF, in place; returns the decoded length.
+
+size_t unsync_encode(const uint8_t *src, size_t len, uint8_t *dst);
+// Inserts 0x00 after every 0xFF followed by 0x00 or a byte >= 0xE0; dst needs 2 * len bytes. Returns the encoded length.
+
+size_t unsync_encoded_size(const uint8_t *src, size_t len);
+// Returns the length unsync_encode would produce, without writing anything.
+
+int unsync_needs_stuffing(uint8_t next);
+// Returns non-zero if a 0xFF followed by `next` must have a 0x00 inserted between them.
+
+#endif
@@ -2,17 +2,26 @@
 #define VIEW_H
 
 #include "common.h"
+#include "tag_index.h"
 
-Status display_deets(FILE *mp3);
-// Displays detailed information about all ID3v2 tags in an MP3 file.
+#define VIEW_CHUNK_SIZE (64 << 10) // Chunk in which text frame data left in the file is copied out.
 
-Status display_tag(FILE *mp3);
-// Displays the content of a single ID3v2 tag from the current file position.
+Status display_deets(const TagIndex *index, FILE *out, const char *image_path);
+// Prints detailed information about all ID3v2 tags in an MP3 file to `out`.
 
-Status read_one_tag(FILE *mp3, const char *tag);
-// Searches for and displays the content of a specific ID3v2 tag.
+Status display_tag(const TagIndex *index, const FrameEntry *frame, FILE *out, const char *image_path);
+// Displays the content of a single indexed ID3v2 tag.
 
-Status read_apic(FILE *mp3, const char *output_path);
-// Reads and extracts the data of an APIC (Attached Picture) ID3v2 tag.
+Status read_one_tag(const TagIndex *index, const char *tag, FILE *out, const char *image_path);
+// Searches the tag index for a specific ID3v2 tag and displays its content.
+
+Status read_apic(const TagIndex *index, const FrameEntry *frame, FILE *out, const char *output_path);
+// Reads the data of an APIC (Attached Picture) ID3v2 tag and extracts the image unless output_path is NULL.
+
+Status parse_apic(const FrameEntry *frame, char MIME_type[100], char *picture_type, char discription[100], unsigned int *payload);
+// Reads the fields of an APIC frame and finds the offset of the picture in its data.
+
+Status write_apic_image(const TagIndex *index, int out_fd);
+// Copies only the picture bytes of the APIC frame to out_fd, straight from the MP3 file when it is open.
 
 #endif
\ No newline at end of file
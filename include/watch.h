@@ -0,0 +1,39 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "common.h"
+#include "cache.h"
+
+#define WATCH_SETTLE_MS 500     // Quiet time after the last event before a batch of changes is indexed.
+#define WATCH_MAX_DELAY_MS 5000 // Longest a change waits while events keep arriving.
+#define WATCH_EVENT_BUFFER (64 << 10)
+
+typedef struct WatchFile
+{
+    struct WatchFile *next;       // Next file in the same hash bucket.
+    struct WatchFile *dirty_next; // Next file changed since the last batch.
+    uint64_t dev;                 // Identity of the file when it was last indexed (0/0 if never).
+    uint64_t ino;
+    int dirty;
+    char path[];
+} WatchFile;
+
+typedef struct
+{
+    int fd;               // inotify descriptor.
+    char **dirs;          // Watched directory of each watch descriptor, or NULL.
+    int dir_capacity;
+    WatchFile **buckets;  // Every known file under the tree, by path.
+    size_t bucket_count;
+    size_t file_count;
+    WatchFile *dirty;     // Files changed since the last batch.
+    int dirty_count;
+    TagCache cache;
+    long updated;         // Files re-indexed in the current batch.
+    long removed;         // Files dropped from the cache in the current batch.
+} Watcher;
+
+Status watch_library(const char *root);
+// Indexes a directory tree into the tag cache, then keeps the cache current from inotify events until interrupted.
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef XXH64_H
+#define XXH64_H
+
+#include "common.h"
+
+typedef struct
+{
+    uint64_t acc[4];    // Four lanes, each consuming every fourth 8-byte word of a stripe.
+    uint64_t length;    // Bytes hashed so far.
+    uint8_t stripe[32]; // Partial stripe waiting for more data.
+    size_t stripe_len;
+    uint64_t seed;
+} Xxh64;
+
+void xxh64_init(Xxh64 *ctx, uint64_t seed);
+// Starts a new XXH64 hash.
+
+void xxh64_update(Xxh64 *ctx, const void *data, size_t len);
+// Adds data to the hash; may be called any number of times.
+
+uint64_t xxh64_final(const Xxh64 *ctx);
+// Returns the hash of everything added so far.
+
+#endif
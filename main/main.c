@@ -1,6 +1,16 @@
 #include "edit.h"
 #include "view.h"
+#include "scan.h"
+#include "prefetch.h"
+#include "cache.h"
+#include "watch.h"
+#include "art.h"
+#include "audio.h"
+#include "fingerprint.h"
+#include "id3v1.h"
 #include "common.h"
+#include <fcntl.h>
+#include <unistd.h>
 
 Status main(int argc, char *argv[])
 {
@@ -20,20 +30,50 @@ Status main(int argc, char *argv[])
         fprintf(stdout, "\n");
         fprintf(stdout, "Usage: ./a.out [FLAGS...] [SOURCE FILE]  \n");
         fprintf(stdout, "       ./a.out -v [SOURCE FILE] [TAG FLAG] ...  \n");
-        fprintf(stdout, "       ./a.out -e [SOURCE FILE] [TAG FLAG] \"[DATA]\" \n");
+        fprintf(stdout, "       ./a.out -v [SOURCE FILE] --apic-stdout  \n");
+        fprintf(stdout, "       ./a.out -e [SOURCE FILE] [TAG FLAG] \"[DATA]\" [[TAG FLAG] \"[DATA]\"]... \n");
+        fprintf(stdout, "       ./a.out --scan [DIRECTORY] [TAG FLAG] ...  \n");
+        fprintf(stdout, "       ./a.out --watch [DIRECTORY]  \n");
+        fprintf(stdout, "       ./a.out --art [DIRECTORY] [STORE]  \n");
+        fprintf(stdout, "       ./a.out --audio [SOURCE FILE] [--estimate] [--tlen]  \n");
+        fprintf(stdout, "       ./a.out --audio-hash [DIRECTORY]  \n");
+        fprintf(stdout, "       ./a.out --audio-dups [DIRECTORY]  \n");
         fprintf(stdout, "\n");
         fprintf(stdout, "[FLAGS...]\n");
         fprintf(stdout, "\t-t, to view all the tags in the ID3 V2\n");
-        fprintf(stdout, "\t-v to view the tags from the Audio file.\n");
+        fprintf(stdout, "\t-v to view the tags from the Audio file, including an ID3v1 tag at its end.\n");
         fprintf(stdout, "\t-e, to edit the data of the audio file.\n");
+        fprintf(stdout, "\t--scan, to view the tags of every file under a directory, parsed in parallel.\n");
+        fprintf(stdout, "\t--apic-stdout, after -v [SOURCE FILE], writes only the embedded picture to stdout.\n");
+        fprintf(stdout, "\t--watch, to keep the tag cache of a directory up to date as files change, until interrupted.\n");
+        fprintf(stdout, "\t--art, to store the picture of every file under a directory once per distinct image.\n");
+        fprintf(stdout, "\t--audio, to show the duration, bitrate, sample rate and channel mode of the audio.\n");
+        fprintf(stdout, "\t--estimate, after --audio [SOURCE FILE], samples the frames instead of reading them all when there is no Xing/VBRI header.\n");
+        fprintf(stdout, "\t--tlen, after --audio [SOURCE FILE], stores the duration in milliseconds in the TLEN tag.\n");
+        fprintf(stdout, "\t--audio-hash, to print a hash of the audio of every file under a directory, leaving out the tags.\n");
+        fprintf(stdout, "\t--audio-dups, to list the files under a directory whose audio is identical, whatever their tags.\n");
+        fprintf(stdout, "[DIRECTORY]\n");
+        fprintf(stdout, "\tThe directory tree to scan or watch; APIC images are described but not extracted.\n");
+        fprintf(stdout, "[STORE]\n");
+        fprintf(stdout, "\tDirectory the pictures are written to as <sha256>.<type>, with %s mapping each file to its picture.\n", ART_MANIFEST_NAME);
         fprintf(stdout, "[SOURCE FILE]\n");
         fprintf(stdout, "\tThe name of the source file you want to read the data from.\n");
+        fprintf(stdout, "\t- reads the MP3 data from stdin; with -e the edited data is written to stdout and logs to stderr.\n");
         fprintf(stdout, "[TAG FLAG]\n");
         fprintf(stdout, "\tMention if you want to read a particular tag from the file.\n\tIf Tag not mentioned the DEFAULTS TO DEISPLY ALL THE TAGS.\n");
         fprintf(stdout, "\tIn case of \033[1mEditing \033[0mit is the TAG you want to edit.\n");
+        fprintf(stdout, "\tAny number of TAG/DATA pairs can be given; they are applied in one rewrite.\n");
+        fprintf(stdout, "\tFor APIC the DATA is the name of an image in %s.\n", IMAGE_INPUT_PATH);
         fprintf(stdout, "[DATA]\n");
         fprintf(stdout, "\tThe meta data you want to replce with.\n\tthe data must be in double inverted commas\n");
         fprintf(stdout, "\t\033[1mWARNING-- \033[0mUsed Only for editing.\n");
+        fprintf(stdout, "[ENVIRONMENT]\n");
+        fprintf(stdout, "\t%s, bytes of padding reserved when a tag is rewritten (default %d).\n", TAG_PADDING_ENV, DEFAULT_TAG_PADDING);
+        fprintf(stdout, "\tEdits that fit in the existing padding are written in place.\n");
+        fprintf(stdout, "\tOtherwise the tag is resized by whole blocks in place where the filesystem supports it (ext4, XFS), and the file is rewritten where it does not.\n");
+        fprintf(stdout, "\t%s, on to write frames that outgrow an ID3v2.4 tag to a tag appended to the file, found through a SEEK frame (default off).\n", TAG_APPEND_ENV);
+        fprintf(stdout, "\t%s, I/O backend of --scan: uring (default), threads or off.\n", PREFETCH_ENV);
+        fprintf(stdout, "\t%s, path of the tag cache used by -v, --scan, --watch and --art (default %s), or off.\n", TAG_CACHE_ENV, TAG_CACHE_PATH);
         fprintf(stdout, "\n");
         return 0;
     }
@@ -56,49 +96,56 @@ Status main(int argc, char *argv[])
             return e_failure;
         }
 
+        int edit_count = (argc - 3) / 2;
+        TagEdit edits[edit_count];
+        for (int i = 0; i < edit_count; i++)
+        {
+            int flag_tag = flag_to_tag(argv[3 + 2 * i]);
+
+            if (flag_tag == 0)
+            {
+                fprintf(stdout, "ERROR : Invalid Flag\n");
+                return e_failure;
+            }
+            edits[i].tag = tagMappings[flag_tag].tag;
+            edits[i].data = argv[4 + 2 * i];
+        }
+
+        // "-" streams the MP3 data from stdin to stdout.
+        if (strcmp(argv[2], "-") == 0)
+        {
+            if (isatty(STDOUT_FILENO))
+            {
+                fprintf(stderr, "ERROR: Refusing to write MP3 data to a terminal, redirect stdout\n");
+                return e_failure;
+            }
+            return edit_stream(STDIN_FILENO, STDOUT_FILENO, edits, edit_count);
+        }
+
         char mp3__file[MAX_PATH_LENGTH];
         strcpy(mp3__file, MP3_FILES_PATH);
         strcat(mp3__file, argv[2]);
 
         FILE *mp3 = fopen(mp3__file, "r");
+        if (mp3 == NULL)
+        {
+            fprintf(stderr, "ERROR: Invalid File\n");
+            return e_failure;
+        }
 
         char temp__mp3__file[MAX_PATH_LENGTH];
         strcpy(temp__mp3__file, MP3_FILES_PATH);
         strcat(temp__mp3__file, "new.mp3");
 
         FILE *new_mp3 = fopen(temp__mp3__file, "wb");
-
-        int flag_tag = flag_to_tag(argv[3]);
-
-        if (flag_tag == 0)
+        if (new_mp3 == NULL)
         {
-            fprintf(stdout, "ERROR : Invalid Flag\n");
+            perror("fopen failed");
             fclose(mp3);
             return e_failure;
         }
-        else
-        {
-            if (strcmp(argv[3], "APIC") == 0)
-            {
-                char *MIME = is_valid_image(argv[4]);
 
-                if (MIME == NULL)
-                {
-                    fprintf(stdout, "ERROR : Invalid Image file\n");
-                    return e_failure;
-                }
-                char image__file[MAX_PATH_LENGTH];
-                strcpy(image__file, IMAGE_INPUT_PATH);
-                strcat(image__file, argv[4]);
-                FILE *img = fopen(image__file, "rb");
-
-                replace_image(mp3, new_mp3, img, MIME, argv[4], argv[2]);
-                fclose(img);
-                free(MIME);
-                return e_success;
-            }
-            edit_tags(mp3, new_mp3, tagMappings[flag_tag].tag, argv[4], argv[2]);
-        }
+        return edit_batch(mp3, new_mp3, edits, edit_count, argv[2]);
     }
 
     else if (strcmp(argv[1], "-v") == 0)
@@ -109,42 +156,76 @@ Status main(int argc, char *argv[])
             return e_failure;
         }
 
-        if (argv[3] == NULL)
+        // --apic-stdout writes only the picture bytes, so they can be piped to another program.
+        int apic_stdout = argv[3] != NULL && strcmp(argv[3], "--apic-stdout") == 0;
+        if (apic_stdout && isatty(STDOUT_FILENO))
         {
+            fprintf(stderr, "ERROR: Refusing to write image data to a terminal, redirect stdout\n");
+            return e_failure;
+        }
 
+        // "-" reads the tag from stdin, which may be a pipe; the cache is not used.
+        int streaming = strcmp(argv[2], "-") == 0;
+        int mp3 = STDIN_FILENO;
+        if (!streaming)
+        {
             char mp3__file[MAX_PATH_LENGTH];
             strcpy(mp3__file, MP3_FILES_PATH);
             strcat(mp3__file, argv[2]);
 
-            FILE *mp3 = fopen(mp3__file, "r");
-
-            if (is_valid_file(mp3) == e_failure)
+            mp3 = open(mp3__file, O_RDONLY);
+            if (mp3 == -1)
             {
                 fprintf(stderr, "ERROR: Invalid File\n");
-                fclose(mp3);
-
                 return e_failure;
             }
-            display_deets(mp3);
-            fclose(mp3);
         }
 
+        TagCache cache;
+        int caching = !streaming && open_tag_cache(&cache) == e_success;
+
+        // The file stays open while the tags are shown: large pictures are copied from it.
+        TagIndex index;
+        Status parsed;
+        if (streaming)
+        {
+            parsed = stream_tag_index(mp3, &index);
+        }
         else
         {
-
-            char mp3__file[MAX_PATH_LENGTH];
-            strcpy(mp3__file, MP3_FILES_PATH);
-            strcat(mp3__file, argv[2]);
-
-            FILE *mp3 = fopen(mp3__file, "r");
-            if (is_valid_file(mp3) == e_failure)
+            parsed = caching ? cached_tag_index(&cache, mp3, &index) : read_tag_index(mp3, &index, NULL);
+        }
+        // A legacy file may only have an ID3v1 trailer: one pread of the file's tail, which a pipe does not have.
+        Id3v1Tag v1;
+        int has_v1 = !streaming && !apic_stdout && read_id3v1(mp3, &v1) == e_success;
+        if (parsed == e_failure && !has_v1)
+        {
+            fprintf(stderr, "ERROR: Invalid File\n");
+            if (!streaming)
+                close(mp3);
+            if (caching)
             {
-                fprintf(stderr, "ERROR: Invalid File\n");
-                fclose(mp3);
-
-                return e_failure;
+                save_tag_cache(&cache);
+                close_tag_cache(&cache);
             }
+            return e_failure;
+        }
+
+        Status shown = e_success;
+        if (apic_stdout)
+        {
+            shown = write_apic_image(&index, STDOUT_FILENO);
+        }
+        else if (argv[3] == NULL)
+        {
+            if (parsed == e_success)
+                display_deets(&index, stdout, IMAGE_OUTPUT_PATH);
+            if (has_v1)
+                display_id3v1(&v1, stdout);
+        }
 
+        else
+        {
             for (int i = 3; i < argc; i++)
 
             {
@@ -154,20 +235,107 @@ Status main(int argc, char *argv[])
                 if (flag_tag == 0)
                 {
                     fprintf(stdout, "ERROR : Invalid tag\n");
-                    fclose(mp3);
+                }
+                else if (parsed == e_success && (!has_v1 || find_frame(&index, tagMappings[flag_tag].tag)))
+                {
+                    read_one_tag(&index, tagMappings[flag_tag].tag, stdout, IMAGE_OUTPUT_PATH);
                 }
                 else
                 {
-
-                    if (strncmp(argv[i], "APIC", 4) == 0)
-                    {
-                        read_apic(mp3, IMAGE_OUTPUT_PATH);
-                    }
-                    read_one_tag(mp3, tagMappings[flag_tag].tag);
+                    // Fields missing from the ID3v2 tag fall back to the ID3v1 trailer.
+                    read_one_id3v1(&v1, tagMappings[flag_tag].tag, stdout);
                 }
             }
+        }
+        if (parsed == e_success)
+            free_tag_index(&index);
+        if (!streaming)
+            close(mp3);
+        if (caching)
+        {
+            save_tag_cache(&cache);
+            close_tag_cache(&cache);
+        }
+        return shown;
+    }
+    else if (strcmp(argv[1], "--scan") == 0)
+    {
+        if (argv[2] == NULL)
+        {
+            fprintf(stdout, "ERROR : Too few arguments, check --info\n");
+            return e_failure;
+        }
 
-            fclose(mp3);
+        int tag_count = argc - 3;
+        const char *tags[tag_count > 0 ? tag_count : 1];
+        for (int i = 0; i < tag_count; i++)
+        {
+            int flag_tag = flag_to_tag(argv[3 + i]);
+
+            if (flag_tag == 0)
+            {
+                fprintf(stdout, "ERROR : Invalid tag\n");
+                return e_failure;
+            }
+            tags[i] = tagMappings[flag_tag].tag;
+        }
+
+        return scan_library(argv[2], tag_count > 0 ? tags : NULL, tag_count);
+    }
+    else if (strcmp(argv[1], "--watch") == 0)
+    {
+        if (argv[2] == NULL)
+        {
+            fprintf(stdout, "ERROR : Too few arguments, check --info\n");
+            return e_failure;
         }
+
+        return watch_library(argv[2]);
     }
+    else if (strcmp(argv[1], "--art") == 0)
+    {
+        if (argv[2] == NULL || argv[3] == NULL)
+        {
+            fprintf(stdout, "ERROR : Too few arguments, check --info\n");
+            return e_failure;
+        }
+
+        return export_art(argv[2], argv[3]);
+    }
+    else if (strcmp(argv[1], "--audio") == 0)
+    {
+        if (argv[2] == NULL)
+        {
+            fprintf(stdout, "ERROR : Too few arguments, check --info\n");
+            return e_failure;
+        }
+
+        int estimate = 0, set_tlen = 0;
+        for (int i = 3; i < argc; i++)
+        {
+            if (strcmp(argv[i], "--estimate") == 0)
+                estimate = 1;
+            else if (strcmp(argv[i], "--tlen") == 0)
+                set_tlen = 1;
+            else
+            {
+                fprintf(stdout, "ERROR : Invalid option %s, check --info\n", argv[i]);
+                return e_failure;
+            }
+        }
+
+        return audio_details(argv[2], estimate, set_tlen);
+    }
+    else if (strcmp(argv[1], "--audio-hash") == 0 || strcmp(argv[1], "--audio-dups") == 0)
+    {
+        if (argv[2] == NULL)
+        {
+            fprintf(stdout, "ERROR : Too few arguments, check --info\n");
+            return e_failure;
+        }
+
+        return hash_library(argv[2], strcmp(argv[1], "--audio-dups") == 0);
+    }
+
+    return e_success;
 }
@@ -0,0 +1,111 @@
+#include "arena.h"
+
+/**
+ * Allocates a block with room for `size` bytes.
+ *
+ * @param size Usable size of the block.
+ * @return The new block, or NULL if malloc failed.
+ */
+static ArenaBlock *new_block(size_t size)
+{
+    ArenaBlock *block = (ArenaBlock *)malloc(sizeof(ArenaBlock) + size);
+    if (!block)
+    {
+        perror("ERROR: malloc failed for arena block");
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+/**
+ * Prepares an arena with a single block.
+ *
+ * @param arena The arena to initialise.
+ * @param size Size of the first block in bytes.
+ * @return e_success if the block was allocated, e_failure otherwise.
+ */
+Status arena_init(Arena *arena, size_t size)
+{
+    arena->head = new_block(size);
+    arena->total = size;
+    return arena->head ? e_success : e_failure;
+}
+
+/**
+ * Hands out memory from the arena.
+ *
+ * @param arena The arena.
+ * @param size Number of bytes requested.
+ * @return Pointer to ARENA_ALIGN-aligned memory, or NULL if a new block could not be allocated.
+ *
+ * @logic
+ * 1. Round the request up to ARENA_ALIGN.
+ * 2. Bump the offset of the current block if the request fits.
+ * 3. Otherwise chain a new block of at least twice the arena's current size.
+ */
+void *arena_alloc(Arena *arena, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    ArenaBlock *block = arena->head;
+    if (!block || block->size - block->used < size)
+    {
+        size_t block_size = arena->total * 2;
+        if (block_size < size)
+            block_size = size;
+        block = new_block(block_size);
+        if (!block)
+            return NULL;
+        block->next = arena->head;
+        arena->head = block;
+        arena->total += block_size;
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+/**
+ * Releases every allocation made from the arena.
+ *
+ * @param arena The arena.
+ *
+ * @logic
+ * 1. With a single block, rewind its offset; no heap call is made.
+ * 2. If the arena grew, replace its blocks with one block of the combined size,
+ *    so the next round of the same work fits without growing again.
+ */
+void arena_reset(Arena *arena)
+{
+    if (arena->head && arena->head->next == NULL)
+    {
+        arena->head->used = 0;
+        return;
+    }
+
+    size_t total = arena->total;
+    arena_free(arena);
+    arena_init(arena, total);
+}
+
+/**
+ * Frees every block of the arena.
+ *
+ * @param arena The arena.
+ */
+void arena_free(Arena *arena)
+{
+    ArenaBlock *block = arena->head;
+    while (block)
+    {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->total = 0;
+}
@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+#include "art.h"
+#include "sha256.h"
+#include "tag_index.h"
+#include "scan.h"
+#include "pool.h"
+#include "view.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Picks a file extension for a picture from its MIME type.
+ *
+ * @param MIME_type MIME type from the APIC frame, e.g. "image/jpeg".
+ * @param ext Receives the extension, without the dot.
+ */
+static void art_extension(const char *MIME_type, char ext[8])
+{
+    const char *slash = strchr(MIME_type, '/');
+    const char *sub = slash ? slash + 1 : MIME_type;
+    if (strcmp(sub, "jpeg") == 0)
+        sub = "jpg";
+
+    size_t len = strlen(sub);
+    int usable = len > 0 && len < 8;
+    for (size_t i = 0; usable && i < len; i++)
+        usable = isalnum((unsigned char)sub[i]);
+    if (!usable)
+        sub = "bin";
+    for (len = 0; sub[len]; len++)
+        ext[len] = tolower((unsigned char)sub[len]);
+    ext[len] = '\0';
+}
+
+/**
+ * Writes a buffer to a descriptor, retrying short writes.
+ *
+ * @return e_success if every byte was written, e_failure otherwise.
+ */
+static Status write_all(int fd, const uint8_t *p, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return e_failure;
+        }
+        p += n;
+        len -= n;
+    }
+    return e_success;
+}
+
+/**
+ * Copies the picture of an APIC frame to a descriptor, hashing it on the way.
+ *
+ * @param index The tag index of the file.
+ * @param frame The APIC frame.
+ * @param payload Offset of the picture in the frame data.
+ * @param chunk ART_CHUNK_SIZE bytes of scratch space.
+ * @param out_fd Destination descriptor.
+ * @param hex Receives the SHA-256 of the picture as hexadecimal.
+ * @return e_success if the picture was copied, e_failure on error.
+ *
+ * @logic
+ * 1. Write and hash the part of the picture held in memory; for a tag of normal size that is all of it.
+ * 2. Read the rest (a large picture left in the file) in ART_CHUNK_SIZE preads, hashing and
+ *    writing each, so the picture is read once and memory use does not depend on its size.
+ */
+static Status copy_picture(const TagIndex *index, const FrameEntry *frame, unsigned int payload, uint8_t *chunk, int out_fd, char hex[2 * SHA256_DIGEST_SIZE + 1])
+{
+    Sha256 ctx;
+    sha256_init(&ctx);
+    if (payload < frame->available)
+    {
+        sha256_update(&ctx, frame->data + payload, frame->available - payload);
+        if (write_all(out_fd, frame->data + payload, frame->available - payload) == e_failure)
+        {
+            perror("ERROR: write failed for APIC image data");
+            return e_failure;
+        }
+    }
+
+    long pos = frame->offset + frame->header_len + (payload > frame->available ? payload : frame->available);
+    long end = frame->offset + frame->header_len + (long)frame->size;
+    while (pos < end)
+    {
+        size_t want = end - pos < ART_CHUNK_SIZE ? (size_t)(end - pos) : ART_CHUNK_SIZE;
+        ssize_t n = pread(index->fd, chunk, want, pos);
+        if (n <= 0)
+        {
+            fprintf(stderr, "ERROR: Failed to read APIC image data\n");
+            return e_failure;
+        }
+        sha256_update(&ctx, chunk, n);
+        if (write_all(out_fd, chunk, n) == e_failure)
+        {
+            perror("ERROR: write failed for APIC image data");
+            return e_failure;
+        }
+        pos += n;
+    }
+
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_final(&ctx, digest);
+    sha256_hex(digest, hex);
+    return e_success;
+}
+
+/**
+ * Copies a picture into the store unless an image with the same content is already there.
+ *
+ * @param art The export state.
+ * @param index The tag index of the file.
+ * @param frame The APIC frame.
+ * @param payload Offset of the picture in the frame data.
+ * @param chunk ART_CHUNK_SIZE bytes of scratch space.
+ * @param name Receives the file name of the image in the store (hash and extension).
+ * @return e_success if the image is in the store, e_failure on error.
+ *
+ * @logic
+ * 1. Copy the picture into a new temporary file in the store with `copy_picture`, which
+ *    hashes it in the same pass.
+ * 2. Link the file to "<sha256>.<extension>". The link fails if the store already has the
+ *    name, i.e. the same content, so two workers storing one picture at once cannot both
+ *    count it and a partial image is never visible.
+ * 3. Remove the temporary name either way.
+ */
+static Status store_picture(ArtExport *art, const TagIndex *index, const FrameEntry *frame, unsigned int payload, const char *MIME_type, uint8_t *chunk, char name[2 * SHA256_DIGEST_SIZE + 10])
+{
+    char temp[PATH_MAX], path[PATH_MAX];
+    snprintf(temp, sizeof(temp), "%s/.picture.XXXXXX", art->store);
+    int fd = mkstemp(temp);
+    if (fd == -1)
+    {
+        fprintf(stderr, "ERROR: Cannot create %s: %s\n", temp, strerror(errno));
+        return e_failure;
+    }
+    fchmod(fd, 0644);
+
+    char hex[2 * SHA256_DIGEST_SIZE + 1], ext[8];
+    Status status = copy_picture(index, frame, payload, chunk, fd, hex);
+    struct stat st;
+    if (status == e_success && fstat(fd, &st) != 0)
+        status = e_failure;
+    if (close(fd) != 0)
+        status = e_failure;
+
+    int stored = 0;
+    if (status == e_success)
+    {
+        art_extension(MIME_type, ext);
+        snprintf(name, 2 * SHA256_DIGEST_SIZE + 10, "%s.%s", hex, ext);
+        snprintf(path, sizeof(path), "%s/%s", art->store, name);
+        if (link(temp, path) == 0)
+        {
+            stored = 1;
+        }
+        else if (errno != EEXIST)
+        {
+            fprintf(stderr, "ERROR: Cannot create %s: %s\n", path, strerror(errno));
+            status = e_failure;
+        }
+    }
+    unlink(temp);
+
+    if (stored)
+    {
+        pthread_mutex_lock(&art->lock);
+        art->unique++;
+        art->bytes_written += st.st_size;
+        pthread_mutex_unlock(&art->lock);
+    }
+    return status;
+}
+
+/**
+ * Exports the picture of one file.
+ *
+ * @param worker The worker running the task; its local state is its ART_CHUNK_SIZE buffer.
+ * @param arg The ScanEntry of the MP3 file.
+ *
+ * @logic
+ * 1. Index the tag (from the cache when it is fresh, else into the worker arena);
+ *    files without a tag or picture are skipped.
+ * 2. Store the picture under "<sha256>.<extension>" with `store_picture` and add a manifest line.
+ */
+static void export_file_task(Worker *worker, void *arg)
+{
+    ScanEntry *entry = arg;
+    ArtExport *art = worker->pool->ctx;
+    int fd = open(entry->path, O_RDONLY);
+    int exported = 0;
+    char name[2 * SHA256_DIGEST_SIZE + 10];
+    if (fd == -1)
+    {
+        fprintf(stderr, "ERROR: Cannot open %s: %s\n", entry->path, strerror(errno));
+    }
+    else
+    {
+        TagIndex index;
+        Status parsed = art->caching ? cached_tag_index(&art->cache, fd, &index) : read_tag_index(fd, &index, &worker->arena);
+        if (parsed == e_success)
+        {
+            const FrameEntry *frame = find_frame(&index, "APIC");
+            char MIME_type[100], discription[100], picture_type;
+            unsigned int payload;
+            exported = frame && parse_apic(frame, MIME_type, &picture_type, discription, &payload) == e_success &&
+                       store_picture(art, &index, frame, payload, MIME_type, worker->local, name) == e_success;
+            free_tag_index(&index);
+        }
+        close(fd);
+    }
+
+    pthread_mutex_lock(&art->lock);
+    art->files++;
+    if (exported)
+    {
+        art->pictures++;
+        fprintf(art->manifest, "%s\t%s\n", name, entry->path);
+    }
+    pthread_mutex_unlock(&art->lock);
+    release_entry(entry);
+}
+
+/**
+ * Queues the export of a file found by the walk on the listing worker's deque.
+ */
+static void export_visit_file(Worker *worker, ScanEntry *entry)
+{
+    submit_task(worker, export_file_task, entry);
+}
+
+/**
+ * Exports the album art of a library into a content-addressed store.
+ *
+ * @param root Directory tree holding the MP3 files.
+ * @param store Directory the images and the manifest are written to; created if missing.
+ * @return e_success if the manifest was written, e_failure on error.
+ *
+ * @logic
+ * 1. Create the store and a temporary manifest, and open the tag cache if it is enabled.
+ * 2. Walk the tree with `walk_library` on a work-stealing pool, skipping the store, with one
+ *    ART_CHUNK_SIZE buffer per worker; every picture is hashed while it is copied and kept
+ *    only the first time its content is seen, so an album's tracks share one image.
+ * 3. Rename the manifest into place, save the cache and log the totals.
+ */
+Status export_art(const char *root, const char *store)
+{
+    if (mkdir(store, 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "ERROR: Cannot create %s: %s\n", store, strerror(errno));
+        return e_failure;
+    }
+
+    ArtExport art;
+    memset(&art, 0, sizeof(art));
+    art.store = store;
+    pthread_mutex_init(&art.lock, NULL);
+    char manifest[PATH_MAX], temp[PATH_MAX];
+    snprintf(manifest, sizeof(manifest), "%s/%s", store, ART_MANIFEST_NAME);
+    snprintf(temp, sizeof(temp), "%s/.%s.tmp", store, ART_MANIFEST_NAME);
+    art.manifest = fopen(temp, "w");
+    if (!art.manifest)
+    {
+        perror("ERROR: Cannot start the art export");
+        return e_failure;
+    }
+    art.caching = open_tag_cache(&art.cache) == e_success;
+
+    WorkPool pool;
+    Status status = init_pool(&pool, pool_thread_count(), &art);
+    if (status == e_success)
+    {
+        for (int i = 0; i < pool.worker_count && status == e_success; i++)
+        {
+            pool.workers[i].local = malloc(ART_CHUNK_SIZE);
+            if (!pool.workers[i].local)
+            {
+                perror("ERROR: malloc failed for copy buffer");
+                status = e_failure;
+            }
+        }
+        ScanWalk walk = {.visit_file = export_visit_file, .skip_dir = store};
+        if (status == e_success)
+            status = walk_library(&pool, &walk, root);
+        for (int i = 0; i < pool.worker_count; i++)
+            free(pool.workers[i].local);
+        free_pool(&pool);
+    }
+
+    if (fclose(art.manifest) != 0 || status == e_failure || rename(temp, manifest) != 0)
+    {
+        perror("ERROR: Cannot write the art manifest");
+        unlink(temp);
+        status = e_failure;
+    }
+    if (art.caching)
+    {
+        save_tag_cache(&art.cache);
+        close_tag_cache(&art.cache);
+    }
+    pthread_mutex_destroy(&art.lock);
+
+    fprintf(stdout, "LOG: Exported %ld pictures from %ld files as %ld new images (%lld bytes) in %s.\n",
+            art.pictures, art.files, art.unique, art.bytes_written, store);
+    return status;
+}
@@ -0,0 +1,590 @@
+#include "audio.h"
+#include "transaction.h"
+#include "id3v1.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef struct
+{
+    int version;              // 10, 20 or 25.
+    int layer;                // 1, 2 or 3.
+    unsigned int bitrate;     // kbit/s.
+    unsigned int sample_rate; // Hz.
+    unsigned int samples;     // Samples per channel in the frame.
+    unsigned int length;      // Bytes in the frame, header included.
+    int channel_mode;         // Two high bits of the fourth header byte.
+} MpegFrame;
+
+typedef struct
+{
+    int fd;
+    uint8_t *buf; // cap bytes.
+    size_t cap;
+    long base;    // File offset of buf[0].
+    size_t len;   // Bytes of the file in buf.
+    long end;     // End of the audio data.
+} AudioWindow;
+
+// Bitrates in kbit/s by [MPEG-2 or 2.5][layer - 1][bitrate index].
+static const uint16_t mpeg_bitrates[2][3][16] = {
+    {{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0},
+     {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0},
+     {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0}},
+    {{0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0},
+     {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0},
+     {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0}}};
+
+// Sample rates by [version bits][sample rate index]; version bits 1 are reserved.
+static const unsigned int mpeg_sample_rates[4][3] = {
+    {11025, 12000, 8000},
+    {0, 0, 0},
+    {22050, 24000, 16000},
+    {44100, 48000, 32000}};
+
+/**
+ * Decodes a 4-byte MPEG audio frame header.
+ *
+ * @param h The header bytes.
+ * @param frame Receives the fields of the frame.
+ * @return 1 if h is a valid header, 0 otherwise (reserved values and free format are rejected).
+ */
+static int parse_frame_header(const uint8_t *h, MpegFrame *frame)
+{
+    if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0)
+        return 0;
+    int version = (h[1] >> 3) & 3;
+    int layer = (h[1] >> 1) & 3;
+    int bitrate = h[2] >> 4;
+    int rate = (h[2] >> 2) & 3;
+    int padding = (h[2] >> 1) & 1;
+    if (version == 1 || layer == 0 || bitrate == 0 || bitrate == 15 || rate == 3 || (h[3] & 3) == 2)
+        return 0;
+
+    frame->version = version == 3 ? 10 : version == 2 ? 20 : 25;
+    frame->layer = 4 - layer;
+    frame->bitrate = mpeg_bitrates[version != 3][frame->layer - 1][bitrate];
+    frame->sample_rate = mpeg_sample_rates[version][rate];
+    frame->channel_mode = h[3] >> 6;
+    if (frame->layer == 1)
+    {
+        frame->samples = 384;
+        frame->length = (12000 * frame->bitrate / frame->sample_rate + padding) * 4;
+    }
+    else
+    {
+        frame->samples = frame->layer == 3 && version != 3 ? 576 : 1152;
+        frame->length = frame->samples / 8 * 1000 * frame->bitrate / frame->sample_rate + padding;
+    }
+    return 1;
+}
+
+static int same_stream(const MpegFrame *a, const MpegFrame *b)
+{
+    return a->version == b->version && a->layer == b->layer && a->sample_rate == b->sample_rate;
+}
+
+/**
+ * Finds the next sync word: a 0xFF byte followed by a byte with its top three bits set.
+ *
+ * @param buf The bytes to search.
+ * @param from Index to start at.
+ * @param len Number of bytes in buf.
+ * @return Index of the 0xFF, or len if there is none (a 0xFF in the last byte is not reported).
+ *
+ * @logic
+ * 1. SSE2 compares 16 bytes, and the 16 bytes after each of them, at once: most of the
+ *    audio holds no sync word, so whole blocks are skipped with one test.
+ * 2. The scalar loop finishes the tail, and is the only path on non-x86 targets.
+ */
+static size_t find_sync(const uint8_t *buf, size_t from, size_t len)
+{
+    size_t i = from;
+#ifdef __SSE2__
+    const __m128i ff = _mm_set1_epi8((char)0xFF);
+    const __m128i e0 = _mm_set1_epi8((char)0xE0);
+    for (; i + 17 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i next = _mm_loadu_si128((const __m128i *)(buf + i + 1));
+        __m128i high = _mm_cmpeq_epi8(_mm_max_epu8(next, e0), next);
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v, ff), high));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i + 1 < len; i++)
+    {
+        if (buf[i] == 0xFF && (buf[i + 1] & 0xE0) == 0xE0)
+            return i;
+    }
+    return len;
+}
+
+/**
+ * Makes `need` bytes at `pos` available in the window, reading from the file if they are not.
+ *
+ * @return A pointer to the bytes, or NULL if the audio ends first or the read fails.
+ */
+static const uint8_t *window_at(AudioWindow *w, long pos, size_t need)
+{
+    if (pos >= w->base && pos + (long)need <= w->base + (long)w->len)
+        return w->buf + (pos - w->base);
+    if (pos + (long)need > w->end)
+        return NULL;
+
+    size_t want = w->end - pos < (long)w->cap ? (size_t)(w->end - pos) : w->cap;
+    ssize_t n = pread(w->fd, w->buf, want, pos);
+    w->base = pos;
+    w->len = n > 0 ? (size_t)n : 0;
+    return w->len >= need ? w->buf : NULL;
+}
+
+/**
+ * Tells whether a frame of the stream starts exactly at `pos`.
+ *
+ * @param w The window over the audio.
+ * @param pos Offset of the candidate header.
+ * @param ref A frame of the stream being followed, or NULL for any stream.
+ * @param frame Receives the frame found.
+ * @return 1 if the header is valid and so is the one it points to (or the audio ends
+ *         there), so a stray 0xFF in the audio data is not taken for a frame; 0 otherwise.
+ */
+static int frame_at(AudioWindow *w, long pos, const MpegFrame *ref, MpegFrame *frame)
+{
+    MpegFrame found, next;
+    const uint8_t *h = window_at(w, pos, 4);
+    if (!h || !parse_frame_header(h, &found) || (ref && !same_stream(&found, ref)))
+        return 0;
+    long after = pos + found.length;
+    h = window_at(w, after, 4);
+    if (after + 4 <= w->end && !(h && parse_frame_header(h, &next) && same_stream(&next, &found)))
+        return 0;
+    *frame = found;
+    return 1;
+}
+
+/**
+ * Finds the next frame at or after `pos`.
+ *
+ * @param w The window over the audio.
+ * @param pos Offset to start at.
+ * @param limit Offset at which the search stops.
+ * @param ref A frame of the stream being followed, or NULL for the first frame.
+ * @param frame Receives the frame found.
+ * @return Offset of the frame, or -1 if there is none before limit.
+ *
+ * @logic
+ * 1. Jump between sync words with `find_sync`, reading the file a window at a time.
+ * 2. Accept a sync word only if `frame_at` finds a frame there.
+ */
+static long next_frame(AudioWindow *w, long pos, long limit, const MpegFrame *ref, MpegFrame *frame)
+{
+    while (pos + 4 <= w->end && pos < limit)
+    {
+        if (!window_at(w, pos, 4))
+            return -1;
+        size_t hit = find_sync(w->buf, pos - w->base, w->len);
+        if (hit >= w->len)
+        {
+            long last = w->base + (long)w->len - 1;
+            pos = last > pos ? last : pos + 1;
+            continue;
+        }
+        pos = w->base + hit;
+        if (frame_at(w, pos, ref, frame))
+            return pos;
+        pos++;
+    }
+    return -1;
+}
+
+static uint32_t be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+    return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+/**
+ * Finds where the audio of a file ends, before any tags appended to it.
+ *
+ * @param fd Descriptor of the MP3 file.
+ * @param start Where the audio starts; trailers are never looked for before it.
+ * @param size Size of the file.
+ * @return Offset just past the audio.
+ *
+ * @logic
+ * 1. Drop an ID3v1 tag at the very end with `id3v1_offset`.
+ * 2. Drop an ID3v2.4 tag appended there: its 10-byte footer ("3DI") records the size
+ *    of the frames, which the header and footer add 20 bytes to.
+ * 3. Drop an APEv2 tag ending there: its 32-byte footer ("APETAGEX") records the size
+ *    of the items and footer, plus a 32-byte header when flag bit 31 is set.
+ */
+long audio_data_end(int fd, long start, long size)
+{
+    long end = id3v1_offset(fd, start, size);
+    uint8_t trailer[32];
+    if (end - start >= 20 && pread(fd, trailer, 10, end - 10) == 10 && memcmp(trailer, "3DI", 3) == 0)
+    {
+        long length = 20 + (long)id3v2_header_size(trailer + 6);
+        if (length <= end - start)
+            end -= length;
+    }
+    if (end - start >= 32 && pread(fd, trailer, 32, end - 32) == 32 && memcmp(trailer, "APETAGEX", 8) == 0)
+    {
+        long length = (long)le32(trailer + 12) + (le32(trailer + 20) & 0x80000000u ? 32 : 0);
+        if (length >= 32 && length <= end - start)
+            end -= length;
+    }
+    return end;
+}
+
+/**
+ * Tells whether the audio of a file starts with MPEG audio frames.
+ *
+ * @param fd Descriptor of the file.
+ * @param start Where the audio starts.
+ * @param end Where the audio ends, from `audio_data_end`.
+ * @return 1 if `next_frame` finds a frame within AUDIO_PROBE_SIZE bytes of start (past
+ *         any padding after the tag), 0 otherwise.
+ */
+int audio_starts_with_frame(int fd, long start, long end)
+{
+    uint8_t buf[AUDIO_CHECK_SIZE];
+    AudioWindow w = {fd, buf, sizeof(buf), 0, 0, end};
+    MpegFrame frame;
+    return next_frame(&w, start, start + AUDIO_PROBE_SIZE, NULL, &frame) >= 0;
+}
+
+/**
+ * Reads the frame and byte counts of a Xing/Info or VBRI header in the first frame.
+ *
+ * @param data The first frame.
+ * @param avail Bytes of it available.
+ * @param frame Its decoded header.
+ * @param info Receives frames, audio_bytes (when recorded) and method.
+ * @return 1 if a header with a frame count was found, 0 otherwise.
+ *
+ * @logic
+ * 1. Xing/Info follows the side information of a Layer III frame, whose size depends
+ *    on the MPEG version and on whether the frame is mono.
+ * 2. VBRI sits 32 bytes after the frame header.
+ */
+static int read_vbr_header(const uint8_t *data, size_t avail, const MpegFrame *frame, AudioInfo *info)
+{
+    size_t at = 4 + (frame->version == 10 ? (frame->channel_mode == 3 ? 17 : 32) : (frame->channel_mode == 3 ? 9 : 17));
+    if (frame->layer == 3 && at + 16 <= avail &&
+        (memcmp(data + at, "Xing", 4) == 0 || memcmp(data + at, "Info", 4) == 0))
+    {
+        uint32_t flags = be32(data + at + 4);
+        if (!(flags & 1) || be32(data + at + 8) == 0)
+            return 0;
+        info->frames = be32(data + at + 8);
+        if (flags & 2)
+            info->audio_bytes = be32(data + at + 12);
+        info->method = e_audio_xing;
+        return 1;
+    }
+
+    at = 4 + 32;
+    if (at + 18 <= avail && memcmp(data + at, "VBRI", 4) == 0 && be32(data + at + 14) != 0)
+    {
+        info->audio_bytes = be32(data + at + 10);
+        info->frames = be32(data + at + 14);
+        info->method = e_audio_vbri;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Counts every frame of the stream.
+ *
+ * @param w The window over the audio.
+ * @param pos Offset of the first frame.
+ * @param first The first frame.
+ * @param samples Receives the number of samples.
+ * @param bytes Receives the number of bytes in frames.
+ * @return The number of frames.
+ *
+ * @logic
+ * 1. Follow the frame lengths from header to header through AUDIO_BLOCK_SIZE windows.
+ * 2. Where a header is invalid (junk between frames), resync with `next_frame`.
+ */
+static long count_frames(AudioWindow *w, long pos, const MpegFrame *first, long long *samples, long long *bytes)
+{
+    long frames = 0;
+    *samples = 0;
+    *bytes = 0;
+    while (pos >= 0 && pos + 4 <= w->end)
+    {
+        const uint8_t *h = window_at(w, pos, 4);
+        MpegFrame frame;
+        if (h && parse_frame_header(h, &frame) && same_stream(&frame, first) && pos + (long)frame.length <= w->end)
+        {
+            frames++;
+            *samples += frame.samples;
+            *bytes += frame.length;
+            pos += frame.length;
+            continue;
+        }
+        if (!h)
+            break;
+        pos = next_frame(w, pos + 1, w->end, first, &frame);
+    }
+    return frames;
+}
+
+/**
+ * Estimates the average bitrate from frames sampled across the stream.
+ *
+ * @param w The window over the audio; reads stay AUDIO_PROBE_SIZE long.
+ * @param start Offset of the first frame.
+ * @param first The first frame.
+ * @return The average bitrate in bit/s, or 0 if no frame was found.
+ *
+ * @logic
+ * 1. Resync at AUDIO_SAMPLE_WINDOWS evenly spaced offsets.
+ * 2. Measure up to AUDIO_SAMPLE_FRAMES frames from each: their bytes over their duration.
+ */
+static long long sample_bitrate(AudioWindow *w, long start, const MpegFrame *first)
+{
+    long long bits = 0, samples = 0;
+    long span = (w->end - start) / AUDIO_SAMPLE_WINDOWS;
+    for (int i = 0; i < AUDIO_SAMPLE_WINDOWS; i++)
+    {
+        MpegFrame frame;
+        long pos = next_frame(w, start + span * i, w->end, first, &frame);
+        for (int k = 0; k < AUDIO_SAMPLE_FRAMES && pos >= 0; k++)
+        {
+            const uint8_t *h = window_at(w, pos, 4);
+            if (!h || !parse_frame_header(h, &frame) || !same_stream(&frame, first) || pos + (long)frame.length > w->end)
+                break;
+            bits += 8LL * frame.length;
+            samples += frame.samples;
+            pos += frame.length;
+        }
+    }
+    return samples ? bits * first->sample_rate / samples : 0;
+}
+
+/**
+ * Works out the duration and bitrate of the MPEG audio in a file.
+ *
+ * @param fd Descriptor of the MP3 file.
+ * @param offset Where the audio starts: the end of the ID3v2 tag, or 0.
+ * @param estimate Non-zero to sample the stream instead of reading every frame header
+ *        when it has no Xing/VBRI header.
+ * @param info Receives the figures.
+ * @return e_success if an MPEG audio frame was found, e_failure otherwise.
+ *
+ * @logic
+ * 1. The audio ends at an ID3v1 or APEv2 tag, if the file has one.
+ * 2. Find the first frame (skipping the padding after the tag) with `next_frame`.
+ * 3. A Xing/Info or VBRI header in it gives the frame count with no further reads.
+ * 4. Otherwise count every frame with `count_frames`, or with `estimate`, extrapolate
+ *    from `sample_bitrate` over the size of the audio.
+ */
+Status scan_audio(int fd, long offset, int estimate, AudioInfo *info)
+{
+    memset(info, 0, sizeof(*info));
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        perror("ERROR: fstat failed for MP3 file");
+        return e_failure;
+    }
+    AudioWindow w = {fd, NULL, AUDIO_PROBE_SIZE, 0, 0, audio_data_end(fd, offset, st.st_size)};
+
+    w.buf = (uint8_t *)malloc(w.cap);
+    if (!w.buf)
+    {
+        perror("ERROR: malloc failed for audio window");
+        return e_failure;
+    }
+
+    MpegFrame first;
+    long start = next_frame(&w, offset, w.end, NULL, &first);
+    if (start < 0)
+    {
+        fprintf(stderr, "ERROR: No MPEG audio frame found.\n");
+        free(w.buf);
+        return e_failure;
+    }
+    info->sample_rate = first.sample_rate;
+    info->channel_mode = first.channel_mode;
+    info->version = first.version;
+    info->layer = first.layer;
+
+    size_t avail = w.end - start < (long)first.length ? (size_t)(w.end - start) : first.length;
+    const uint8_t *data = window_at(&w, start, avail);
+    Status status = e_success;
+    if (data && read_vbr_header(data, avail, &first, info))
+    {
+        if (info->audio_bytes == 0)
+            info->audio_bytes = w.end - start;
+        info->duration_ms = (long long)info->frames * first.samples * 1000 / first.sample_rate;
+    }
+    else if (estimate)
+    {
+        info->method = e_audio_estimate;
+        info->audio_bytes = w.end - start;
+        long long bitrate = sample_bitrate(&w, start, &first);
+        if (bitrate == 0)
+        {
+            fprintf(stderr, "ERROR: No MPEG audio frame could be sampled.\n");
+            status = e_failure;
+        }
+        else
+        {
+            info->duration_ms = info->audio_bytes * 8 * 1000 / bitrate;
+            info->frames = info->duration_ms * first.sample_rate / (1000LL * first.samples);
+        }
+    }
+    else
+    {
+        uint8_t *block = (uint8_t *)realloc(w.buf, AUDIO_BLOCK_SIZE);
+        if (!block)
+        {
+            perror("ERROR: realloc failed for audio window");
+            status = e_failure;
+        }
+        else
+        {
+            w.buf = block;
+            w.cap = AUDIO_BLOCK_SIZE;
+            w.len = 0;
+            posix_fadvise(fd, start, w.end - start, POSIX_FADV_SEQUENTIAL);
+            long long samples;
+            info->method = e_audio_scan;
+            info->frames = count_frames(&w, start, &first, &samples, &info->audio_bytes);
+            info->duration_ms = samples * 1000 / first.sample_rate;
+        }
+    }
+    free(w.buf);
+
+    info->bitrate = info->duration_ms > 0 ? info->audio_bytes * 8 / info->duration_ms : first.bitrate;
+    return status;
+}
+
+const char *audio_method_name(AudioMethod method)
+{
+    switch (method)
+    {
+    case e_audio_xing:
+        return "the Xing header";
+    case e_audio_vbri:
+        return "the VBRI header";
+    case e_audio_scan:
+        return "a scan of every frame header";
+    default:
+        return "frames sampled across the file";
+    }
+}
+
+void display_audio(const AudioInfo *info, FILE *out)
+{
+    static const char *modes[] = {"Stereo", "Joint stereo", "Dual channel", "Mono"};
+    static const char *layers[] = {"", "I", "II", "III"};
+    long long ms = info->duration_ms;
+    fprintf(out, "\nThe duration of the audio is %lld:%02lld.%03lld (%lld ms)\n", ms / 60000, ms / 1000 % 60, ms % 1000, ms);
+    fprintf(out, "The average bitrate is %u kbps\n", info->bitrate);
+    fprintf(out, "The sample rate is %u Hz\n", info->sample_rate);
+    fprintf(out, "The channel mode is %s\n", modes[info->channel_mode & 3]);
+    fprintf(out, "The audio is MPEG-%d%s Layer %s, %ld frames\n", info->version / 10, info->version == 25 ? ".5" : "",
+            layers[info->layer & 3], info->frames);
+    fprintf(out, "LOG: Read the duration from %s.\n", audio_method_name(info->method));
+}
+
+/**
+ * Prints the audio figures of an MP3 file, optionally storing the duration in TLEN.
+ *
+ * @param file_name Name of the MP3 file in MP3_FILES_PATH.
+ * @param estimate Passed to `scan_audio`.
+ * @param set_tlen Non-zero to set the TLEN tag to the duration in milliseconds.
+ * @return e_success if the figures were printed (and TLEN stored), e_failure on error.
+ *
+ * @logic
+ * 1. Index the ID3v2 tag, if there is one, to find where the audio starts; with
+ *    set_tlen the index comes from an edit transaction.
+ * 2. Scan the audio with `scan_audio` and print the figures.
+ * 3. Set TLEN in the transaction and commit it, which patches the tag in place when
+ *    the padding allows.
+ */
+Status audio_details(const char *file_name, int estimate, int set_tlen)
+{
+    char mp3__file[MAX_PATH_LENGTH];
+    strcpy(mp3__file, MP3_FILES_PATH);
+    strcat(mp3__file, file_name);
+    FILE *mp3 = fopen(mp3__file, "r");
+    if (mp3 == NULL)
+    {
+        fprintf(stderr, "ERROR: Invalid File\n");
+        return e_failure;
+    }
+
+    char magic[3];
+    int tagged = fread(magic, 1, 3, mp3) == 3 && memcmp(magic, "ID3", 3) == 0;
+    TagTransaction txn;
+    long offset = 0;
+    if (set_tlen)
+    {
+        if (!tagged || begin_transaction(&txn, mp3) == e_failure)
+        {
+            fprintf(stderr, "ERROR: The file has no ID3v2 tag to store TLEN in.\n");
+            fclose(mp3);
+            return e_failure;
+        }
+        offset = txn.index.audio_offset;
+    }
+    else if (tagged)
+    {
+        TagIndex index;
+        if (build_tag_index(mp3, &index) == e_success)
+            offset = index.audio_offset;
+        free_tag_index(&index);
+    }
+
+    AudioInfo info;
+    if (scan_audio(fileno(mp3), offset, estimate, &info) == e_failure)
+    {
+        if (set_tlen)
+            free_transaction(&txn);
+        fclose(mp3);
+        return e_failure;
+    }
+    display_audio(&info, stdout);
+    if (!set_tlen)
+    {
+        fclose(mp3);
+        return e_success;
+    }
+
+    char length[32];
+    snprintf(length, sizeof(length), "%lld", info.duration_ms);
+    char temp__mp3__file[MAX_PATH_LENGTH];
+    strcpy(temp__mp3__file, MP3_FILES_PATH);
+    strcat(temp__mp3__file, "new.mp3");
+    FILE *new_mp3 = NULL;
+    if (set_text_frame(&txn, "TLEN", length) == e_failure || (new_mp3 = fopen(temp__mp3__file, "wb")) == NULL)
+    {
+        if (!new_mp3)
+            perror("fopen failed");
+        free_transaction(&txn);
+        fclose(mp3);
+        return e_failure;
+    }
+    Status status = commit_transaction(&txn, mp3, new_mp3, file_name);
+    free_transaction(&txn);
+    if (status == e_success)
+        fprintf(stdout, "LOG: successfully set the TLEN tag to \"%s\".\n", length);
+    return status;
+}
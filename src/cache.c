@@ -0,0 +1,571 @@
+#include "cache.h"
+#include "copy.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define CACHE_RECORD_ALIGN 8      // Records start on 8-byte boundaries so the index stays aligned.
+#define CACHE_COMPACT_SLACK (1 << 20) // Dead record bytes tolerated before the cache is compacted.
+
+typedef struct
+{
+    const CacheEntry *entry;
+    const uint8_t *record;
+    int order; // Lower is newer; pending entries win over entries already in the file.
+} CacheCandidate;
+
+/**
+ * Returns the modification time of a file in nanoseconds.
+ */
+static int64_t mtime_ns(const struct stat *st)
+{
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+/**
+ * Orders two cache keys by device, then inode.
+ *
+ * @return Negative, zero or positive like strcmp.
+ */
+static int compare_key(uint64_t dev_a, uint64_t ino_a, uint64_t dev_b, uint64_t ino_b)
+{
+    if (dev_a != dev_b)
+        return dev_a < dev_b ? -1 : 1;
+    if (ino_a != ino_b)
+        return ino_a < ino_b ? -1 : 1;
+    return 0;
+}
+
+/**
+ * qsort(3) comparator for candidates: by key, newest first within a key.
+ */
+static int compare_candidates(const void *a, const void *b)
+{
+    const CacheCandidate *x = a;
+    const CacheCandidate *y = b;
+    int key = compare_key(x->entry->dev, x->entry->ino, y->entry->dev, y->entry->ino);
+    return key ? key : x->order - y->order;
+}
+
+/**
+ * Writes a whole buffer to a descriptor.
+ *
+ * @return e_success if every byte was written, e_failure on error.
+ */
+static Status write_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return e_failure;
+        }
+        p += n;
+        len -= n;
+    }
+    return e_success;
+}
+
+/**
+ * Opens the metadata cache.
+ *
+ * @param cache The cache to open.
+ * @return e_success if caching is enabled (the cache may still be empty), e_failure if TAG_CACHE=off.
+ *
+ * @logic
+ * 1. Take the path from TAG_CACHE, or TAG_CACHE_PATH when it is unset.
+ * 2. Map the file read-only; lookups binary search the index in place.
+ * 3. A missing, short or foreign file is treated as an empty cache and replaced on the next save.
+ */
+Status open_tag_cache(TagCache *cache)
+{
+    const char *path = getenv(TAG_CACHE_ENV);
+    if (path && strcmp(path, "off") == 0)
+        return e_failure;
+    if (!path || !*path)
+        path = TAG_CACHE_PATH;
+
+    memset(cache, 0, sizeof(*cache));
+    snprintf(cache->path, sizeof(cache->path), "%s", path);
+    pthread_mutex_init(&cache->lock, NULL);
+
+    int fd = open(cache->path, O_RDONLY);
+    if (fd == -1)
+        return e_success;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CacheHeader))
+    {
+        close(fd);
+        return e_success;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("ERROR: mmap failed for tag cache");
+        return e_success;
+    }
+
+    const CacheHeader *header = map;
+    if (memcmp(header->magic, TAG_CACHE_MAGIC, 4) != 0 || header->version != TAG_CACHE_VERSION ||
+        header->records_end < sizeof(CacheHeader) || header->records_end % CACHE_RECORD_ALIGN != 0 ||
+        header->records_end + (uint64_t)header->entry_count * sizeof(CacheEntry) > (uint64_t)st.st_size)
+    {
+        munmap(map, st.st_size);
+        return e_success;
+    }
+
+    cache->map = map;
+    cache->map_len = st.st_size;
+    cache->header = header;
+    cache->entries = (const CacheEntry *)(cache->map + header->records_end);
+    return e_success;
+}
+
+/**
+ * Looks up the cache entry of a file.
+ *
+ * @param cache The cache.
+ * @param st Status of the file, as returned by stat(2).
+ * @return The entry, or NULL if the file is not cached or has changed since it was cached.
+ *
+ * @logic
+ * 1. Binary search the index for the file's device and inode.
+ * 2. Treat the entry as stale unless the size and nanosecond mtime still match.
+ */
+const CacheEntry *cache_lookup(const TagCache *cache, const struct stat *st)
+{
+    if (!cache->map)
+        return NULL;
+
+    uint32_t low = 0;
+    uint32_t high = cache->header->entry_count;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        const CacheEntry *entry = &cache->entries[mid];
+        int cmp = compare_key(entry->dev, entry->ino, st->st_dev, st->st_ino);
+        if (cmp == 0)
+        {
+            if (entry->size != (uint64_t)st->st_size || entry->mtime_ns != mtime_ns(st))
+                return NULL;
+            if (entry->record_offset + entry->record_len > cache->header->records_end)
+                return NULL;
+            return entry;
+        }
+        if (cmp < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return NULL;
+}
+
+/**
+ * Rebuilds a tag index from a cache entry.
+ *
+ * @param cache The cache the entry belongs to; must stay open while the index is used.
+ * @param entry The entry returned by cache_lookup.
+ * @param fd Descriptor of the file the cached tag belongs to, or -1 to leave truncated frames as they are.
+ * @param index The tag index to fill in; release it with free_tag_index().
+ * @param arena Arena for the frame list, or NULL to allocate it on the heap.
+ * @return e_success if the index was rebuilt, e_failure if the file has no tag or on error.
+ *
+ * @logic
+ * 1. Point the data of every stored frame straight into the cache mapping.
+ * 2. With a descriptor, read the full data of truncated text frames into one buffer owned
+ *    by the index. Pictures keep their stored prefix; the image is read from the descriptor
+ *    (index->fd) only while it is extracted.
+ */
+Status cache_load_index(const TagCache *cache, const CacheEntry *entry, int fd, TagIndex *index, Arena *arena)
+{
+    memset(index, 0, sizeof(*index));
+    index->arena = arena;
+    index->fd = fd;
+    if (!(entry->flags & CACHE_ENTRY_TAGGED))
+        return e_failure;
+
+    const uint8_t *record = cache->map + entry->record_offset;
+    const CacheFrame *frames = (const CacheFrame *)record;
+    uint8_t *data = (uint8_t *)record + entry->frame_count * sizeof(CacheFrame);
+
+    index->header_size = entry->header_size;
+    index->version = entry->version;
+    if (entry->flags & CACHE_ENTRY_DECODED)
+    {
+        index->decoded = 1;
+        index->fd = fd = -1;
+    }
+    index->frames_end = entry->frames_end;
+    index->audio_offset = entry->audio_offset;
+
+    if (entry->frame_count > 0)
+    {
+        size_t frames_size = entry->frame_count * sizeof(FrameEntry);
+        index->frames = (FrameEntry *)(arena ? arena_alloc(arena, frames_size) : malloc(frames_size));
+        if (!index->frames)
+        {
+            perror("ERROR: malloc failed for cached frame list");
+            return e_failure;
+        }
+    }
+
+    long missing = 0;
+    for (uint32_t i = 0; i < entry->frame_count; i++)
+    {
+        if (frames[i].stored < frames[i].size && strncmp(frames[i].id, "APIC", 4) != 0)
+            missing += frames[i].size;
+    }
+    if (fd >= 0 && missing > 0)
+    {
+        index->buffer = (uint8_t *)malloc(missing);
+        if (!index->buffer)
+        {
+            perror("ERROR: malloc failed for cached frame data");
+            free_tag_index(index);
+            return e_failure;
+        }
+    }
+
+    long loaded = 0;
+    for (uint32_t i = 0; i < entry->frame_count; i++)
+    {
+        FrameEntry *frame = &index->frames[i];
+        memcpy(frame->id, frames[i].id, 4);
+        frame->id[4] = '\0';
+        frame->offset = frames[i].offset;
+        frame->size = frames[i].size;
+        memcpy(frame->flags, frames[i].flags, 2);
+        frame->header_len = frames[i].header_len;
+        frame->data = data;
+        frame->available = frames[i].stored;
+        data += frames[i].stored;
+
+        if (frames[i].stored < frames[i].size && strncmp(frames[i].id, "APIC", 4) != 0 && index->buffer)
+        {
+            uint8_t *full = index->buffer + loaded;
+            if (pread(fd, full, frames[i].size, frames[i].offset + frames[i].header_len) == (ssize_t)frames[i].size)
+            {
+                frame->data = full;
+                frame->available = frames[i].size;
+            }
+            loaded += frames[i].size;
+        }
+        index->frame_count++;
+    }
+    index->buffer_len = loaded;
+    return e_success;
+}
+
+/**
+ * Works out how much of a frame's data is kept in the cache.
+ *
+ * @param frame The frame.
+ * @return The frame size up to CACHE_INLINE_LIMIT, else the CACHE_PREFIX_LIMIT prefix.
+ */
+static uint32_t stored_size(const FrameEntry *frame)
+{
+    uint32_t stored = frame->size <= CACHE_INLINE_LIMIT ? frame->size : CACHE_PREFIX_LIMIT;
+    return stored < frame->available ? stored : frame->available;
+}
+
+/**
+ * Records the parsed tag of a file for the next save.
+ *
+ * @param cache The cache.
+ * @param st Status of the file the index was built from.
+ * @param index The parsed tag, or NULL if the file has no ID3v2 tag.
+ * @return e_success if the entry was queued, e_failure on allocation failure.
+ *
+ * @logic
+ * 1. Lay out the record: a CacheFrame per frame, then the frame data. Frames up to
+ *    CACHE_INLINE_LIMIT bytes are kept whole; larger ones keep a CACHE_PREFIX_LIMIT prefix
+ *    and are flagged unless they are pictures, whose prefix is all a scan displays.
+ * 2. Queue the entry on the pending list under the cache lock.
+ */
+Status cache_put(TagCache *cache, const struct stat *st, const TagIndex *index)
+{
+    int frame_count = index ? index->frame_count : 0;
+    size_t record_len = frame_count * sizeof(CacheFrame);
+    for (int i = 0; i < frame_count; i++)
+        record_len += stored_size(&index->frames[i]);
+    record_len = (record_len + CACHE_RECORD_ALIGN - 1) & ~(size_t)(CACHE_RECORD_ALIGN - 1);
+
+    CachePending *pending = (CachePending *)calloc(1, sizeof(CachePending) + record_len);
+    if (!pending)
+    {
+        perror("ERROR: calloc failed for cache entry");
+        return e_failure;
+    }
+
+    CacheEntry *entry = &pending->entry;
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->size = st->st_size;
+    entry->mtime_ns = mtime_ns(st);
+    entry->record_len = record_len;
+    entry->flags = index ? CACHE_ENTRY_TAGGED : 0;
+    if (index && index->decoded)
+        entry->flags |= CACHE_ENTRY_DECODED;
+    entry->header_size = index ? index->header_size : 0;
+    entry->version = index ? index->version : 0;
+    entry->frame_count = frame_count;
+    entry->frames_end = index ? index->frames_end : 0;
+    entry->audio_offset = index ? index->audio_offset : 0;
+
+    CacheFrame *frames = (CacheFrame *)pending->record;
+    uint8_t *data = pending->record + frame_count * sizeof(CacheFrame);
+    for (int i = 0; i < frame_count; i++)
+    {
+        const FrameEntry *frame = &index->frames[i];
+        memcpy(frames[i].id, frame->id, 4);
+        memcpy(frames[i].flags, frame->flags, 2);
+        frames[i].header_len = frame->header_len;
+        frames[i].size = frame->size;
+        frames[i].stored = stored_size(frame);
+        frames[i].offset = frame->offset;
+        if (frames[i].stored < frame->size && (strncmp(frame->id, "APIC", 4) != 0 || index->decoded))
+            entry->flags |= CACHE_ENTRY_TRUNCATED;
+        memcpy(data, frame->data, frames[i].stored);
+        data += frames[i].stored;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    pending->next = cache->pending;
+    cache->pending = pending;
+    cache->pending_count++;
+    pthread_mutex_unlock(&cache->lock);
+    return e_success;
+}
+
+/**
+ * Queues the removal of a file from the cache.
+ *
+ * @param cache The cache.
+ * @param dev Device of the file.
+ * @param ino Inode of the file.
+ * @return e_success if the removal was queued, e_failure on allocation failure.
+ */
+Status cache_forget(TagCache *cache, uint64_t dev, uint64_t ino)
+{
+    CachePending *pending = (CachePending *)calloc(1, sizeof(CachePending));
+    if (!pending)
+    {
+        perror("ERROR: calloc failed for cache entry");
+        return e_failure;
+    }
+    pending->entry.dev = dev;
+    pending->entry.ino = ino;
+    pending->entry.flags = CACHE_ENTRY_DELETED;
+
+    pthread_mutex_lock(&cache->lock);
+    pending->next = cache->pending;
+    cache->pending = pending;
+    cache->pending_count++;
+    pthread_mutex_unlock(&cache->lock);
+    return e_success;
+}
+
+/**
+ * Copies the records of the current cache file into a new one at the same offsets.
+ *
+ * @param cache The cache.
+ * @param out_fd Descriptor of the new file, positioned after the header.
+ * @return e_success if the records were copied, e_failure on error.
+ */
+static Status copy_old_records(const TagCache *cache, int out_fd)
+{
+    int in_fd = open(cache->path, O_RDONLY);
+    if (in_fd == -1)
+        return e_failure;
+
+    long long length = cache->header->records_end - sizeof(CacheHeader);
+    CopyResult result;
+    Status status = e_failure;
+    if (lseek(in_fd, sizeof(CacheHeader), SEEK_SET) == (off_t)sizeof(CacheHeader) &&
+        copy_fd(in_fd, out_fd, length, &result) == e_success && result.bytes == length)
+        status = e_success;
+    close(in_fd);
+    return status;
+}
+
+/**
+ * Writes the pending entries to the cache file.
+ *
+ * @param cache The cache.
+ * @return e_success if the cache was saved (or nothing was pending), e_failure on error.
+ *
+ * @logic
+ * 1. Merge the pending entries with the entries of the current file, keeping the newest per file
+ *    and dropping files whose newest entry is a removal.
+ * 2. Write a new file next to the cache: the old records are copied wholesale with `copy_fd`
+ *    (a reflink on filesystems that support it) so their offsets stay valid, unless more than
+ *    half of them are dead, in which case only the live records are rewritten.
+ * 3. Append the new records, then the sorted index, then fill in the header.
+ * 4. Rename the new file over the cache, so readers always see a complete cache.
+ */
+Status save_tag_cache(TagCache *cache)
+{
+    if (cache->pending_count == 0)
+        return e_success;
+
+    int old_count = cache->map ? cache->header->entry_count : 0;
+    CacheCandidate *candidates = (CacheCandidate *)malloc((cache->pending_count + old_count) * sizeof(CacheCandidate));
+    CacheEntry *entries = (CacheEntry *)malloc((cache->pending_count + old_count) * sizeof(CacheEntry));
+    if (!candidates || !entries)
+    {
+        perror("ERROR: malloc failed while saving tag cache");
+        free(candidates);
+        free(entries);
+        return e_failure;
+    }
+
+    int count = 0;
+    for (CachePending *pending = cache->pending; pending; pending = pending->next, count++)
+        candidates[count] = (CacheCandidate){&pending->entry, pending->record, count};
+    for (int i = 0; i < old_count; i++, count++)
+        candidates[count] = (CacheCandidate){&cache->entries[i], cache->map + cache->entries[i].record_offset, count};
+    qsort(candidates, count, sizeof(CacheCandidate), compare_candidates);
+
+    int kept = 0;
+    uint64_t live_old = 0;
+    const CacheEntry *previous = NULL;
+    for (int i = 0; i < count; i++)
+    {
+        const CacheEntry *entry = candidates[i].entry;
+        if (previous && compare_key(previous->dev, previous->ino, entry->dev, entry->ino) == 0)
+            continue;
+        previous = entry;
+        if (entry->flags & CACHE_ENTRY_DELETED)
+            continue;
+        candidates[kept++] = candidates[i];
+        if (candidates[i].order >= cache->pending_count)
+            live_old += candidates[i].entry->record_len;
+    }
+
+    uint64_t old_records = cache->map ? cache->header->records_end - sizeof(CacheHeader) : 0;
+    int compact = old_records > 2 * live_old + CACHE_COMPACT_SLACK;
+
+    char temp_path[MAX_PATH_LENGTH + 32];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp.%d", cache->path, (int)getpid());
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        perror("ERROR: Cannot create tag cache");
+        free(candidates);
+        free(entries);
+        return e_failure;
+    }
+
+    Status status = lseek(fd, sizeof(CacheHeader), SEEK_SET) == (off_t)sizeof(CacheHeader) ? e_success : e_failure;
+    uint64_t pos = sizeof(CacheHeader);
+    if (status == e_success && old_records > 0 && !compact)
+    {
+        status = copy_old_records(cache, fd);
+        pos += old_records;
+    }
+
+    uint64_t live = 0;
+    for (int i = 0; i < kept && status == e_success; i++)
+    {
+        entries[i] = *candidates[i].entry;
+        live += entries[i].record_len;
+        if (candidates[i].order >= cache->pending_count && !compact)
+            continue;
+
+        status = write_all(fd, candidates[i].record, entries[i].record_len);
+        entries[i].record_offset = pos;
+        pos += entries[i].record_len;
+    }
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TAG_CACHE_MAGIC, 4);
+    header.version = TAG_CACHE_VERSION;
+    header.entry_count = kept;
+    header.records_end = pos;
+    header.live_bytes = live;
+
+    if (status == e_success)
+        status = write_all(fd, entries, kept * sizeof(CacheEntry));
+    if (status == e_success && pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+        status = e_failure;
+    if (close(fd) != 0)
+        status = e_failure;
+    if (status == e_success && rename(temp_path, cache->path) != 0)
+        status = e_failure;
+    if (status == e_failure)
+    {
+        perror("ERROR: Failed to save tag cache");
+        unlink(temp_path);
+    }
+
+    free(candidates);
+    free(entries);
+
+    while (cache->pending)
+    {
+        CachePending *next = cache->pending->next;
+        free(cache->pending);
+        cache->pending = next;
+    }
+    cache->pending_count = 0;
+    return status;
+}
+
+/**
+ * Indexes the tag of an open file, serving it from the cache when possible.
+ *
+ * @param cache The cache; must stay open while the index is used.
+ * @param fd Descriptor of the file; must stay open while the index is used.
+ * @param index The tag index to fill in; release it with free_tag_index().
+ * @return e_success if the file has a tag, e_failure otherwise.
+ *
+ * @logic
+ * 1. Look the file up by device, inode, size and mtime.
+ * 2. On a hit, rebuild the index from the cache; pictures are left in the file and
+ *    truncated text frames are read from it.
+ * 3. On a miss, read and parse the tag and queue it for the next save. A decoded
+ *    (unsynchronised) tag the cache could not keep whole counts as a miss, as its
+ *    frames cannot be read back from the file.
+ */
+Status cached_tag_index(TagCache *cache, int fd, TagIndex *index)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return read_tag_index(fd, index, NULL);
+
+    const CacheEntry *entry = cache_lookup(cache, &st);
+    int complete = entry && !((entry->flags & CACHE_ENTRY_DECODED) && (entry->flags & CACHE_ENTRY_TRUNCATED));
+    if (complete)
+        return cache_load_index(cache, entry, fd, index, NULL);
+
+    Status status = read_tag_index(fd, index, NULL);
+    cache_put(cache, &st, status == e_success ? index : NULL);
+    return status;
+}
+
+/**
+ * Unmaps the cache and frees any entries that were not saved.
+ *
+ * @param cache The cache.
+ */
+void close_tag_cache(TagCache *cache)
+{
+    if (cache->map)
+        munmap(cache->map, cache->map_len);
+    while (cache->pending)
+    {
+        CachePending *next = cache->pending->next;
+        free(cache->pending);
+        cache->pending = next;
+    }
+    pthread_mutex_destroy(&cache->lock);
+    memset(cache, 0, sizeof(*cache));
+}
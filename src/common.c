@@ -1,4 +1,8 @@
 #include "common.h"
+#include "tag_index.h"
+#include "copy.h"
+#include <pthread.h>
+#include <unistd.h>
 
 ID3TagMapping tagMappings[NUM_TAGS] = {
     {"AENC", "Audio encryption"},
@@ -88,6 +92,101 @@ ID3TagMapping tagMappings[NUM_TAGS] = {
 
 char valid_MIME[4][3] = {"jpg", "png", "bmp", "gif"};
 
+static uint8_t tag_slots[TAG_TABLE_SIZE];   // Index + 1 of the tag hashed to each slot, or 0 if empty.
+static uint32_t slot_keys[TAG_TABLE_SIZE];  // Integer key of the tag in each slot.
+static FrameKind tag_kinds[NUM_TAGS];       // Frame kind of each tag in `tagMappings`.
+static pthread_once_t tag_table_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Packs a 4-byte frame ID into a 32-bit key.
+ *
+ * @param tag The frame ID; only the first four bytes are read.
+ * @return The bytes as a big-endian integer.
+ */
+static uint32_t tag_key(const char *tag)
+{
+    const uint8_t *p = (const uint8_t *)tag;
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static unsigned int tag_slot(uint32_t key)
+{
+    return (key * TAG_HASH_MULTIPLIER) >> (32 - TAG_TABLE_BITS);
+}
+
+/**
+ * Works out how a frame is laid out from its ID.
+ *
+ * @param tag The frame ID.
+ * @return The kind of the frame.
+ */
+static FrameKind classify_tag(const char *tag)
+{
+    if (strncmp(tag, "APIC", 4) == 0)
+        return e_frame_apic;
+    if (strncmp(tag, "COMM", 4) == 0 || strncmp(tag, "USLT", 4) == 0 || strncmp(tag, "USER", 4) == 0)
+        return e_frame_comment;
+    if (tag[0] == 'T')
+        return e_frame_text;
+    if (tag[0] == 'W')
+        return e_frame_url;
+    return e_frame_binary;
+}
+
+/**
+ * Builds the frame ID table from `tagMappings`, once per process.
+ *
+ * @logic
+ * 1. Hash every ID's 32-bit key into TAG_TABLE_SIZE slots; TAG_HASH_MULTIPLIER places
+ *    all the IDs of `tagMappings` in distinct slots, so a lookup is a single probe.
+ * 2. Linear probing keeps the table correct if entries are added that collide.
+ * 3. Record the frame kind of every ID for the per-frame dispatch.
+ */
+static void build_tag_table(void)
+{
+    for (int i = 0; i < NUM_TAGS; i++)
+    {
+        uint32_t key = tag_key(tagMappings[i].tag);
+        unsigned int slot = tag_slot(key);
+        while (tag_slots[slot])
+            slot = (slot + 1) & (TAG_TABLE_SIZE - 1);
+        tag_slots[slot] = i + 1;
+        slot_keys[slot] = key;
+        tag_kinds[i] = classify_tag(tagMappings[i].tag);
+    }
+}
+
+/**
+ * Looks up a 4-byte frame ID in the tag mappings.
+ *
+ * @param tag The frame ID; only the first four bytes are read.
+ * @return The index of the tag in `tagMappings`, or -1 if it is not known.
+ *
+ * @logic
+ * 1. Build the table on first use.
+ * 2. Probe from the hashed slot until the key matches or an empty slot is reached.
+ */
+int tag_lookup(const char *tag)
+{
+    pthread_once(&tag_table_once, build_tag_table);
+    uint32_t key = tag_key(tag);
+    for (unsigned int slot = tag_slot(key); tag_slots[slot]; slot = (slot + 1) & (TAG_TABLE_SIZE - 1))
+    {
+        if (slot_keys[slot] == key)
+            return tag_slots[slot] - 1;
+    }
+    return -1;
+}
+
+/**
+ * Returns the frame kind of a tag found with `tag_lookup`.
+ */
+FrameKind tag_kind(int tag_index)
+{
+    pthread_once(&tag_table_once, build_tag_table);
+    return tag_kinds[tag_index];
+}
+
 /**
  * Checks if a given tag is a valid ID3v2 tag and returns its index.
  *
@@ -96,22 +195,16 @@ char valid_MIME[4][3] = {"jpg", "png", "bmp", "gif"};
  * @return e_success if the tag is valid, e_failure otherwise.
  *
  * @logic
- * 1. Iterate through the `tagMappings` array.
- * 2. Compare the input `tag` with each tag in the array.
- * 3. If a match is found, store the index and return e_success.
- * 4. If no match is found after iterating through all mappings, return e_failure.
+ * 1. Look the tag up with `tag_lookup`.
+ * 2. If it is found, store its index and return e_success; otherwise return e_failure.
  */
 Status is_valid_tag_W_index(const char *tag, int *tag_index)
 {
-    for (int i = 0; i < 83; i++)
-    {
-        if (strncmp(tag, tagMappings[i].tag, 4) == 0)
-        {
-            *tag_index = i;
-            return e_success;
-        }
-    }
-    return e_failure;
+    int found = tag_lookup(tag);
+    if (found < 0)
+        return e_failure;
+    *tag_index = found;
+    return e_success;
 }
 
 /**
@@ -119,23 +212,10 @@ Status is_valid_tag_W_index(const char *tag, int *tag_index)
  *
  * @param tag The 4-byte tag name to check.
  * @return e_success if the tag is valid, e_failure otherwise.
- *
- * @logic
- * 1. Iterate through the `tagMappings` array.
- * 2. Compare the input `tag` with each tag in the array.
- * 3. If a match is found, return e_success.
- * 4. If no match is found after iterating through all mappings, return e_failure.
  */
 Status is_valid_tag(const char *tag)
 {
-    for (int i = 0; i < 83; i++)
-    {
-        if (strncmp(tag, tagMappings[i].tag, 4) == 0)
-        {
-            return e_success;
-        }
-    }
-    return e_failure;
+    return tag_lookup(tag) < 0 ? e_failure : e_success;
 }
 
 /**
@@ -145,22 +225,16 @@ Status is_valid_tag(const char *tag)
  * @return The index of the tag in `tagMappings`, or 0 if not found.
  *
  * @logic
- * 1. Iterate through the `tagMappings` array.
- * 2. Compare the input `tag` with each tag in the array.
- * 3. If a match is found, return the index.
- * 4. If no match is found, return 0 (the index of the first tag).
+ * 1. Reject names that are not exactly four characters long.
+ * 2. Look the tag up with `tag_lookup`.
+ * 3. If no match is found, return 0 (the index of the first tag).
  */
 int flag_to_tag(char *tag)
 {
-    for (int i = 0; i < NUM_TAGS; i++)
-    {
-        if (strcmp(tag, tagMappings[i].tag) == 0)
-        {
-            return i;
-        }
-    }
-
-    return 0;
+    if (strlen(tag) != 4)
+        return 0;
+    int found = tag_lookup(tag);
+    return found < 0 ? 0 : found;
 }
 
 /**
@@ -225,17 +299,40 @@ char *is_valid_image(const char *image_name)
  * @return e_success on successful copy, e_failure on error.
  *
  * @logic
- * 1. Read one byte at a time from the source file.
- * 2. Write the read byte to the destination file.
- * 3. Continue until the end of the source file is reached.
+ * 1. Flush the destination stream and line up both descriptors with their stream positions.
+ * 2. Hand the copy to copy_fd, which uses copy_file_range/sendfile/splice
+ *    and falls back to a large aligned buffer.
+ * 3. Move both streams past the copied bytes and log the bytes moved and the strategy.
  */
 Status copy_remaining_bits(FILE *source, FILE *destination)
 {
-    uint8_t temp;
-    while (fread(&temp, 1, 1, source) > 0)
+    if (fflush(destination) != 0)
+    {
+        perror("ERROR: fflush failed before copying");
+        return e_failure;
+    }
+
+    long in_pos = ftell(source);
+    long out_pos = ftell(destination);
+    int in_fd = fileno(source);
+    int out_fd = fileno(destination);
+    if (lseek(in_fd, in_pos, SEEK_SET) < 0 || lseek(out_fd, out_pos, SEEK_SET) < 0)
+    {
+        perror("ERROR: lseek failed before copying");
+        return e_failure;
+    }
+
+    CopyResult result;
+    Status status = copy_fd(in_fd, out_fd, -1, &result);
+
+    fseek(source, in_pos + result.bytes, SEEK_SET);
+    fseek(destination, out_pos + result.bytes, SEEK_SET);
+    if (status == e_failure)
     {
-        fwrite(&temp, 1, 1, destination);
+        return e_failure;
     }
+
+    fprintf(stdout, "LOG: Copied %lld bytes using %s.\n", result.bytes, copy_strategy_name(result.strategy));
     return e_success;
 }
 
@@ -295,77 +392,58 @@ int size_of_the_file(FILE *file)
  * Converts an integer size to a 4-byte array (standard ID3v2 size encoding).
  *
  * @param num The integer size to convert.
- * @return A pointer to a dynamically allocated 4-byte array representing the size.
- * The caller is responsible for freeing this memory. Returns NULL on error.
+ * @param bytes Caller-provided 4-byte destination for the encoded size.
  *
  * @logic
- * 1. Allocate 4 bytes of memory.
- * 2. Extract each byte of the integer using bitwise right shifts and AND operations.
- * 3. Store the bytes in big-endian order in the allocated array.
+ * 1. Extract each byte of the integer using bitwise right shifts and AND operations.
+ * 2. Store the bytes in big-endian order in the caller's array.
  */
-char *convert_size(int num)
+void convert_size(int num, uint8_t bytes[4])
 {
-    unsigned char *bytes = (uint8_t *)malloc(4 * sizeof(char));
     bytes[0] = (num >> 24) & 0xFF;
     bytes[1] = (num >> 16) & 0xFF;
     bytes[2] = (num >> 8) & 0xFF;
     bytes[3] = num & 0xFF;
-
-    return bytes;
 }
 
 /**
  * Converts an integer size to a 4-byte array (ID3v2 header size encoding - 7 bits per byte).
  *
  * @param num The integer size to convert.
- * @return A pointer to a dynamically allocated 4-byte array representing the encoded size.
- * The caller is responsible for freeing this memory. Returns NULL on error.
+ * @param bytes Caller-provided 4-byte destination for the encoded size.
  *
  * @logic
- * 1. Allocate 4 bytes of memory.
- * 2. Extract 7 bits at a time from the integer using bitwise right shifts and AND operations.
- * 3. Store the 7-bit values in the allocated array.
+ * 1. Extract 7 bits at a time from the integer using bitwise right shifts and AND operations.
+ * 2. Store the 7-bit values in the caller's array.
  */
-char *convert_header_size(int num)
+void convert_header_size(int num, uint8_t bytes[4])
 {
-    unsigned char *bytes = (uint8_t *)malloc(4 * sizeof(char));
     bytes[0] = (num >> 21) & 0x7F;
     bytes[1] = (num >> 14) & 0x7F;
     bytes[2] = (num >> 7) & 0x7F;
     bytes[3] = num & 0x7F;
-
-    return bytes;
 }
 
 /**
  * Determines the file offset marking the end of the ID3v2 header.
  *
  * @param mp3 File pointer to the MP3 file.
- * @return The offset (in bytes) where the audio data begins.
+ * @return The offset (in bytes) just past the last ID3v2 frame, or -1 on error.
  *
  * @logic
- * 1. Seek to the start of the tag data area (10 bytes from the beginning).
- * 2. Continuously read 4 bytes as a potential tag name.
- * 3. validate ID3v2 tag.
- * 4. If not a valid tag, the current file pointer position minus 4 is the end of the header.
- * 5. If it is a valid tag, read the 4-byte tag size.
- * 6. Skip the 2-byte flags and the tag data based on the read size.
- * 7. Repeat until an invalid tag is encountered.
+ * 1. Build the tag index in a single pass over the header.
+ * 2. Return the offset just past the last indexed frame.
+ * 3. Leave the file positioned at that offset.
  */
 int end_of_header(FILE *mp3)
 {
-    fseek(mp3, 10, SEEK_SET);
-    while (1)
+    TagIndex index;
+    if (build_tag_index(mp3, &index) == e_failure)
     {
-        char curent_tag[4];
-        fread(curent_tag, 1, 4, mp3);
-        if (is_valid_tag(curent_tag) == e_failure)
-        {
-            return ftell(mp3) - 4;
-        }
-        uint8_t Tag_size[4];
-        fread(&Tag_size, 1, 4, mp3);
-        int size = id3v2_tag_size(Tag_size);
-        fseek(mp3, ftell(mp3) + 2 + size, SEEK_SET);
+        return -1;
     }
+    int end = index.frames_end;
+    free_tag_index(&index);
+    fseek(mp3, end, SEEK_SET);
+    return end;
 }
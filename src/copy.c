@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+#include "copy.h"
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+#define KERNEL_COPY_CHUNK (1 << 30) // Largest request handed to the kernel in one call.
+
+/**
+ * Works out how many bytes the next copy call may move.
+ *
+ * @param remaining Bytes left to copy, or negative to copy until end of file.
+ * @param chunk The largest request size.
+ * @return The size of the next request.
+ */
+static size_t next_chunk(long long remaining, size_t chunk)
+{
+    if (remaining < 0 || remaining > (long long)chunk)
+        return chunk;
+    return (size_t)remaining;
+}
+
+/**
+ * Checks whether a failed kernel copy call means the strategy is unsupported for these descriptors.
+ *
+ * @param err The errno value of the failed call.
+ * @return 1 if another strategy should be tried, 0 for a real I/O error.
+ */
+static int unsupported(int err)
+{
+    return err == EINVAL || err == EXDEV || err == ENOSYS || err == EOPNOTSUPP || err == EBADF || err == ESPIPE;
+}
+
+/**
+ * Copies with copy_file_range(2), which lets the filesystem share or clone extents.
+ *
+ * @return e_success if the copy finished, e_failure if the strategy is unavailable or failed.
+ */
+static Status copy_with_file_range(int in_fd, int out_fd, long long *remaining, CopyResult *result)
+{
+    while (*remaining != 0)
+    {
+        ssize_t n = copy_file_range(in_fd, NULL, out_fd, NULL, next_chunk(*remaining, KERNEL_COPY_CHUNK), 0);
+        if (n < 0)
+            return e_failure;
+        if (n == 0)
+            break;
+        result->bytes += n;
+        result->strategy = e_copy_file_range;
+        if (*remaining > 0)
+            *remaining -= n;
+    }
+    return e_success;
+}
+
+/**
+ * Copies with sendfile(2), which moves data through the page cache without a user buffer.
+ *
+ * @return e_success if the copy finished, e_failure if the strategy is unavailable or failed.
+ */
+static Status copy_with_sendfile(int in_fd, int out_fd, long long *remaining, CopyResult *result)
+{
+    while (*remaining != 0)
+    {
+        ssize_t n = sendfile(out_fd, in_fd, NULL, next_chunk(*remaining, KERNEL_COPY_CHUNK));
+        if (n < 0)
+            return e_failure;
+        if (n == 0)
+            break;
+        result->bytes += n;
+        result->strategy = e_copy_sendfile;
+        if (*remaining > 0)
+            *remaining -= n;
+    }
+    return e_success;
+}
+
+/**
+ * Copies with splice(2) through an intermediate pipe.
+ *
+ * @return e_success if the copy finished, e_failure if the strategy is unavailable or failed.
+ */
+static Status copy_with_splice(int in_fd, int out_fd, long long *remaining, CopyResult *result)
+{
+    int pipe_fd[2];
+    if (pipe(pipe_fd) != 0)
+        return e_failure;
+
+    Status status = e_success;
+    while (*remaining != 0)
+    {
+        ssize_t n = splice(in_fd, NULL, pipe_fd[1], NULL, next_chunk(*remaining, COPY_BUFFER_SIZE), SPLICE_F_MOVE);
+        if (n < 0)
+        {
+            status = e_failure;
+            break;
+        }
+        if (n == 0)
+            break;
+
+        ssize_t left = n;
+        while (left > 0)
+        {
+            ssize_t out = splice(pipe_fd[0], NULL, out_fd, NULL, left, SPLICE_F_MOVE);
+            if (out <= 0)
+            {
+                // Bytes already in the pipe cannot be handed to another strategy.
+                perror("ERROR: splice failed while draining the pipe");
+                errno = EIO;
+                close(pipe_fd[0]);
+                close(pipe_fd[1]);
+                return e_failure;
+            }
+            left -= out;
+        }
+        result->bytes += n;
+        result->strategy = e_copy_splice;
+        if (*remaining > 0)
+            *remaining -= n;
+    }
+    int saved_errno = errno;
+    close(pipe_fd[0]);
+    close(pipe_fd[1]);
+    errno = saved_errno;
+    return status;
+}
+
+/**
+ * Copies through a large aligned user-space buffer with read(2)/write(2).
+ *
+ * @return e_success if the copy finished, e_failure on an I/O error.
+ */
+static Status copy_with_buffer(int in_fd, int out_fd, long long *remaining, CopyResult *result)
+{
+    void *buffer;
+    if (posix_memalign(&buffer, COPY_BUFFER_ALIGN, COPY_BUFFER_SIZE) != 0)
+    {
+        perror("ERROR: posix_memalign failed for copy buffer");
+        return e_failure;
+    }
+
+    while (*remaining != 0)
+    {
+        ssize_t n = read(in_fd, buffer, next_chunk(*remaining, COPY_BUFFER_SIZE));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("ERROR: read failed while copying");
+            free(buffer);
+            return e_failure;
+        }
+        if (n == 0)
+            break;
+
+        ssize_t written = 0;
+        while (written < n)
+        {
+            ssize_t w = write(out_fd, (char *)buffer + written, n - written);
+            if (w < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                perror("ERROR: write failed while copying");
+                free(buffer);
+                return e_failure;
+            }
+            written += w;
+        }
+        result->bytes += n;
+        result->strategy = e_copy_buffered;
+        if (*remaining > 0)
+            *remaining -= n;
+    }
+    free(buffer);
+    return e_success;
+}
+
+/**
+ * Copies bytes between two file descriptors using the fastest strategy available.
+ *
+ * @param in_fd Source descriptor, read from its current offset.
+ * @param out_fd Destination descriptor, written at its current offset.
+ * @param length Number of bytes to copy, or negative to copy until end of file.
+ * @param result Receives the number of bytes moved and the strategy used.
+ * @return e_success on successful copy, e_failure on error.
+ *
+ * @logic
+ * 1. Try copy_file_range, then sendfile, then splice through a pipe.
+ * 2. When a strategy reports that it does not support these descriptors,
+ *    fall through to the next one, continuing from where the last one stopped.
+ * 3. Finish with the aligned read/write buffer, which works for any descriptors.
+ */
+Status copy_fd(int in_fd, int out_fd, long long length, CopyResult *result)
+{
+    static Status (*const strategies[])(int, int, long long *, CopyResult *) = {
+        copy_with_file_range,
+        copy_with_sendfile,
+        copy_with_splice,
+    };
+
+    result->bytes = 0;
+    result->strategy = e_copy_none;
+    long long remaining = length;
+
+    for (size_t i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++)
+    {
+        if (strategies[i](in_fd, out_fd, &remaining, result) == e_success)
+            return e_success;
+        if (!unsupported(errno))
+        {
+            perror("ERROR: kernel copy failed");
+            return e_failure;
+        }
+    }
+    return copy_with_buffer(in_fd, out_fd, &remaining, result);
+}
+
+/**
+ * Returns a printable name for a copy strategy.
+ *
+ * @param strategy The copy strategy.
+ * @return A constant string naming the strategy.
+ */
+const char *copy_strategy_name(CopyStrategy strategy)
+{
+    switch (strategy)
+    {
+    case e_copy_file_range:
+        return "copy_file_range";
+    case e_copy_sendfile:
+        return "sendfile";
+    case e_copy_splice:
+        return "splice";
+    case e_copy_buffered:
+        return "buffered read/write";
+    default:
+        return "none";
+    }
+}
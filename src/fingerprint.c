@@ -0,0 +1,266 @@
+#define _GNU_SOURCE
+#include "fingerprint.h"
+#include "audio.h"
+#include "pool.h"
+#include "scan.h"
+#include "tag_index.h"
+#include "xxh64.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct
+{
+    pthread_mutex_t lock; // Guards the results.
+    AudioHash *results;
+    long count;
+    long capacity;
+    long skipped;         // Files that hold no MPEG audio.
+} HashContext;
+
+/**
+ * Hashes the audio of an MP3 file.
+ *
+ * @param fd Descriptor of the file.
+ * @param chunk FINGERPRINT_CHUNK bytes of scratch space.
+ * @param result Receives the hash and the number of bytes hashed; path is left alone.
+ * @return e_success if the audio was hashed, e_failure on a read error (result->error is set)
+ *         or if the file holds no MPEG audio (result->error is 0).
+ *
+ * @logic
+ * 1. The audio starts where the tag index says it does: after the ID3v2 tag, its
+ *    padding and any footer, or at 0 for a file without a tag. Copies that differ
+ *    only in their tags therefore hash the same.
+ * 2. It ends before any ID3v1 or APEv2 trailer, found with `audio_data_end`.
+ * 3. Give up unless MPEG audio frames start there, past any padding
+ *    (`audio_starts_with_frame`), so the other files of a library are not hashed as audio.
+ * 4. Stream the range through XXH64 in FINGERPRINT_CHUNK preads, telling the kernel
+ *    the file is read once from start to end.
+ */
+Status hash_audio(int fd, uint8_t *chunk, AudioHash *result)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        result->error = errno;
+        return e_failure;
+    }
+    long start = 0;
+    TagIndex index;
+    if (read_tag_index(fd, &index, NULL) == e_success)
+    {
+        start = index.audio_offset < st.st_size ? index.audio_offset : st.st_size;
+        free_tag_index(&index);
+    }
+    long end = audio_data_end(fd, start, st.st_size);
+    if (!audio_starts_with_frame(fd, start, end))
+    {
+        result->error = 0;
+        return e_failure;
+    }
+    posix_fadvise(fd, start, end - start, POSIX_FADV_SEQUENTIAL);
+
+    Xxh64 hash;
+    xxh64_init(&hash, FINGERPRINT_SEED);
+    for (long pos = start; pos < end;)
+    {
+        size_t want = end - pos < FINGERPRINT_CHUNK ? (size_t)(end - pos) : FINGERPRINT_CHUNK;
+        ssize_t n = pread(fd, chunk, want, pos);
+        if (n <= 0)
+        {
+            result->error = n < 0 ? errno : EIO;
+            return e_failure;
+        }
+        xxh64_update(&hash, chunk, n);
+        pos += n;
+    }
+    result->hash = xxh64_final(&hash);
+    result->bytes = end - start;
+    result->error = 0;
+    return e_success;
+}
+
+/**
+ * Hashes one file and records the result; a file that holds no MPEG audio is only counted.
+ *
+ * @param worker The worker running the task; its local state is its read buffer.
+ * @param arg The ScanEntry of the file; the result takes a copy of its path.
+ */
+static void hash_file_task(Worker *worker, void *arg)
+{
+    ScanEntry *entry = arg;
+    HashContext *ctx = worker->pool->ctx;
+    AudioHash result = {NULL, 0, 0, 0};
+    int fd = open(entry->path, O_RDONLY);
+    Status status = e_failure;
+    if (fd == -1)
+    {
+        result.error = errno;
+    }
+    else
+    {
+        status = hash_audio(fd, worker->local, &result);
+        close(fd);
+    }
+    int skipped = status == e_failure && result.error == 0;
+    if (!skipped)
+        result.path = strdup(entry->path);
+    release_entry(entry);
+
+    pthread_mutex_lock(&ctx->lock);
+    if (skipped || !result.path)
+    {
+        ctx->skipped += skipped;
+        pthread_mutex_unlock(&ctx->lock);
+        if (!skipped)
+            perror("ERROR: malloc failed for path");
+        return;
+    }
+    if (ctx->count == ctx->capacity)
+    {
+        long capacity = ctx->capacity ? ctx->capacity * 2 : 256;
+        AudioHash *grown = (AudioHash *)realloc(ctx->results, capacity * sizeof(AudioHash));
+        if (grown)
+        {
+            ctx->results = grown;
+            ctx->capacity = capacity;
+        }
+    }
+    if (ctx->count < ctx->capacity)
+        ctx->results[ctx->count++] = result;
+    else
+        free(result.path);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+/**
+ * Queues the hashing of a file found by the walk on the listing worker's deque, where
+ * idle workers steal it: the hashing of large files spreads over every core.
+ */
+static void hash_visit_file(Worker *worker, ScanEntry *entry)
+{
+    submit_task(worker, hash_file_task, entry);
+}
+
+static int by_path(const void *a, const void *b)
+{
+    return strcmp(((const AudioHash *)a)->path, ((const AudioHash *)b)->path);
+}
+
+// Orders by audio (hash, then size), so duplicates end up next to each other, then by path.
+static int by_audio(const void *a, const void *b)
+{
+    const AudioHash *x = a, *y = b;
+    if (x->error != y->error)
+        return x->error < y->error ? -1 : 1;
+    if (x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
+    if (x->bytes != y->bytes)
+        return x->bytes < y->bytes ? -1 : 1;
+    return strcmp(x->path, y->path);
+}
+
+/**
+ * Prints the groups of files whose audio is identical.
+ *
+ * @param results The hashes, sorted with `by_audio`.
+ * @param count Number of results.
+ *
+ * @logic
+ * 1. Files match when both the hash and the audio size are equal.
+ * 2. Every copy after the first in a group is counted as redundant storage.
+ */
+static void report_duplicates(const AudioHash *results, long count)
+{
+    long groups = 0, copies = 0;
+    long long wasted = 0;
+    for (long i = 0; i < count;)
+    {
+        long j = i + 1;
+        while (j < count && !results[i].error && !results[j].error && results[j].hash == results[i].hash && results[j].bytes == results[i].bytes)
+            j++;
+        if (j - i > 1 && results[i].bytes > 0)
+        {
+            fprintf(stdout, "\n==> %016llx: %lld bytes of audio in %ld files <==\n", (unsigned long long)results[i].hash, results[i].bytes, j - i);
+            for (long k = i; k < j; k++)
+                fprintf(stdout, "%s\n", results[k].path);
+            groups++;
+            copies += j - i - 1;
+            wasted += (j - i - 1) * results[i].bytes;
+        }
+        i = j;
+    }
+    fprintf(stdout, "\nLOG: Found %ld groups of identical audio with %ld redundant copies holding %lld bytes.\n", groups, copies, wasted);
+}
+
+/**
+ * Hashes the audio of every file in a directory tree.
+ *
+ * @param root Directory to walk recursively.
+ * @param duplicates Non-zero to print only the groups of files with identical audio.
+ * @return e_success if the tree was walked, e_failure on error.
+ *
+ * @logic
+ * 1. Walk the tree with `walk_library` on a work-stealing pool with one worker per online
+ *    core, each with its own FINGERPRINT_CHUNK read buffer; `hash_audio` does the work per file.
+ * 2. Sort the results: by path for the list of hashes, by audio for the duplicate report.
+ * 3. Print "<hash>  <bytes>  <path>" per file, or the groups from `report_duplicates`.
+ */
+Status hash_library(const char *root, int duplicates)
+{
+    struct stat st;
+    if (stat(root, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        fprintf(stderr, "ERROR: %s is not a directory\n", root);
+        return e_failure;
+    }
+
+    HashContext ctx = {.lock = PTHREAD_MUTEX_INITIALIZER};
+    WorkPool pool;
+    if (init_pool(&pool, pool_thread_count(), &ctx) == e_failure)
+        return e_failure;
+
+    Status status = e_success;
+    for (int i = 0; i < pool.worker_count && status == e_success; i++)
+    {
+        pool.workers[i].local = malloc(FINGERPRINT_CHUNK);
+        if (!pool.workers[i].local)
+        {
+            perror("ERROR: malloc failed for read buffer");
+            status = e_failure;
+        }
+    }
+    ScanWalk walk = {.visit_file = hash_visit_file};
+    if (status == e_success)
+        status = walk_library(&pool, &walk, root);
+
+    int workers = pool.worker_count;
+    for (int i = 0; i < pool.worker_count; i++)
+        free(pool.workers[i].local);
+    free_pool(&pool);
+
+    long long total = 0;
+    long errors = 0;
+    if (status == e_success)
+    {
+        qsort(ctx.results, ctx.count, sizeof(AudioHash), duplicates ? by_audio : by_path);
+        for (long i = 0; i < ctx.count; i++)
+        {
+            const AudioHash *result = &ctx.results[i];
+            total += result->bytes;
+            errors += result->error != 0;
+            if (result->error)
+                fprintf(stderr, "ERROR: %s: %s\n", result->path, strerror(result->error));
+            else if (!duplicates)
+                fprintf(stdout, "%016llx  %lld  %s\n", (unsigned long long)result->hash, result->bytes, result->path);
+        }
+        if (duplicates)
+            report_duplicates(ctx.results, ctx.count);
+        fprintf(stdout, "LOG: Hashed %lld bytes of audio in %ld files (%ld unreadable, %ld not MPEG audio) using %d threads.\n", total, ctx.count - errors, errors, ctx.skipped, workers);
+    }
+
+    for (long i = 0; i < ctx.count; i++)
+        free(ctx.results[i].path);
+    free(ctx.results);
+    return status;
+}
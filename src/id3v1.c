@@ -0,0 +1,268 @@
+#include "id3v1.h"
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Genre names of the ID3v1 genre byte: the 80 of the original list, then the Winamp extensions.
+static const char *const id3v1_genres[] = {
+    "Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge", "Hip-Hop",
+    "Jazz", "Metal", "New Age", "Oldies", "Other", "Pop", "R&B", "Rap",
+    "Reggae", "Rock", "Techno", "Industrial", "Alternative", "Ska", "Death Metal", "Pranks",
+    "Soundtrack", "Euro-Techno", "Ambient", "Trip-Hop", "Vocal", "Jazz+Funk", "Fusion", "Trance",
+    "Classical", "Instrumental", "Acid", "House", "Game", "Sound Clip", "Gospel", "Noise",
+    "AlternRock", "Bass", "Soul", "Punk", "Space", "Meditative", "Instrumental Pop", "Instrumental Rock",
+    "Ethnic", "Gothic", "Darkwave", "Techno-Industrial", "Electronic", "Pop-Folk", "Eurodance", "Dream",
+    "Southern Rock", "Comedy", "Cult", "Gangsta", "Top 40", "Christian Rap", "Pop/Funk", "Jungle",
+    "Native American", "Cabaret", "New Wave", "Psychedelic", "Rave", "Showtunes", "Trailer", "Lo-Fi",
+    "Tribal", "Acid Punk", "Acid Jazz", "Polka", "Retro", "Musical", "Rock & Roll", "Hard Rock",
+    "Folk", "Folk-Rock", "National Folk", "Swing", "Fast Fusion", "Bebop", "Latin", "Revival",
+    "Celtic", "Bluegrass", "Avantgarde", "Gothic Rock", "Progressive Rock", "Psychedelic Rock", "Symphonic Rock", "Slow Rock",
+    "Big Band", "Chorus", "Easy Listening", "Acoustic", "Humour", "Speech", "Chanson", "Opera",
+    "Chamber Music", "Sonata", "Symphony", "Booty Bass", "Primus", "Porn Groove", "Satire", "Slow Jam",
+    "Club", "Tango", "Samba", "Folklore", "Ballad", "Power Ballad", "Rhythmic Soul", "Freestyle",
+    "Duet", "Punk Rock", "Drum Solo", "A capella", "Euro-House", "Dance Hall", "Goa", "Drum & Bass",
+    "Club-House", "Hardcore", "Terror", "Indie", "BritPop", "Afro-Punk", "Polsk Punk", "Beat",
+    "Christian Gangsta Rap", "Heavy Metal", "Black Metal", "Crossover", "Contemporary Christian", "Christian Rock", "Merengue", "Salsa",
+    "Thrash Metal", "Anime", "JPop", "Synthpop", "Abstract", "Art Rock", "Baroque", "Bhangra",
+    "Big Beat", "Breakbeat", "Chillout", "Downtempo", "Dub", "EBM", "Eclectic", "Electro",
+    "Electroclash", "Emo", "Experimental", "Garage", "Global", "IDM", "Illbient", "Industro-Goth",
+    "Jam Band", "Krautrock", "Leftfield", "Lounge", "Math Rock", "New Romantic", "Nu-Breakz", "Post-Punk",
+    "Post-Rock", "Psytrance", "Shoegaze", "Space Rock", "Trop Rock", "World Music", "Neoclassical", "Audiobook",
+    "Audio Theatre", "Neue Deutsche Welle", "Podcast", "Indie Rock", "G-Funk", "Dubstep", "Garage Rock", "Psybient"};
+
+static const char *const id3v1_speeds[] = {NULL, "Slow", "Medium", "Fast", "Hardcore"};
+
+const char *id3v1_genre_name(int genre)
+{
+    if (genre < 0 || genre >= (int)(sizeof(id3v1_genres) / sizeof(id3v1_genres[0])))
+        return NULL;
+    return id3v1_genres[genre];
+}
+
+/**
+ * Finds where the ID3v1 tag of a file starts.
+ *
+ * @param fd Descriptor of the file.
+ * @param start Offset the tag is never looked for before (the end of the ID3v2 tag).
+ * @param size Size of the file.
+ * @return The offset of the "TAG" block, or of the "TAG+" block in front of it, or size
+ *         if the file does not end with an ID3v1 tag.
+ */
+long id3v1_offset(int fd, long start, long size)
+{
+    uint8_t id[4];
+    long end = size;
+    if (end - start >= ID3V1_SIZE && pread(fd, id, 3, end - ID3V1_SIZE) == 3 && memcmp(id, "TAG", 3) == 0)
+    {
+        end -= ID3V1_SIZE;
+        if (end - start >= ID3V1_EXTENDED_SIZE && pread(fd, id, 4, end - ID3V1_EXTENDED_SIZE) == 4 && memcmp(id, "TAG+", 4) == 0)
+            end -= ID3V1_EXTENDED_SIZE;
+    }
+    return end;
+}
+
+/**
+ * Decodes a fixed-width ID3v1 field to UTF-8.
+ *
+ * @param dst Receives the text; TEXT_EXPANSION bytes per input byte, plus the terminator.
+ * @param field The field.
+ * @param len Its width.
+ * @param more The continuation of the field in the extended tag, or NULL.
+ * @param more_len Width of the continuation.
+ *
+ * @logic
+ * 1. A field ends at its first NUL; the continuation only counts if the field fills its width.
+ * 2. Trailing spaces, the padding of many encoders, are dropped.
+ * 3. The bytes are UTF-8 where valid and ISO-8859-1 otherwise (TEXT_LEGACY): the standard
+ *    says ISO-8859-1, but plenty of taggers wrote UTF-8.
+ */
+static void decode_field(char *dst, const uint8_t *field, size_t len, const uint8_t *more, size_t more_len)
+{
+    uint8_t raw[90];
+    size_t n = strnlen((const char *)field, len);
+    memcpy(raw, field, n);
+    if (more && n == len)
+    {
+        size_t m = strnlen((const char *)more, more_len);
+        memcpy(raw + n, more, m);
+        n += m;
+    }
+    while (n > 0 && raw[n - 1] == ' ')
+        n--;
+
+    TextDecoder dec;
+    text_decoder_init(&dec, TEXT_LEGACY);
+    size_t consumed;
+    size_t w = text_to_utf8(&dec, raw, n, 1, (uint8_t *)dst, &consumed);
+    dst[w] = '\0';
+}
+
+/**
+ * Reads the ID3v1 tag at the end of a file.
+ *
+ * @param fd Descriptor of the file.
+ * @param tag Receives the decoded fields.
+ * @return e_success if the file ends with an ID3v1 tag, e_failure if it does not or on error.
+ *
+ * @logic
+ * 1. Read the last ID3V1_SIZE + ID3V1_EXTENDED_SIZE bytes (fewer for a small file) with a
+ *    single pread: the rest of the file is never touched.
+ * 2. The last 128 bytes must start with "TAG". If the comment's 29th byte is NUL and its
+ *    30th is not, the tag is ID3v1.1 and the 30th byte is the track number.
+ * 3. If the 227 bytes before start with "TAG+", their title, artist and album continue
+ *    the tag's, and they add a speed, a free-text genre and start and end times.
+ */
+Status read_id3v1(int fd, Id3v1Tag *tag)
+{
+    memset(tag, 0, sizeof(*tag));
+    tag->genre = ID3V1_NO_GENRE;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        perror("ERROR: fstat failed");
+        return e_failure;
+    }
+    if (st.st_size < ID3V1_SIZE)
+        return e_failure;
+    size_t want = st.st_size >= ID3V1_SIZE + ID3V1_EXTENDED_SIZE ? ID3V1_SIZE + ID3V1_EXTENDED_SIZE : ID3V1_SIZE;
+    uint8_t tail[ID3V1_SIZE + ID3V1_EXTENDED_SIZE];
+    ssize_t n = pread(fd, tail, want, st.st_size - want);
+    if (n != (ssize_t)want)
+    {
+        if (n < 0)
+            perror("ERROR: pread failed for ID3v1 tag");
+        return e_failure;
+    }
+
+    const uint8_t *v1 = tail + want - ID3V1_SIZE;
+    if (memcmp(v1, "TAG", 3) != 0)
+        return e_failure;
+    const uint8_t *ext = want > ID3V1_SIZE && memcmp(tail, "TAG+", 4) == 0 ? tail : NULL;
+    tag->extended = ext != NULL;
+
+    decode_field(tag->title, v1 + 3, 30, ext ? ext + 4 : NULL, 60);
+    decode_field(tag->artist, v1 + 33, 30, ext ? ext + 64 : NULL, 60);
+    decode_field(tag->album, v1 + 63, 30, ext ? ext + 124 : NULL, 60);
+    decode_field(tag->year, v1 + 93, 4, NULL, 0);
+    int v11 = v1[125] == 0 && v1[126] != 0;
+    decode_field(tag->comment, v1 + 97, v11 ? 28 : 30, NULL, 0);
+    tag->track = v11 ? v1[126] : 0;
+    tag->genre = v1[127];
+
+    if (ext)
+    {
+        tag->speed = ext[184] <= 4 ? ext[184] : 0;
+        decode_field(tag->genre_name, ext + 185, 30, NULL, 0);
+        decode_field(tag->start_time, ext + 215, 6, NULL, 0);
+        decode_field(tag->end_time, ext + 221, 6, NULL, 0);
+    }
+    return e_success;
+}
+
+/**
+ * Formats the ID3v1 field that corresponds to an ID3v2 frame ID.
+ *
+ * @param tag The decoded tag.
+ * @param id The frame ID: TIT2, TPE1, TALB, TYER (or TDRC), COMM, TRCK or TCON.
+ * @param buf Space for the track number and numbered genres; ID3V1_FIELD_MAX bytes.
+ * @return The value, or NULL if the tag has no such field or it is empty.
+ */
+static const char *id3v1_field(const Id3v1Tag *tag, const char *id, char *buf)
+{
+    const char *value = NULL;
+    if (strcmp(id, "TIT2") == 0)
+        value = tag->title;
+    else if (strcmp(id, "TPE1") == 0)
+        value = tag->artist;
+    else if (strcmp(id, "TALB") == 0)
+        value = tag->album;
+    else if (strcmp(id, "TYER") == 0 || strcmp(id, "TDRC") == 0)
+        value = tag->year;
+    else if (strcmp(id, "COMM") == 0)
+        value = tag->comment;
+    else if (strcmp(id, "TRCK") == 0 && tag->track)
+    {
+        snprintf(buf, ID3V1_FIELD_MAX, "%d", tag->track);
+        value = buf;
+    }
+    else if (strcmp(id, "TCON") == 0)
+    {
+        // The free-text genre of an extended tag is the more precise one.
+        const char *name = id3v1_genre_name(tag->genre);
+        if (tag->genre_name[0])
+            value = tag->genre_name;
+        else if (name)
+            value = name;
+        else if (tag->genre != ID3V1_NO_GENRE)
+        {
+            snprintf(buf, ID3V1_FIELD_MAX, "(%d)", tag->genre);
+            value = buf;
+        }
+    }
+    return value && value[0] ? value : NULL;
+}
+
+// Frame IDs of the ID3v1 fields, in the order they are displayed.
+static const char *const id3v1_fields[] = {"TIT2", "TPE1", "TALB", "TYER", "COMM", "TRCK", "TCON"};
+
+static void display_id3v1_field(const char *id, const char *value, FILE *out)
+{
+    int tag_index = tag_lookup(id);
+    fprintf(out, "\nThe tag is %s : %s\n", id, tag_index >= 0 ? tagMappings[tag_index].description : "");
+    fprintf(out, "The %s is %s\n", id, value);
+}
+
+/**
+ * Displays an ID3v1 tag.
+ *
+ * @param tag The decoded tag.
+ * @param out Stream the tag is printed to.
+ * @return e_success.
+ *
+ * @logic
+ * 1. Prints the size and version of the tag, the way display_deets prints the ID3v2 header size.
+ * 2. Prints every non-empty field under its ID3v2 frame ID, then the extended speed and times.
+ */
+Status display_id3v1(const Id3v1Tag *tag, FILE *out)
+{
+    fprintf(out, "\nThe size of the %sID3v1%s tag is %d\n", tag->extended ? "extended " : "", tag->track ? ".1" : "",
+            ID3V1_SIZE + (tag->extended ? ID3V1_EXTENDED_SIZE : 0));
+
+    char buf[ID3V1_FIELD_MAX];
+    for (size_t i = 0; i < sizeof(id3v1_fields) / sizeof(id3v1_fields[0]); i++)
+    {
+        const char *value = id3v1_field(tag, id3v1_fields[i], buf);
+        if (value)
+            display_id3v1_field(id3v1_fields[i], value, out);
+    }
+    if (tag->speed)
+        fprintf(out, "\nThe speed is %s\n", id3v1_speeds[tag->speed]);
+    if (tag->start_time[0])
+        fprintf(out, "The music starts at %s\n", tag->start_time);
+    if (tag->end_time[0])
+        fprintf(out, "The music ends at %s\n", tag->end_time);
+
+    fprintf(out, "\n\nEnd of the ID3v1 tag.\n\n");
+    return e_success;
+}
+
+/**
+ * Displays one field of an ID3v1 tag.
+ *
+ * @param tag The decoded tag.
+ * @param given_tag The ID3v2 frame ID the field is asked for by.
+ * @param out Stream the field is printed to.
+ * @return e_success if the field is present and displayed, e_failure otherwise.
+ */
+Status read_one_id3v1(const Id3v1Tag *tag, const char *given_tag, FILE *out)
+{
+    char buf[ID3V1_FIELD_MAX];
+    const char *value = id3v1_field(tag, given_tag, buf);
+    if (!value)
+    {
+        fprintf(stderr, "ERROR: Tag '%s' Not Found\n", given_tag);
+        return e_failure;
+    }
+    display_id3v1_field(given_tag, value, out);
+    return e_success;
+}
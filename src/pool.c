@@ -0,0 +1,379 @@
+#include "pool.h"
+#include <sched.h>
+#include <unistd.h>
+
+/**
+ * Pushes a task onto the bottom of a deque, growing it when full.
+ *
+ * @param deque The deque.
+ * @param task The task.
+ * @return e_success if the task was queued, e_failure if the deque could not grow.
+ */
+static Status push_bottom(TaskDeque *deque, Task task)
+{
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity)
+    {
+        int new_capacity = deque->capacity * 2;
+        Task *grown = (Task *)malloc(new_capacity * sizeof(Task));
+        if (!grown)
+        {
+            pthread_mutex_unlock(&deque->lock);
+            perror("ERROR: malloc failed for task deque");
+            return e_failure;
+        }
+        for (int i = 0; i < deque->count; i++)
+            grown[i] = deque->tasks[(deque->top + i) % deque->capacity];
+        free(deque->tasks);
+        deque->tasks = grown;
+        deque->top = 0;
+        deque->capacity = new_capacity;
+    }
+    deque->tasks[(deque->top + deque->count) % deque->capacity] = task;
+    deque->count++;
+    pthread_mutex_unlock(&deque->lock);
+    return e_success;
+}
+
+/**
+ * Takes the most recently pushed task from the bottom of a deque (owner side).
+ *
+ * @return 1 if a task was taken, 0 if the deque was empty.
+ */
+static int pop_bottom(TaskDeque *deque, Task *task)
+{
+    pthread_mutex_lock(&deque->lock);
+    int found = deque->count > 0;
+    if (found)
+    {
+        deque->count--;
+        *task = deque->tasks[(deque->top + deque->count) % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+/**
+ * Takes the oldest task from the top of a deque (thief side).
+ *
+ * @return 1 if a task was taken, 0 if the deque was empty.
+ */
+static int steal_top(TaskDeque *deque, Task *task)
+{
+    pthread_mutex_lock(&deque->lock);
+    int found = deque->count > 0;
+    if (found)
+    {
+        *task = deque->tasks[deque->top];
+        deque->top = (deque->top + 1) % deque->capacity;
+        deque->count--;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+/**
+ * Wakes a parked worker after a task was queued.
+ *
+ * @param pool The pool.
+ *
+ * @logic
+ * 1. Bump `queued` before looking for parked workers: a worker that parks afterwards
+ *    sees the new count and does not wait, so the task cannot be missed.
+ * 2. Take the lock only when someone is parked, so a busy pool pays one atomic add per task.
+ */
+static void wake_worker(WorkPool *pool)
+{
+    atomic_fetch_add(&pool->queued, 1);
+    if (atomic_load(&pool->parked) > 0)
+    {
+        pthread_mutex_lock(&pool->idle_lock);
+        pthread_cond_signal(&pool->work_ready);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+}
+
+/**
+ * Marks a task finished, waking every parked worker when it was the last one so they exit.
+ */
+static void finish_task(WorkPool *pool)
+{
+    if (atomic_fetch_sub(&pool->pending, 1) == 1)
+    {
+        pthread_mutex_lock(&pool->idle_lock);
+        pthread_cond_broadcast(&pool->work_ready);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+}
+
+/**
+ * Parks an idle worker until a task is queued or none is pending.
+ *
+ * @param pool The pool.
+ * @param seen Value of `queued` before the worker last looked for a task.
+ */
+static void park_worker(WorkPool *pool, unsigned long seen)
+{
+    pthread_mutex_lock(&pool->idle_lock);
+    atomic_fetch_add(&pool->parked, 1);
+    while (atomic_load(&pool->queued) == seen && atomic_load(&pool->pending) != 0)
+        pthread_cond_wait(&pool->work_ready, &pool->idle_lock);
+    atomic_fetch_sub(&pool->parked, 1);
+    pthread_mutex_unlock(&pool->idle_lock);
+}
+
+/**
+ * Runs a task on the calling worker, then releases its arena memory.
+ */
+static void run_task(Worker *worker, Task task)
+{
+    task.fn(worker, task.arg);
+    arena_reset(&worker->arena);
+    finish_task(worker->pool);
+}
+
+/**
+ * Worker thread loop.
+ *
+ * @logic
+ * 1. Run tasks from the bottom of the worker's own deque (depth first, cache warm).
+ * 2. When it is empty, take a task injected from outside the pool, or steal the oldest
+ *    task of another worker, trying each in turn starting after this worker so thieves spread out.
+ * 3. Exit once no task is pending anywhere; only running tasks and reserved injections create new ones.
+ * 4. While other work is still pending, yield for a few rounds, then park with `park_worker`
+ *    until a task is queued, so a scan waiting on prefetch I/O leaves the cores idle.
+ */
+static void *worker_loop(void *arg)
+{
+    Worker *worker = arg;
+    WorkPool *pool = worker->pool;
+    Task task;
+    int idle = 0;
+
+    while (1)
+    {
+        unsigned long seen = atomic_load(&pool->queued);
+        if (pop_bottom(&worker->deque, &task))
+        {
+            run_task(worker, task);
+            idle = 0;
+            continue;
+        }
+
+        int stolen = steal_top(&pool->inbox, &task);
+        for (int i = 1; i < pool->worker_count && !stolen; i++)
+        {
+            Worker *victim = &pool->workers[(worker->id + i) % pool->worker_count];
+            stolen = steal_top(&victim->deque, &task);
+        }
+        if (stolen)
+        {
+            run_task(worker, task);
+            idle = 0;
+            continue;
+        }
+
+        if (atomic_load(&pool->pending) == 0)
+            break;
+        if (++idle < POOL_IDLE_SPINS)
+            sched_yield();
+        else
+            park_worker(pool, seen);
+    }
+    return NULL;
+}
+
+/**
+ * Creates the workers of a pool.
+ *
+ * @param pool The pool to initialise.
+ * @param worker_count Number of workers, clamped to 1..POOL_MAX_WORKERS.
+ * @param ctx Shared state passed to the tasks through pool->ctx.
+ * @return e_success if every worker was set up, e_failure on allocation failure.
+ */
+Status init_pool(WorkPool *pool, int worker_count, void *ctx)
+{
+    if (worker_count < 1)
+        worker_count = 1;
+    if (worker_count > POOL_MAX_WORKERS)
+        worker_count = POOL_MAX_WORKERS;
+
+    pool->workers = (Worker *)calloc(worker_count, sizeof(Worker));
+    if (!pool->workers)
+    {
+        perror("ERROR: calloc failed for worker pool");
+        return e_failure;
+    }
+    pool->worker_count = 0;
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->parked, 0);
+    pthread_mutex_init(&pool->idle_lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pool->ctx = ctx;
+    pool->inbox.tasks = (Task *)malloc(POOL_DEQUE_SIZE * sizeof(Task));
+    pool->inbox.top = 0;
+    pool->inbox.count = 0;
+    pool->inbox.capacity = POOL_DEQUE_SIZE;
+    pthread_mutex_init(&pool->inbox.lock, NULL);
+    if (!pool->inbox.tasks)
+    {
+        perror("ERROR: malloc failed for pool inbox");
+        free_pool(pool);
+        return e_failure;
+    }
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        Worker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->id = i;
+        worker->deque.tasks = (Task *)malloc(POOL_DEQUE_SIZE * sizeof(Task));
+        worker->deque.capacity = POOL_DEQUE_SIZE;
+        pthread_mutex_init(&worker->deque.lock, NULL);
+        if (!worker->deque.tasks || arena_init(&worker->arena, POOL_ARENA_SIZE) == e_failure)
+        {
+            free(worker->deque.tasks);
+            pthread_mutex_destroy(&worker->deque.lock);
+            free_pool(pool);
+            return e_failure;
+        }
+        pool->worker_count++;
+    }
+    return e_success;
+}
+
+/**
+ * Queues a task on the worker's own deque.
+ *
+ * @param worker The worker running the calling task.
+ * @param fn The task function.
+ * @param arg Argument passed to the task function.
+ *
+ * @logic
+ * 1. Count the task as pending before it becomes visible to thieves.
+ * 2. Wake a parked worker to steal it.
+ * 3. If the deque cannot grow, run the task immediately instead of dropping it.
+ */
+void submit_task(Worker *worker, TaskFn fn, void *arg)
+{
+    Task task = {fn, arg};
+    atomic_fetch_add(&worker->pool->pending, 1);
+    if (push_bottom(&worker->deque, task) == e_failure)
+    {
+        task.fn(worker, task.arg);
+        finish_task(worker->pool);
+        return;
+    }
+    wake_worker(worker->pool);
+}
+
+/**
+ * Counts a task that another thread will inject later.
+ *
+ * @param pool The pool.
+ */
+void reserve_task(WorkPool *pool)
+{
+    atomic_fetch_add(&pool->pending, 1);
+}
+
+/**
+ * Hands a task to the pool from a thread outside it.
+ *
+ * @param pool The pool.
+ * @param fn The task function.
+ * @param arg Argument passed to the task function.
+ *
+ * @logic
+ * 1. The task was already counted by reserve_task, so the pending count is left alone.
+ * 2. Queue it on the shared inbox, which idle workers check before stealing, and wake
+ *    a parked worker to take it.
+ * 3. Retry while the inbox cannot grow; the task must not be lost.
+ */
+void inject_task(WorkPool *pool, TaskFn fn, void *arg)
+{
+    Task task = {fn, arg};
+    while (push_bottom(&pool->inbox, task) == e_failure)
+        usleep(POOL_RETRY_SLEEP_US);
+    wake_worker(pool);
+}
+
+/**
+ * Runs a root task and every task it spawns on the pool's workers.
+ *
+ * @param pool The pool.
+ * @param fn The root task function.
+ * @param arg Argument for the root task.
+ * @return e_success once every task has finished, e_failure if no worker thread could be started.
+ *
+ * @logic
+ * 1. Queue the root task on the first worker.
+ * 2. Start one thread per worker; idle workers steal from busy ones.
+ * 3. Join the threads once the pending count has dropped to zero.
+ */
+Status run_pool(WorkPool *pool, TaskFn fn, void *arg)
+{
+    submit_task(&pool->workers[0], fn, arg);
+
+    int started = 0;
+    for (; started < pool->worker_count; started++)
+    {
+        if (pthread_create(&pool->workers[started].thread, NULL, worker_loop, &pool->workers[started]) != 0)
+        {
+            fprintf(stderr, "ERROR: pthread_create failed for worker %d\n", started);
+            break;
+        }
+    }
+
+    if (started == 0)
+    {
+        // Nothing will run the root task; drain it so the pool can be reused.
+        Task task;
+        pop_bottom(&pool->workers[0].deque, &task);
+        atomic_store(&pool->pending, 0);
+        return e_failure;
+    }
+
+    for (int i = 0; i < started; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+    return e_success;
+}
+
+/**
+ * Releases the deques and arenas of every worker.
+ *
+ * @param pool The pool.
+ */
+void free_pool(WorkPool *pool)
+{
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        free(pool->workers[i].deque.tasks);
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+        arena_free(&pool->workers[i].arena);
+    }
+    free(pool->workers);
+    free(pool->inbox.tasks);
+    pthread_mutex_destroy(&pool->inbox.lock);
+    pthread_mutex_destroy(&pool->idle_lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pool->inbox.tasks = NULL;
+    pool->workers = NULL;
+    pool->worker_count = 0;
+}
+
+/**
+ * Returns the default number of workers for a pool.
+ *
+ * @return The number of online cores, clamped to 1..POOL_MAX_WORKERS.
+ */
+int pool_thread_count(void)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1)
+        return 1;
+    if (cores > POOL_MAX_WORKERS)
+        return POOL_MAX_WORKERS;
+    return (int)cores;
+}
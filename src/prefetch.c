@@ -0,0 +1,607 @@
+#define _GNU_SOURCE
+#include "prefetch.h"
+#include "tag_index.h"
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+enum
+{
+    e_slot_open,
+    e_slot_read,
+    e_slot_read_rest,
+    e_slot_done // Handed to the pool, or free.
+};
+
+/**
+ * Works out how much of the file a buffered prefix says must be read.
+ *
+ * @param buffer The bytes read from the start of the file.
+ * @param length Number of bytes in buffer.
+ * @return 10 plus the declared tag size if the prefix starts with an ID3v2 header, else length.
+ */
+static long tag_extent(const uint8_t *buffer, long length)
+{
+    if (length < 10 || memcmp(buffer, "ID3", 3) != 0)
+        return length;
+    return 10 + (long)id3v2_header_size(buffer + 6);
+}
+
+/**
+ * Hands a filled slot to the pool as a completion task, closing its file unless the tag is large.
+ */
+static void finish_slot(Prefetcher *prefetcher, PrefetchSlot *slot)
+{
+    if (slot->fd != -1 && (slot->error || !slot->large))
+    {
+        close(slot->fd);
+        slot->fd = -1;
+    }
+    slot->state = e_slot_done;
+    inject_task(prefetcher->pool, prefetcher->done, slot);
+}
+
+/**
+ * Takes the next queued request and a free slot for it.
+ *
+ * @param prefetcher The prefetcher; its lock must be held.
+ * @return The slot now serving the oldest request, or NULL if there is no request or no free slot.
+ */
+static PrefetchSlot *assign_slot(Prefetcher *prefetcher)
+{
+    if (!prefetcher->queue_head || !prefetcher->free_slots)
+        return NULL;
+
+    PrefetchSlot *slot = prefetcher->free_slots;
+    prefetcher->free_slots = slot->next;
+    slot->request = prefetcher->queue_head;
+    prefetcher->queue_head = slot->request->next;
+    if (!prefetcher->queue_head)
+        prefetcher->queue_tail = NULL;
+
+    slot->buffer = slot->window;
+    slot->length = 0;
+    slot->error = 0;
+    slot->large = 0;
+    slot->fd = -1;
+    return slot;
+}
+
+/**
+ * Works out how much of the tag is still to be read once the window is in the slot.
+ *
+ * @param slot The slot, holding the first `length` bytes of its open file.
+ * @return Bytes to read after the window (the buffer has grown to hold them), 0 if nothing
+ *         more is read, or -1 on error (slot->error is set).
+ *
+ * @logic
+ * 1. Nothing more is needed if the declared tag ends inside the window, or the file did.
+ * 2. Clamp the declared size to the file size, so a corrupt header cannot ask for more.
+ * 3. A tag over TAG_READ_LIMIT is not buffered: the slot is marked large and keeps its
+ *    file open, and the completion task indexes it with `read_tag_index`, which reads
+ *    it frame by frame. At most TAG_READ_LIMIT bytes are thus held per slot.
+ * 4. Otherwise grow the buffer to the whole tag.
+ */
+static long plan_rest(PrefetchSlot *slot)
+{
+    long needed = tag_extent(slot->buffer, slot->length);
+    if (needed <= slot->length || slot->length < PREFETCH_WINDOW)
+        return 0;
+
+    struct stat st;
+    if (fstat(slot->fd, &st) != 0)
+    {
+        slot->error = errno;
+        return -1;
+    }
+    if (needed > st.st_size)
+        needed = st.st_size;
+    if (needed <= slot->length)
+        return 0;
+    if (needed > TAG_READ_LIMIT)
+    {
+        slot->large = 1;
+        return 0;
+    }
+
+    uint8_t *buffer = (uint8_t *)malloc(needed);
+    if (!buffer)
+    {
+        slot->error = ENOMEM;
+        return -1;
+    }
+    memcpy(buffer, slot->buffer, slot->length);
+    slot->buffer = buffer;
+    return needed - slot->length;
+}
+
+/**
+ * Reads a file into a slot with blocking calls (I/O thread backend).
+ *
+ * @logic
+ * 1. Open the file and read the prefetch window from offset 0.
+ * 2. If `plan_rest` asks for more of the tag, read it with one more pread.
+ */
+static void read_slot(PrefetchSlot *slot)
+{
+    slot->fd = open(slot->request->path, O_RDONLY | O_CLOEXEC);
+    if (slot->fd == -1)
+    {
+        slot->error = errno;
+        return;
+    }
+
+    ssize_t n = pread(slot->fd, slot->buffer, PREFETCH_WINDOW, 0);
+    if (n < 0)
+    {
+        slot->error = errno;
+        return;
+    }
+    slot->length = n;
+
+    long rest = plan_rest(slot);
+    if (rest > 0)
+    {
+        n = pread(slot->fd, slot->buffer + slot->length, rest, slot->length);
+        if (n < 0)
+            slot->error = errno;
+        else
+            slot->length += n;
+    }
+}
+
+/**
+ * I/O thread loop of the blocking backend.
+ */
+static void *io_thread(void *arg)
+{
+    Prefetcher *prefetcher = arg;
+    while (1)
+    {
+        pthread_mutex_lock(&prefetcher->lock);
+        PrefetchSlot *slot;
+        while ((slot = assign_slot(prefetcher)) == NULL && !(prefetcher->closing && !prefetcher->queue_head))
+            pthread_cond_wait(&prefetcher->wake, &prefetcher->lock);
+        pthread_mutex_unlock(&prefetcher->lock);
+        if (!slot)
+            break;
+
+        read_slot(slot);
+        finish_slot(prefetcher, slot);
+    }
+    return NULL;
+}
+
+/**
+ * Maps the rings of an io_uring instance.
+ *
+ * @param ring The ring to set up.
+ * @param entries Number of submission queue entries.
+ * @return e_success if the ring is usable, e_failure if io_uring is unavailable.
+ *
+ * @logic
+ * 1. Create the ring with io_uring_setup(2).
+ * 2. Check that the kernel supports the OPENAT and READ operations.
+ * 3. Map the submission ring, the completion ring and the SQE array.
+ */
+static Status setup_uring(Uring *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+        return e_failure;
+    ring->entries = params.sq_entries;
+
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, probe_size);
+    int supported = probe && syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+                    probe->last_op >= IORING_OP_READ &&
+                    (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) &&
+                    (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    if (!supported)
+    {
+        close(ring->fd);
+        return e_failure;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        perror("ERROR: mmap failed for io_uring");
+        if (ring->sq_ring != MAP_FAILED)
+            munmap(ring->sq_ring, ring->sq_ring_size);
+        if (ring->cq_ring != MAP_FAILED)
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        if (ring->sqes != MAP_FAILED)
+            munmap(ring->sqes, ring->sqes_size);
+        close(ring->fd);
+        return e_failure;
+    }
+
+    uint8_t *sq = ring->sq_ring;
+    uint8_t *cq = ring->cq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return e_success;
+}
+
+/**
+ * Unmaps and closes an io_uring instance.
+ */
+static void close_uring(Uring *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+/**
+ * Prepares the next submission queue entry; it is sent with the next io_uring_enter.
+ *
+ * @return The zeroed entry. The ring has one entry per slot, so it is never full.
+ */
+static struct io_uring_sqe *next_sqe(Uring *ring)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+    return sqe;
+}
+
+/**
+ * Queues an asynchronous read into a slot.
+ */
+static void submit_read(Uring *ring, PrefetchSlot *slot, long offset, long length, int state)
+{
+    struct io_uring_sqe *sqe = next_sqe(ring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = slot->fd;
+    sqe->addr = (unsigned long)(slot->buffer + offset);
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->user_data = (unsigned long)slot;
+    slot->state = state;
+}
+
+/**
+ * Advances a slot when one of its io_uring operations completes.
+ *
+ * @param prefetcher The prefetcher.
+ * @param slot The slot the operation belongs to.
+ * @param res The result of the operation (a descriptor, a byte count or a negated errno).
+ * @return 1 if the slot was handed to the pool, 0 if another operation was queued.
+ *
+ * @logic
+ * 1. After the open, read the prefetch window from offset 0.
+ * 2. After the first read, read the rest of the tag if `plan_rest` asks for it.
+ * 3. Otherwise, or on any error, hand the slot to the pool.
+ */
+static int complete_slot(Prefetcher *prefetcher, PrefetchSlot *slot, int res)
+{
+    if (res < 0)
+    {
+        slot->error = -res;
+        finish_slot(prefetcher, slot);
+        return 1;
+    }
+
+    switch (slot->state)
+    {
+    case e_slot_open:
+        slot->fd = res;
+        submit_read(&prefetcher->ring, slot, 0, PREFETCH_WINDOW, e_slot_read);
+        return 0;
+
+    case e_slot_read:
+    {
+        slot->length = res;
+        long rest = plan_rest(slot);
+        if (rest > 0)
+        {
+            submit_read(&prefetcher->ring, slot, slot->length, rest, e_slot_read_rest);
+            return 0;
+        }
+        break;
+    }
+
+    default:
+        slot->length += res;
+        break;
+    }
+    finish_slot(prefetcher, slot);
+    return 1;
+}
+
+/**
+ * Gives up on the ring after io_uring_enter failed for good.
+ *
+ * @param prefetcher The prefetcher.
+ * @param error errno of the failure, reported for the files that were in flight.
+ *
+ * @logic
+ * 1. Close the ring, which cancels the operations still queued or in the kernel.
+ * 2. Fail every slot that was not yet handed to the pool, so the completion task reserved
+ *    for it still runs and the pool's pending count can reach zero.
+ */
+static void abandon_uring(Prefetcher *prefetcher, int error)
+{
+    close_uring(&prefetcher->ring);
+    prefetcher->ring.fd = -1;
+    for (int i = 0; i < PREFETCH_DEPTH; i++)
+    {
+        PrefetchSlot *slot = &prefetcher->slots[i];
+        if (slot->state == e_slot_done)
+            continue;
+        slot->error = error;
+        finish_slot(prefetcher, slot);
+    }
+}
+
+/**
+ * I/O thread loop of the io_uring backend.
+ *
+ * @logic
+ * 1. Give every queued request a free slot and queue an OPENAT for it.
+ * 2. Submit the queued operations and wait for at least one completion in the same call.
+ * 3. Advance each completed slot, which queues its next operation or hands it to the pool.
+ * 4. Sleep on the condition variable when nothing is in flight, and exit once closing.
+ * 5. If io_uring_enter fails for good, fail the slots in flight with `abandon_uring` and
+ *    serve the rest of the queue with blocking reads, as an I/O thread does.
+ */
+static void *uring_thread(void *arg)
+{
+    Prefetcher *prefetcher = arg;
+    Uring *ring = &prefetcher->ring;
+    int inflight = 0;
+
+    while (1)
+    {
+        pthread_mutex_lock(&prefetcher->lock);
+        PrefetchSlot *slot;
+        while ((slot = assign_slot(prefetcher)) != NULL)
+        {
+            struct io_uring_sqe *sqe = next_sqe(ring);
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (unsigned long)slot->request->path;
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            sqe->user_data = (unsigned long)slot;
+            slot->state = e_slot_open;
+            inflight++;
+        }
+        if (inflight == 0)
+        {
+            int done = prefetcher->closing && !prefetcher->queue_head;
+            if (!done)
+                pthread_cond_wait(&prefetcher->wake, &prefetcher->lock);
+            pthread_mutex_unlock(&prefetcher->lock);
+            if (done)
+                break;
+            continue;
+        }
+        pthread_mutex_unlock(&prefetcher->lock);
+
+        int ret = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0)
+        {
+            int error = errno;
+            if (error == EINTR || error == EAGAIN || error == EBUSY)
+                continue;
+            fprintf(stderr, "ERROR: io_uring_enter failed (%s), falling back to blocking reads.\n", strerror(error));
+            abandon_uring(prefetcher, error);
+            return io_thread(prefetcher);
+        }
+        ring->to_submit -= ret;
+
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            inflight -= complete_slot(prefetcher, (PrefetchSlot *)(unsigned long)cqe->user_data, cqe->res);
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/**
+ * Works out which backend TAG_PREFETCH asks for.
+ *
+ * @return The requested backend; io_uring when the variable is unset or unrecognised.
+ */
+static PrefetchBackend requested_backend(void)
+{
+    const char *value = getenv(PREFETCH_ENV);
+    if (value && strcmp(value, "off") == 0)
+        return e_prefetch_off;
+    if (value && strcmp(value, "threads") == 0)
+        return e_prefetch_threads;
+    return e_prefetch_uring;
+}
+
+/**
+ * Starts the prefetcher.
+ *
+ * @param prefetcher The prefetcher to start.
+ * @param pool The pool completion tasks are injected into.
+ * @param done Task run with each filled slot; it must call release_prefetch_slot.
+ * @return e_success if a backend is running or prefetching is off, e_failure on error.
+ *
+ * @logic
+ * 1. Honour TAG_PREFETCH=off, leaving the caller to read files itself.
+ * 2. Allocate the slot windows in one block.
+ * 3. Start one io_uring thread, or PREFETCH_THREADS blocking I/O threads
+ *    if io_uring is unavailable or TAG_PREFETCH=threads.
+ */
+Status start_prefetcher(Prefetcher *prefetcher, WorkPool *pool, TaskFn done)
+{
+    memset(prefetcher, 0, sizeof(*prefetcher));
+    prefetcher->backend = requested_backend();
+    if (prefetcher->backend == e_prefetch_off)
+        return e_success;
+
+    prefetcher->pool = pool;
+    prefetcher->done = done;
+    prefetcher->windows = (uint8_t *)malloc((size_t)PREFETCH_DEPTH * PREFETCH_WINDOW);
+    if (!prefetcher->windows)
+    {
+        perror("ERROR: malloc failed for prefetch buffers");
+        return e_failure;
+    }
+    for (int i = PREFETCH_DEPTH - 1; i >= 0; i--)
+    {
+        prefetcher->slots[i].window = prefetcher->windows + (size_t)i * PREFETCH_WINDOW;
+        prefetcher->slots[i].fd = -1;
+        prefetcher->slots[i].state = e_slot_done;
+        prefetcher->slots[i].next = prefetcher->free_slots;
+        prefetcher->free_slots = &prefetcher->slots[i];
+    }
+    pthread_mutex_init(&prefetcher->lock, NULL);
+    pthread_cond_init(&prefetcher->wake, NULL);
+
+    if (prefetcher->backend == e_prefetch_uring && setup_uring(&prefetcher->ring, PREFETCH_DEPTH) == e_success)
+    {
+        if (pthread_create(&prefetcher->threads[0], NULL, uring_thread, prefetcher) == 0)
+        {
+            prefetcher->thread_count = 1;
+            return e_success;
+        }
+        close_uring(&prefetcher->ring);
+    }
+
+    prefetcher->backend = e_prefetch_threads;
+    for (int i = 0; i < PREFETCH_THREADS; i++)
+    {
+        if (pthread_create(&prefetcher->threads[i], NULL, io_thread, prefetcher) != 0)
+            break;
+        prefetcher->thread_count++;
+    }
+    if (prefetcher->thread_count == 0)
+    {
+        fprintf(stderr, "ERROR: pthread_create failed for prefetch thread\n");
+        pthread_mutex_destroy(&prefetcher->lock);
+        pthread_cond_destroy(&prefetcher->wake);
+        free(prefetcher->windows);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/**
+ * Queues a file for prefetching.
+ *
+ * @param prefetcher The prefetcher.
+ * @param request The request; its memory must stay valid until its slot is released.
+ *
+ * @logic
+ * 1. Reserve the completion task so the pool keeps running until the file has been read.
+ * 2. Append the request to the queue and wake the I/O threads; this never blocks,
+ *    so workers listing directories cannot stall behind slots held by other workers.
+ */
+void prefetch_file(Prefetcher *prefetcher, PrefetchRequest *request)
+{
+    reserve_task(prefetcher->pool);
+    request->next = NULL;
+
+    pthread_mutex_lock(&prefetcher->lock);
+    if (prefetcher->queue_tail)
+        prefetcher->queue_tail->next = request;
+    else
+        prefetcher->queue_head = request;
+    prefetcher->queue_tail = request;
+    pthread_cond_signal(&prefetcher->wake);
+    pthread_mutex_unlock(&prefetcher->lock);
+}
+
+/**
+ * Returns a slot once its buffer, and the file of a large tag, are no longer needed.
+ *
+ * @param prefetcher The prefetcher.
+ * @param slot The slot handed to the completion task.
+ */
+void release_prefetch_slot(Prefetcher *prefetcher, PrefetchSlot *slot)
+{
+    if (slot->buffer != slot->window)
+        free(slot->buffer);
+    if (slot->fd != -1)
+    {
+        close(slot->fd);
+        slot->fd = -1;
+    }
+    slot->buffer = NULL;
+    slot->request = NULL;
+
+    pthread_mutex_lock(&prefetcher->lock);
+    slot->next = prefetcher->free_slots;
+    prefetcher->free_slots = slot;
+    pthread_cond_signal(&prefetcher->wake);
+    pthread_mutex_unlock(&prefetcher->lock);
+}
+
+/**
+ * Stops the I/O threads and releases the prefetcher.
+ *
+ * @param prefetcher The prefetcher; every queued file must already have completed.
+ */
+void stop_prefetcher(Prefetcher *prefetcher)
+{
+    if (prefetcher->backend == e_prefetch_off)
+        return;
+
+    pthread_mutex_lock(&prefetcher->lock);
+    prefetcher->closing = 1;
+    pthread_cond_broadcast(&prefetcher->wake);
+    pthread_mutex_unlock(&prefetcher->lock);
+
+    for (int i = 0; i < prefetcher->thread_count; i++)
+        pthread_join(prefetcher->threads[i], NULL);
+    if (prefetcher->backend == e_prefetch_uring && prefetcher->ring.fd != -1)
+        close_uring(&prefetcher->ring);
+
+    pthread_mutex_destroy(&prefetcher->lock);
+    pthread_cond_destroy(&prefetcher->wake);
+    free(prefetcher->windows);
+}
+
+/**
+ * Returns a printable name for a prefetch backend.
+ *
+ * @param backend The backend.
+ * @return A constant string naming the backend.
+ */
+const char *prefetch_backend_name(PrefetchBackend backend)
+{
+    switch (backend)
+    {
+    case e_prefetch_uring:
+        return "io_uring";
+    case e_prefetch_threads:
+        return "thread pool";
+    default:
+        return "synchronous";
+    }
+}
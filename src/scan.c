@@ -0,0 +1,567 @@
+#define _GNU_SOURCE
+#include "scan.h"
+#include "pool.h"
+#include "prefetch.h"
+#include "cache.h"
+#include "tag_index.h"
+#include "view.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The entries of one directory share a single allocation, released by the last task that uses it.
+struct ScanBatch
+{
+    atomic_int refs;
+    int count;
+    const ScanWalk *walk; // The walk the directory belongs to.
+    ScanEntry entries[];
+};
+
+typedef struct ScanName
+{
+    struct ScanName *next;
+    int is_dir;
+    int has_stat;
+    struct stat st;
+    char name[];
+} ScanName;
+
+typedef struct
+{
+    const char *const *tags; // Tags to print, or NULL for every tag.
+    int tag_count;
+    pthread_mutex_t output_lock; // Keeps the report of one file together on stdout.
+    long files;
+    long tagged;
+    atomic_long cached;    // Files served from the tag cache.
+    Prefetcher prefetcher; // Reads headers and tags ahead of the workers.
+    int caching;           // Non-zero if cache is open.
+    TagCache cache;
+} ScanContext;
+
+typedef struct
+{
+    FILE *out;     // Stream writing into report; created once per worker.
+    char *report;  // Report of the file being scanned; grows to the largest report and is reused.
+    size_t len;
+    size_t capacity;
+} ScanWorker;
+
+static void walk_dir_task(Worker *worker, void *arg);
+static void scan_file_task(Worker *worker, void *arg);
+static void scan_prefetched_task(Worker *worker, void *arg);
+static void scan_cached_task(Worker *worker, void *arg);
+
+/**
+ * fopencookie(3) write callback appending to a worker's report buffer.
+ *
+ * @return The number of bytes accepted, or -1 if the buffer could not grow.
+ */
+static ssize_t report_write(void *cookie, const char *buf, size_t size)
+{
+    ScanWorker *local = cookie;
+    if (local->len + size > local->capacity)
+    {
+        size_t capacity = local->capacity ? local->capacity : 4096;
+        while (capacity < local->len + size)
+            capacity *= 2;
+        char *grown = (char *)realloc(local->report, capacity);
+        if (!grown)
+            return -1;
+        local->report = grown;
+        local->capacity = capacity;
+    }
+    memcpy(local->report + local->len, buf, size);
+    local->len += size;
+    return size;
+}
+
+/**
+ * Drops one entry's reference to its batch, freeing the batch with the last one.
+ *
+ * @param entry A file handed to visit_file, or a directory once it has been listed.
+ */
+void release_entry(ScanEntry *entry)
+{
+    ScanBatch *batch = entry->batch;
+    if (atomic_fetch_sub(&batch->refs, 1) == 1)
+        free(batch);
+}
+
+/**
+ * Checks whether the cache can answer for a file without reading it.
+ *
+ * @return 1 if the cache entry is fresh and holds every frame a scan displays, 0 otherwise.
+ */
+static int usable_entry(const ScanContext *ctx, const ScanEntry *entry)
+{
+    const CacheEntry *cached = cache_lookup(&ctx->cache, &entry->st);
+    return cached && !(cached->flags & CACHE_ENTRY_TRUNCATED);
+}
+
+/**
+ * Lists a directory and queues a task for every regular file and subdirectory in it.
+ *
+ * @param worker The worker running the task.
+ * @param arg The ScanEntry of the directory.
+ *
+ * @logic
+ * 1. Read every entry, keeping the names in the worker arena; symbolic links are not followed.
+ *    With `stat_files`, files are stat'ed here (a scan uses it so fresh cache entries skip the file entirely).
+ * 2. Copy the full paths into one batch allocation shared by all the child tasks.
+ * 3. Queue the subdirectories on this worker's deque, where idle workers can steal them,
+ *    leaving out `skip_dir`, and hand every file to `visit_file`.
+ * 4. Release this directory's reference on its own batch.
+ */
+static void walk_dir_task(Worker *worker, void *arg)
+{
+    ScanEntry *self = arg;
+    const ScanWalk *walk = self->batch->walk;
+    DIR *dir = opendir(self->path);
+    if (!dir)
+    {
+        fprintf(stderr, "ERROR: Cannot read directory %s: %s\n", self->path, strerror(errno));
+        release_entry(self);
+        return;
+    }
+
+    size_t dir_len = strlen(self->path);
+    const char *separator = dir_len > 0 && self->path[dir_len - 1] == '/' ? "" : "/";
+    ScanName *names = NULL;
+    int count = 0;
+    size_t path_bytes = 0;
+
+    struct dirent *dirent;
+    while ((dirent = readdir(dir)) != NULL)
+    {
+        if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0)
+            continue;
+
+        int type = dirent->d_type;
+        int has_stat = 0;
+        struct stat st;
+        if (type == DT_UNKNOWN || (type == DT_REG && walk->stat_files))
+        {
+            if (fstatat(dirfd(dir), dirent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            has_stat = 1;
+        }
+        if (type != DT_DIR && type != DT_REG)
+            continue;
+
+        size_t name_len = strlen(dirent->d_name);
+        ScanName *name = (ScanName *)arena_alloc(&worker->arena, sizeof(ScanName) + name_len + 1);
+        if (!name)
+            break;
+        memcpy(name->name, dirent->d_name, name_len + 1);
+        name->is_dir = type == DT_DIR;
+        name->has_stat = has_stat;
+        if (has_stat)
+            name->st = st;
+        name->next = names;
+        names = name;
+        count++;
+        path_bytes += dir_len + 1 + name_len + 1;
+    }
+    closedir(dir);
+
+    if (count > 0)
+    {
+        ScanBatch *batch = (ScanBatch *)malloc(sizeof(ScanBatch) + count * sizeof(ScanEntry) + path_bytes);
+        if (!batch)
+        {
+            perror("ERROR: malloc failed for directory entries");
+            release_entry(self);
+            return;
+        }
+        atomic_init(&batch->refs, count);
+        batch->count = count;
+        batch->walk = walk;
+
+        char *path = (char *)&batch->entries[count];
+        int i = 0;
+        for (ScanName *name = names; name; name = name->next, i++)
+        {
+            ScanEntry *entry = &batch->entries[i];
+            entry->batch = batch;
+            entry->path = path;
+            entry->is_dir = name->is_dir;
+            entry->has_stat = name->has_stat;
+            entry->st = name->st;
+            path += sprintf(path, "%s%s%s", self->path, separator, name->name) + 1;
+        }
+        for (i = 0; i < count; i++)
+        {
+            ScanEntry *entry = &batch->entries[i];
+            if (!entry->is_dir)
+                walk->visit_file(worker, entry);
+            else if (walk->skip_dir && strcmp(entry->path, walk->skip_dir) == 0)
+                release_entry(entry);
+            else
+                submit_task(worker, walk_dir_task, entry);
+        }
+    }
+    release_entry(self);
+}
+
+/**
+ * Walks a directory tree on a pool.
+ *
+ * @param pool The pool; its workers run the directory tasks and whatever visit_file queues.
+ * @param walk What to do with the files; must stay valid until the walk returns.
+ * @param root Directory to walk.
+ * @return e_success once every task has finished, e_failure on error.
+ *
+ * @logic
+ * 1. Put the root in a batch of its own and run it as the first task; directory tasks
+ *    queue their children, so both the walk and the work on the files spread over the workers.
+ */
+Status walk_library(WorkPool *pool, const ScanWalk *walk, const char *root)
+{
+    ScanBatch *batch = (ScanBatch *)malloc(sizeof(ScanBatch) + sizeof(ScanEntry));
+    if (!batch)
+    {
+        perror("ERROR: malloc failed for the walk root");
+        return e_failure;
+    }
+    atomic_init(&batch->refs, 1);
+    batch->count = 1;
+    batch->walk = walk;
+    batch->entries[0] = (ScanEntry){.batch = batch, .path = root, .is_dir = 1};
+    Status status = run_pool(pool, walk_dir_task, &batch->entries[0]);
+    if (status == e_failure)
+        free(batch);
+    return status;
+}
+
+/**
+ * Starts the work on a file found by the walk.
+ *
+ * @param worker The worker listing the file's directory.
+ * @param entry The file.
+ *
+ * @logic
+ * 1. A file whose cache entry is fresh is reported from the cache.
+ * 2. Otherwise hand it to the prefetcher, or queue it directly when prefetching is off.
+ */
+static void scan_visit_file(Worker *worker, ScanEntry *entry)
+{
+    ScanContext *ctx = worker->pool->ctx;
+    if (entry->has_stat && ctx->caching && usable_entry(ctx, entry))
+    {
+        submit_task(worker, scan_cached_task, entry);
+    }
+    else if (ctx->prefetcher.backend == e_prefetch_off)
+    {
+        submit_task(worker, scan_file_task, entry);
+    }
+    else
+    {
+        entry->request.path = entry->path;
+        entry->request.arg = entry;
+        prefetch_file(&ctx->prefetcher, &entry->request);
+    }
+}
+
+/**
+ * Prints the report for one file.
+ *
+ * @param worker The worker running the task.
+ * @param path Path of the file.
+ * @param index The indexed tag, or NULL if the file has none.
+ * @param error errno of a failed open or read, or 0.
+ *
+ * @logic
+ * 1. Renders the report into the worker's report buffer with the `-v` display functions,
+ *    describing APIC frames without extracting the images.
+ * 2. Writes the whole report to stdout under the output lock so reports never interleave.
+ */
+static void report_file(Worker *worker, const char *path, const TagIndex *index, int error)
+{
+    ScanContext *ctx = worker->pool->ctx;
+    ScanWorker *local = worker->local;
+    FILE *out = local->out;
+
+    fprintf(out, "\n==> %s <==\n", path);
+    if (error)
+    {
+        fprintf(out, "ERROR: %s\n", strerror(error));
+    }
+    else if (!index)
+    {
+        fprintf(out, "No ID3v2 tag.\n");
+    }
+    else if (ctx->tags == NULL)
+    {
+        display_deets(index, out, NULL);
+    }
+    else
+    {
+        for (int i = 0; i < ctx->tag_count; i++)
+        {
+            if (find_frame(index, ctx->tags[i]) == NULL)
+                fprintf(out, "\nTag '%s' Not Found\n", ctx->tags[i]);
+            else
+                read_one_tag(index, ctx->tags[i], out, NULL);
+        }
+    }
+    fflush(out);
+
+    pthread_mutex_lock(&ctx->output_lock);
+    fwrite(local->report, 1, local->len, stdout);
+    ctx->files++;
+    ctx->tagged += index != NULL;
+    pthread_mutex_unlock(&ctx->output_lock);
+    local->len = 0;
+}
+
+/**
+ * Queues a freshly parsed tag for the cache.
+ *
+ * @param worker The worker running the task.
+ * @param entry The file.
+ * @param index The parsed tag, or NULL if the file has none.
+ */
+static void remember(Worker *worker, const ScanEntry *entry, const TagIndex *index)
+{
+    ScanContext *ctx = worker->pool->ctx;
+    if (ctx->caching && entry->has_stat)
+        cache_put(&ctx->cache, &entry->st, index);
+}
+
+/**
+ * Reports a file straight from the tag cache.
+ *
+ * @param worker The worker running the task.
+ * @param arg The ScanEntry of the file.
+ *
+ * @logic
+ * 1. Rebuilds the index from the cache record, taking the frame list from the worker arena;
+ *    pictures keep only their cached prefix, which is all the scan displays.
+ * 2. Prints the report with `report_file` without touching the file.
+ */
+static void scan_cached_task(Worker *worker, void *arg)
+{
+    ScanEntry *self = arg;
+    ScanContext *ctx = worker->pool->ctx;
+    const CacheEntry *cached = cache_lookup(&ctx->cache, &self->st);
+
+    TagIndex index;
+    if (cache_load_index(&ctx->cache, cached, -1, &index, &worker->arena) == e_failure)
+    {
+        report_file(worker, self->path, NULL, 0);
+    }
+    else
+    {
+        report_file(worker, self->path, &index, 0);
+        free_tag_index(&index);
+    }
+    atomic_fetch_add(&ctx->cached, 1);
+    release_entry(self);
+}
+
+/**
+ * Reads, parses and reports one file synchronously (used when prefetching is off).
+ *
+ * @param worker The worker running the task.
+ * @param arg The ScanEntry of the file.
+ *
+ * @logic
+ * 1. Reads and indexes the tag with `read_tag_index`, taking the tag buffer and frame list from the worker arena.
+ * 2. Prints the report with `report_file` and records the tag in the cache.
+ */
+static void scan_file_task(Worker *worker, void *arg)
+{
+    ScanEntry *self = arg;
+    int fd = open(self->path, O_RDONLY);
+    if (fd == -1)
+    {
+        report_file(worker, self->path, NULL, errno);
+    }
+    else
+    {
+        TagIndex index;
+        if (read_tag_index(fd, &index, &worker->arena) == e_failure)
+        {
+            report_file(worker, self->path, NULL, 0);
+            remember(worker, self, NULL);
+        }
+        else
+        {
+            report_file(worker, self->path, &index, 0);
+            remember(worker, self, &index);
+            free_tag_index(&index);
+        }
+        close(fd);
+    }
+    release_entry(self);
+}
+
+/**
+ * Parses and reports a file whose tag the prefetcher has already read.
+ *
+ * @param worker The worker running the task.
+ * @param arg The PrefetchSlot holding the start of the file.
+ *
+ * @logic
+ * 1. Indexes the tag straight out of the slot buffer, taking the frame list from the worker arena,
+ *    and merges an appended tag if a SEEK frame points to one. A tag over TAG_READ_LIMIT was
+ *    not buffered: index it with `read_tag_index` from the file the prefetcher left open.
+ * 2. Prints the report with `report_file` and records the tag in the cache.
+ * 3. Returns the slot to the prefetcher so the next file can be read into it.
+ */
+static void scan_prefetched_task(Worker *worker, void *arg)
+{
+    PrefetchSlot *slot = arg;
+    ScanContext *ctx = worker->pool->ctx;
+    ScanEntry *self = slot->request->arg;
+
+    TagIndex index;
+    if (slot->error)
+    {
+        report_file(worker, self->path, NULL, slot->error);
+    }
+    else if (slot->large)
+    {
+        if (read_tag_index(slot->fd, &index, &worker->arena) == e_failure)
+        {
+            report_file(worker, self->path, NULL, 0);
+            remember(worker, self, NULL);
+        }
+        else
+        {
+            report_file(worker, self->path, &index, 0);
+            remember(worker, self, &index);
+            free_tag_index(&index);
+        }
+    }
+    else if (index_tag_buffer(slot->buffer, slot->length, &index, &worker->arena) == e_failure)
+    {
+        report_file(worker, self->path, NULL, 0);
+        remember(worker, self, NULL);
+    }
+    else
+    {
+        // The prefetcher has closed the file: it is reopened only to follow a SEEK frame to an appended tag.
+        int fd = find_frame(&index, "SEEK") ? open(self->path, O_RDONLY) : -1;
+        if (fd != -1 && read_appended_tag(fd, &index) == e_failure)
+        {
+            report_file(worker, self->path, NULL, ENOMEM);
+        }
+        else
+        {
+            report_file(worker, self->path, &index, 0);
+            remember(worker, self, &index);
+            free_tag_index(&index);
+        }
+        if (fd != -1)
+            close(fd);
+    }
+    release_prefetch_slot(&ctx->prefetcher, slot);
+    release_entry(self);
+}
+
+/**
+ * Returns the number of worker threads used for a scan.
+ *
+ * @return The number of online cores, clamped to 1..POOL_MAX_WORKERS.
+ */
+int scan_thread_count(void)
+{
+    return pool_thread_count();
+}
+
+/**
+ * Scans a directory tree and prints the ID3v2 tags of every file in it.
+ *
+ * @param root Directory to scan recursively.
+ * @param tags Tags to print for each file, or NULL to print every tag.
+ * @param tag_count Number of entries in tags.
+ * @return e_success if the tree was scanned, e_failure on error.
+ *
+ * @logic
+ * 1. Creates a work-stealing pool with one worker per online core, and gives each
+ *    worker a report stream that is reused for every file it scans.
+ * 2. Starts the prefetcher, which keeps up to PREFETCH_DEPTH files being opened and read
+ *    (io_uring, or blocking I/O threads as a fallback) and hands each buffered tag to the pool.
+ * 3. Walks the tree with `walk_library`; directory tasks queue their children,
+ *    so both the walk and the parsing are spread over the workers, and a worker stuck
+ *    on a large file does not hold back the files queued behind it.
+ * 4. Files whose tag cache entry is still fresh are reported without being opened;
+ *    the others are parsed and written back to the cache once the scan has finished.
+ * 5. Prints a summary once every task has finished.
+ */
+Status scan_library(const char *root, const char *const *tags, int tag_count)
+{
+    ScanContext ctx = {
+        .tags = tags,
+        .tag_count = tag_count,
+        .output_lock = PTHREAD_MUTEX_INITIALIZER,
+    };
+
+    struct stat st;
+    if (stat(root, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        fprintf(stderr, "ERROR: %s is not a directory\n", root);
+        return e_failure;
+    }
+
+    WorkPool pool;
+    if (init_pool(&pool, scan_thread_count(), &ctx) == e_failure)
+        return e_failure;
+    atomic_init(&ctx.cached, 0);
+    ctx.caching = open_tag_cache(&ctx.cache) == e_success;
+
+    ScanWorker locals[pool.worker_count];
+    memset(locals, 0, sizeof(locals));
+    cookie_io_functions_t report_io = {.write = report_write};
+    Status status = e_success;
+    for (int i = 0; i < pool.worker_count; i++)
+    {
+        locals[i].out = fopencookie(&locals[i], "w", report_io);
+        if (!locals[i].out)
+        {
+            perror("ERROR: fopencookie failed");
+            status = e_failure;
+            break;
+        }
+        pool.workers[i].local = &locals[i];
+    }
+
+    int prefetching = 0;
+    if (status == e_success)
+    {
+        status = start_prefetcher(&ctx.prefetcher, &pool, scan_prefetched_task);
+        prefetching = status == e_success;
+    }
+
+    ScanWalk walk = {.visit_file = scan_visit_file, .stat_files = ctx.caching};
+    if (status == e_success)
+        status = walk_library(&pool, &walk, root);
+
+    if (prefetching)
+        stop_prefetcher(&ctx.prefetcher);
+
+    int workers = pool.worker_count;
+    for (int i = 0; i < pool.worker_count; i++)
+    {
+        if (locals[i].out)
+            fclose(locals[i].out);
+        free(locals[i].report);
+    }
+    free_pool(&pool);
+
+    if (ctx.caching)
+    {
+        if (status == e_success)
+            save_tag_cache(&ctx.cache);
+        close_tag_cache(&ctx.cache);
+    }
+
+    if (status == e_success)
+        fprintf(stdout, "\nLOG: Scanned %ld files, %ld with an ID3v2 tag, %ld from the cache, using %d threads and %s I/O.\n", ctx.files, ctx.tagged, atomic_load(&ctx.cached), workers, prefetch_backend_name(ctx.prefetcher.backend));
+    return status;
+}
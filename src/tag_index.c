@@ -0,0 +1,917 @@
+#include "tag_index.h"
+#include "unsync.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Grows the index buffer so that it holds at least `needed` bytes of the file.
+ *
+ * @param mp3 File pointer to the MP3 file (positioned at index->buffer_len).
+ * @param index The tag index whose buffer is extended.
+ * @param needed The number of bytes from the start of the file that must be buffered.
+ * @return e_success if the bytes were read, e_failure on error or end of file.
+ *
+ * @logic
+ * 1. Reallocate the buffer to the requested length.
+ * 2. Read the missing bytes from the current file position.
+ */
+static Status extend_buffer(FILE *mp3, TagIndex *index, long needed)
+{
+    uint8_t *grown = (uint8_t *)realloc(index->buffer, needed);
+    if (!grown)
+    {
+        perror("ERROR: realloc failed for tag buffer");
+        return e_failure;
+    }
+    index->buffer = grown;
+
+    size_t missing = needed - index->buffer_len;
+    size_t got = fread(index->buffer + index->buffer_len, 1, missing, mp3);
+    index->buffer_len += got;
+    return got == missing ? e_success : e_failure;
+}
+
+typedef struct
+{
+    int header_len; // Bytes in a frame header.
+    Status (*decode)(const uint8_t *header, FrameEntry *frame);
+    // Fills in the ID, size and flags of a frame; fails for padding or a malformed ID.
+} FrameDecoder;
+
+/**
+ * Checks that the bytes of a frame ID are all A-Z or 0-9.
+ *
+ * @param id The first byte of the frame header.
+ * @param len Number of characters in the ID.
+ * @return e_success if the ID is well formed, e_failure for padding or garbage.
+ */
+static Status is_frame_id(const uint8_t *id, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        if (!((id[i] >= 'A' && id[i] <= 'Z') || (id[i] >= '0' && id[i] <= '9')))
+            return e_failure;
+    }
+    return e_success;
+}
+
+// ID3v2.2 frame IDs and the v2.3 frames they became.
+static const char v22_ids[][2][5] = {
+    {"BUF", "RBUF"}, {"CNT", "PCNT"}, {"COM", "COMM"}, {"ETC", "ETCO"}, {"GEO", "GEOB"},
+    {"IPL", "TIPL"}, {"MCI", "MCDI"}, {"MLL", "MLLT"}, {"POP", "POPM"}, {"REV", "RVRB"},
+    {"SLT", "SYLT"}, {"STC", "SYTC"}, {"TAL", "TALB"}, {"TBP", "TBPM"}, {"TCM", "TCOM"},
+    {"TCO", "TCON"}, {"TCR", "TCOP"}, {"TDY", "TDLY"}, {"TEN", "TENC"}, {"TFT", "TFLT"},
+    {"TKE", "TKEY"}, {"TLA", "TLAN"}, {"TLE", "TLEN"}, {"TMT", "TMED"}, {"TOA", "TOPE"},
+    {"TOF", "TOFN"}, {"TOL", "TOLY"}, {"TOT", "TOAL"}, {"TP1", "TPE1"}, {"TP2", "TPE2"},
+    {"TP3", "TPE3"}, {"TP4", "TPE4"}, {"TPA", "TPOS"}, {"TPB", "TPUB"}, {"TRC", "TSRC"},
+    {"TRK", "TRCK"}, {"TSS", "TSSE"}, {"TT1", "TIT1"}, {"TT2", "TIT2"}, {"TT3", "TIT3"},
+    {"TXT", "TEXT"}, {"TXX", "TXXX"}, {"TYE", "TYER"}, {"UFI", "UFID"}, {"ULT", "USLT"},
+    {"WAF", "WOAF"}, {"WAR", "WOAR"}, {"WAS", "WOAS"}, {"WCM", "WCOM"}, {"WCP", "WCOP"},
+    {"WPB", "WPUB"}, {"WXX", "WXXX"}};
+
+/**
+ * Decodes an ID3v2.2 frame header: 3-character ID, 3-byte big-endian size, no flags.
+ *
+ * @logic
+ * 1. Map the ID to its v2.3 equivalent; an ID without one (e.g. PIC, whose layout
+ *    differs from APIC) keeps its three characters and is skipped by the display.
+ */
+static Status decode_v22(const uint8_t *header, FrameEntry *frame)
+{
+    if (is_frame_id(header, 3) == e_failure)
+        return e_failure;
+    memcpy(frame->id, header, 3);
+    frame->id[3] = '\0';
+    for (size_t i = 0; i < sizeof(v22_ids) / sizeof(v22_ids[0]); i++)
+    {
+        if (memcmp(header, v22_ids[i][0], 3) == 0)
+        {
+            memcpy(frame->id, v22_ids[i][1], 5);
+            break;
+        }
+    }
+    frame->size = (unsigned int)header[3] << 16 | (unsigned int)header[4] << 8 | header[5];
+    frame->flags[0] = frame->flags[1] = 0;
+    return e_success;
+}
+
+/**
+ * Decodes an ID3v2.3 frame header: 4-character ID, 32-bit big-endian size, 2 flag bytes.
+ */
+static Status decode_v23(const uint8_t *header, FrameEntry *frame)
+{
+    if (is_frame_id(header, 4) == e_failure)
+        return e_failure;
+    memcpy(frame->id, header, 4);
+    frame->id[4] = '\0';
+    frame->size = id3v2_tag_size(header + 4);
+    frame->flags[0] = header[8];
+    frame->flags[1] = header[9];
+    return e_success;
+}
+
+/**
+ * Decodes an ID3v2.4 frame header, whose size is syncsafe (7 bits per byte).
+ */
+static Status decode_v24(const uint8_t *header, FrameEntry *frame)
+{
+    if (decode_v23(header, frame) == e_failure)
+        return e_failure;
+    frame->size = id3v2_header_size(header + 4);
+    return e_success;
+}
+
+static const FrameDecoder frame_decoders[] = {
+    {6, decode_v22},
+    {10, decode_v23},
+    {10, decode_v24}};
+
+/**
+ * Checks the tag header and picks the frame decoder of its version, once per file.
+ *
+ * @param header The 10-byte tag header.
+ * @param index The tag index; header_size and version are filled in.
+ * @return The decoder, or NULL if there is no ID3v2.2-2.4 header.
+ */
+static const FrameDecoder *select_decoder(const uint8_t *header, TagIndex *index)
+{
+    if (memcmp(header, "ID3", 3) != 0 || header[3] < 2 || header[3] > 4)
+        return NULL;
+    index->version = header[3];
+    index->header_size = id3v2_header_size(header + 6);
+    return &frame_decoders[header[3] - 2];
+}
+
+/**
+ * Works out where the first frame starts, skipping an extended header.
+ *
+ * @param index The tag index (version set).
+ * @param header The 10-byte tag header.
+ * @param ext The 4 bytes after the tag header (the extended header size, if there is one).
+ * @return The offset of the first frame, or -1 if the frames cannot be parsed; callers
+ *         treat the whole declared tag as unreadable then.
+ *
+ * @logic
+ * 1. v2.3 declares the extended header size without its own 4 bytes; v2.4 declares it
+ *    syncsafe and including them.
+ * 2. In v2.2 the same flag means the tag is compressed, which is not supported.
+ */
+static long first_frame(const TagIndex *index, const uint8_t *header, const uint8_t *ext)
+{
+    if (!(header[5] & TAG_FLAG_EXTENDED))
+        return 10;
+    if (index->version == 2)
+        return -1;
+    if (index->version == 3)
+        return 10 + 4 + (long)id3v2_tag_size(ext);
+    return 10 + (long)id3v2_header_size(ext);
+}
+
+/**
+ * Moves the audio offset past a v2.4 footer, which follows the declared tag instead of padding.
+ */
+static void skip_footer(TagIndex *index, const uint8_t *header)
+{
+    long declared_end = 10 + (long)index->header_size;
+    if (index->version == 4 && (header[5] & TAG_FLAG_FOOTER) && index->frames_end <= declared_end)
+        index->audio_offset = declared_end + 10;
+}
+
+/**
+ * Appends a frame entry to the index.
+ *
+ * @param index The tag index.
+ * @param decoder The frame decoder of the tag's version.
+ * @param header The frame header.
+ * @param offset File offset of the frame header.
+ * @param capacity Number of entries currently allocated for the frame list.
+ * @return A pointer to the new entry, or NULL on allocation failure.
+ *
+ * @logic
+ * 1. Double the capacity of the frame array when it is full, taking the new array
+ *    from the index arena if it has one (the old array is released with the arena).
+ * 2. Fill in the ID, size and flags with the decoder.
+ */
+static FrameEntry *add_frame(TagIndex *index, const FrameDecoder *decoder, const uint8_t *header, long offset, int *capacity)
+{
+    if (index->frame_count == *capacity)
+    {
+        int new_capacity = *capacity ? *capacity * 2 : 16;
+        FrameEntry *grown;
+        if (index->arena)
+        {
+            grown = (FrameEntry *)arena_alloc(index->arena, new_capacity * sizeof(FrameEntry));
+            if (grown && index->frame_count)
+                memcpy(grown, index->frames, index->frame_count * sizeof(FrameEntry));
+        }
+        else
+        {
+            grown = (FrameEntry *)realloc(index->frames, new_capacity * sizeof(FrameEntry));
+        }
+        if (!grown)
+        {
+            perror("ERROR: realloc failed for frame list");
+            return NULL;
+        }
+        index->frames = grown;
+        *capacity = new_capacity;
+    }
+
+    FrameEntry *frame = &index->frames[index->frame_count++];
+    decoder->decode(header, frame);
+    frame->offset = offset;
+    frame->header_len = decoder->header_len;
+    frame->available = frame->size;
+    return frame;
+}
+
+/**
+ * Returns non-zero if the whole tag after the header is unsynchronised (v2.2 and v2.3).
+ */
+static int whole_tag_unsync(const TagIndex *index, const uint8_t *header)
+{
+    return (header[5] & TAG_FLAG_UNSYNC) && index->version < 4;
+}
+
+/**
+ * Removes the per-frame unsynchronisation of a v2.4 tag, in place.
+ *
+ * @param index The tag index; the data of every frame to decode must be in memory.
+ * @param header The 10-byte tag header.
+ *
+ * @logic
+ * 1. A frame is unsynchronised if its own flag or the tag header flag says so.
+ * 2. Drop its data length indicator, decode the data with `unsync_decode` and clear
+ *    both flags, so the frame reads (and is rewritten) as plain data.
+ */
+static void decode_frames(TagIndex *index, const uint8_t *header)
+{
+    if (index->version != 4)
+        return;
+    for (int i = 0; i < index->frame_count; i++)
+    {
+        FrameEntry *frame = &index->frames[i];
+        if (!(frame->flags[1] & FRAME_FLAG_UNSYNC) && !(header[5] & TAG_FLAG_UNSYNC))
+            continue;
+        if (frame->available < frame->size)
+            continue;
+        if ((frame->flags[1] & FRAME_FLAG_LENGTH) && frame->size >= 4)
+        {
+            frame->data += 4;
+            frame->size -= 4;
+        }
+        frame->size = unsync_decode(frame->data, frame->size);
+        frame->available = frame->size;
+        frame->flags[1] &= ~(FRAME_FLAG_UNSYNC | FRAME_FLAG_LENGTH);
+        index->decoded = 1;
+    }
+}
+
+static Status no_more(TagIndex *index, long needed, void *ctx);
+
+/**
+ * Walks the frames of a buffered tag and records them in the index.
+ *
+ * @param index The tag index; its buffer must hold at least the 10-byte header.
+ * @param decoder The frame decoder of the tag's version, chosen once by `select_decoder`.
+ * @param more Callback that makes at least `needed` bytes of the file available in the buffer.
+ * @param ctx Context passed to the callback.
+ * @return e_success if the frames were indexed, e_failure on allocation failure.
+ *
+ * @logic
+ * 1. Decode a tag that is unsynchronised as a whole in place first; the walk then
+ *    stays inside the decoded buffer.
+ * 2. Skip an extended header, then walk the frames until padding or a malformed frame ID
+ *    is found, asking for more bytes if a frame runs past the end of the buffer.
+ * 3. Record each frame's ID, offset, size and flags. Frames this tool does not know are
+ *    recorded too and stepped over by their size, so they neither end the walk nor get
+ *    lost when the tag is rewritten.
+ * 4. Data pointers are fixed up once the buffer can no longer move, and v2.4 frames
+ *    that are unsynchronised are decoded.
+ * 5. The audio starts after the declared tag when the gap after the frames is padding,
+ *    otherwise right after the last frame, and after the footer of a v2.4 tag that has one.
+ */
+static Status walk_frames(TagIndex *index, const FrameDecoder *decoder, Status (*more)(TagIndex *, long, void *), void *ctx)
+{
+    int capacity = 0;
+    int header_len = decoder->header_len;
+    long raw_len = index->buffer_len;
+    if (whole_tag_unsync(index, index->buffer))
+    {
+        index->buffer_len = 10 + unsync_decode(index->buffer + 10, index->buffer_len - 10);
+        index->decoded = 1;
+        more = no_more;
+    }
+    long pos = 10;
+    if ((index->buffer[5] & TAG_FLAG_EXTENDED) && (index->buffer_len >= 14 || more(index, 14, ctx) == e_success))
+        pos = first_frame(index, index->buffer, index->buffer + 10);
+    int readable = pos >= 0 && pos <= 10 + (long)index->header_size;
+    if (!readable)
+        pos = 10 + (long)index->header_size;
+    FrameEntry probe;
+    while (readable)
+    {
+        if (pos + header_len > index->buffer_len && more(index, pos + header_len, ctx) == e_failure)
+            break;
+        if (decoder->decode(index->buffer + pos, &probe) == e_failure)
+            break;
+
+        long frame_end = pos + header_len + probe.size;
+        if (frame_end > index->buffer_len && more(index, frame_end, ctx) == e_failure)
+            break;
+
+        if (add_frame(index, decoder, index->buffer + pos, pos, &capacity) == NULL)
+            return e_failure;
+        pos = frame_end;
+    }
+    index->frames_end = pos;
+
+    for (int i = 0; i < index->frame_count; i++)
+    {
+        index->frames[i].data = index->buffer + index->frames[i].offset + header_len;
+    }
+    decode_frames(index, index->buffer);
+
+    long declared_end = 10 + (long)index->header_size;
+    index->audio_offset = index->frames_end;
+    if (declared_end > index->frames_end && declared_end <= index->buffer_len)
+    {
+        long i = index->frames_end;
+        while (i < declared_end && index->buffer[i] == 0)
+            i++;
+        if (i == declared_end)
+            index->audio_offset = declared_end;
+    }
+    if (whole_tag_unsync(index, index->buffer))
+        index->audio_offset = declared_end < raw_len ? declared_end : raw_len;
+    skip_footer(index, index->buffer);
+    if (index->decoded)
+        index->fd = -1;
+    return e_success;
+}
+
+/**
+ * Allocates the tag buffer of an index from its arena if it has one, from the heap otherwise.
+ *
+ * @param index The tag index; an arena buffer is marked borrowed, so it is released
+ *        with the arena rather than by free_tag_index.
+ * @param size The number of bytes.
+ * @return The buffer, or NULL on allocation failure.
+ */
+static uint8_t *alloc_tag_buffer(TagIndex *index, size_t size)
+{
+    if (!index->arena)
+        return (uint8_t *)malloc(size);
+    index->borrowed = 1;
+    return (uint8_t *)arena_alloc(index->arena, size);
+}
+
+/**
+ * Indexes a tag too large to read whole, reading each frame header separately.
+ *
+ * @param fd File descriptor of the MP3 file.
+ * @param index The tag index (header_size, version, arena and fd already set).
+ * @param decoder The frame decoder of the tag's version.
+ * @param header The 10-byte tag header.
+ * @param base File offset of the tag header: 0, or the start of an appended tag.
+ * @param length End of the region to index: base + 10 + the declared size, clamped to the file size.
+ * @return e_success if the tag was parsed, e_failure on error.
+ *
+ * @logic
+ * 1. pread the frame headers one after another from the first frame, stepping over each
+ *    frame by its size, until padding, a malformed ID or a frame running past `length`.
+ * 2. Frames up to TAG_FRAME_LOAD_LIMIT bytes are read whole; larger ones (pictures) only
+ *    keep a TAG_FRAME_PREFIX prefix, and the rest is read or copied from fd when needed.
+ *    Unsynchronised frames are read whole and decoded, as their bytes cannot be copied.
+ *    The loaded data is packed into one buffer after the tag header.
+ * 3. The audio starts after the declared tag if the gap after the frames is all zeros,
+ *    checked a block at a time.
+ */
+static Status index_large_tag(int fd, TagIndex *index, const FrameDecoder *decoder, const uint8_t *header, long base, long length)
+{
+    int capacity = 0;
+    int header_len = decoder->header_len;
+    long pos = base + 10, loaded = 10;
+    uint8_t frame_header[10];
+    if ((header[5] & TAG_FLAG_EXTENDED) && pread(fd, frame_header, 4, base + 10) == 4)
+    {
+        long first = first_frame(index, header, frame_header);
+        pos = first < 0 ? length : base + first;
+    }
+    if (pos > length)
+        pos = length;
+    FrameEntry probe;
+    while (pos + header_len <= length && pread(fd, frame_header, header_len, pos) == header_len)
+    {
+        if (decoder->decode(frame_header, &probe) == e_failure)
+            break;
+        long frame_end = pos + header_len + probe.size;
+        if (frame_end > length)
+            break;
+        FrameEntry *frame = add_frame(index, decoder, frame_header, pos, &capacity);
+        if (frame == NULL)
+        {
+            free_tag_index(index);
+            return e_failure;
+        }
+        int unsync = (frame->flags[1] & FRAME_FLAG_UNSYNC) || (header[5] & TAG_FLAG_UNSYNC);
+        if (frame->size > TAG_FRAME_LOAD_LIMIT && !(index->version == 4 && unsync))
+            frame->available = TAG_FRAME_PREFIX;
+        loaded += frame->available;
+        pos = frame_end;
+    }
+    index->frames_end = pos;
+
+    index->buffer = alloc_tag_buffer(index, loaded);
+    if (!index->buffer)
+    {
+        perror("ERROR: malloc failed for tag buffer");
+        free_tag_index(index);
+        return e_failure;
+    }
+    memcpy(index->buffer, header, 10);
+    index->buffer_len = loaded;
+    uint8_t *data = index->buffer + 10;
+    for (int i = 0; i < index->frame_count; i++)
+    {
+        FrameEntry *frame = &index->frames[i];
+        if (pread(fd, data, frame->available, frame->offset + header_len) != (ssize_t)frame->available)
+        {
+            perror("ERROR: pread failed for frame data");
+            free_tag_index(index);
+            return e_failure;
+        }
+        frame->data = data;
+        data += frame->available;
+    }
+    decode_frames(index, header);
+
+    index->audio_offset = index->frames_end;
+    if (length == base + 10 + (long)index->header_size && length > index->frames_end)
+    {
+        uint8_t block[4096];
+        long i = index->frames_end;
+        while (i < length)
+        {
+            long chunk = length - i < (long)sizeof(block) ? length - i : (long)sizeof(block);
+            if (pread(fd, block, chunk, i) != chunk)
+                break;
+            long j = 0;
+            while (j < chunk && block[j] == 0)
+                j++;
+            if (j < chunk)
+                break;
+            i += chunk;
+        }
+        if (i == length)
+            index->audio_offset = length;
+    }
+    skip_footer(index, header);
+    if (index->decoded)
+        index->fd = -1;
+    return e_success;
+}
+
+/**
+ * Reads more of the file into a buffered tag index (callback for walk_frames).
+ *
+ * @param index The tag index.
+ * @param needed The number of bytes from the start of the file that must be buffered.
+ * @param mp3 File pointer to the MP3 file.
+ * @return e_success if the bytes were read, e_failure otherwise.
+ */
+static Status read_more(TagIndex *index, long needed, void *mp3)
+{
+    return extend_buffer((FILE *)mp3, index, needed);
+}
+
+/**
+ * Builds an in-memory index of all the frames in the ID3v2 tag.
+ *
+ * @param mp3 File pointer to the MP3 file.
+ * @param index The tag index to fill in; release it with free_tag_index().
+ * @return e_success if the tag was parsed, e_failure on error.
+ *
+ * @logic
+ * 1. Read the 10-byte header, decode the declared tag size and pick the frame decoder of its version.
+ * 2. Read the whole declared tag region in a single fread.
+ * 3. Walk the frames inside the buffer, extending it if a frame runs past the declared size.
+ * 4. A tag over TAG_READ_LIMIT is indexed with `index_large_tag` instead, so a large
+ *    picture is copied from the file when the tag is rewritten rather than held in memory.
+ * 5. Merge the frames of a tag appended to the file with `read_appended_tag`.
+ */
+Status build_tag_index(FILE *mp3, TagIndex *index)
+{
+    memset(index, 0, sizeof(*index));
+    index->fd = -1;
+    if (!mp3)
+    {
+        fprintf(stderr, "ERROR: Invalid file pointer.\n");
+        return e_failure;
+    }
+
+    if (fseek(mp3, 0, SEEK_SET) != 0)
+    {
+        perror("ERROR: fseek failed while seeking tag header");
+        return e_failure;
+    }
+
+    uint8_t header[10];
+    const FrameDecoder *decoder;
+    if (fread(header, 1, 10, mp3) != 10 || (decoder = select_decoder(header, index)) == NULL)
+    {
+        return e_failure;
+    }
+    index->fd = fileno(mp3);
+    if (10 + (long)index->header_size > TAG_READ_LIMIT && !whole_tag_unsync(index, header))
+    {
+        struct stat st;
+        long length = 10 + (long)index->header_size;
+        if (fstat(index->fd, &st) == 0 && length > st.st_size)
+            length = st.st_size;
+        if (index_large_tag(index->fd, index, decoder, header, 0, length) == e_failure)
+            return e_failure;
+        return read_appended_tag(fileno(mp3), index);
+    }
+
+    index->buffer = (uint8_t *)malloc(10);
+    if (!index->buffer)
+    {
+        perror("ERROR: malloc failed for tag buffer");
+        return e_failure;
+    }
+    memcpy(index->buffer, header, 10);
+    index->buffer_len = 10;
+
+    extend_buffer(mp3, index, 10 + (long)index->header_size);
+
+    if (walk_frames(index, decoder, read_more, mp3) == e_failure)
+    {
+        free_tag_index(index);
+        return e_failure;
+    }
+    return read_appended_tag(fileno(mp3), index);
+}
+
+/**
+ * Stops a walk at the end of a buffer that already holds the whole tag (callback for walk_frames).
+ *
+ * @return e_failure, as no more of the file is available.
+ */
+static Status no_more(TagIndex *index, long needed, void *ctx)
+{
+    (void)index;
+    (void)needed;
+    (void)ctx;
+    return e_failure;
+}
+
+/**
+ * Builds an index of the ID3v2 tag from a single read of the declared tag region.
+ *
+ * @param fd File descriptor of the MP3 file (opened for reading).
+ * @param index The tag index to fill in; release it with free_tag_index().
+ * @param arena Arena for the tag buffer and frame list, or NULL to allocate them on the heap.
+ * @return e_success if the tag was parsed, e_failure on error.
+ *
+ * @logic
+ * 1. Read the 10-byte header, decode the declared tag size and pick the frame decoder of its version.
+ * 2. Read exactly 10 + the declared size (clamped to the file size) with one pread into
+ *    a buffer from the arena, so a scan worker makes no heap allocation per file;
+ *    the audio after the tag is never read.
+ * 3. Walk the frames inside that buffer only; a frame running past the declared tag ends the walk.
+ * 4. A tag over TAG_READ_LIMIT is indexed with `index_large_tag` instead, unless it must be decoded whole.
+ * 5. Merge the frames of a tag appended to the file with `read_appended_tag`.
+ */
+Status read_tag_index(int fd, TagIndex *index, Arena *arena)
+{
+    memset(index, 0, sizeof(*index));
+    index->arena = arena;
+    index->fd = fd;
+
+    uint8_t header[10];
+    const FrameDecoder *decoder;
+    if (pread(fd, header, 10, 0) != 10 || (decoder = select_decoder(header, index)) == NULL)
+    {
+        return e_failure;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        perror("ERROR: fstat failed");
+        return e_failure;
+    }
+    long length = 10 + (long)index->header_size;
+    if (length > st.st_size)
+        length = st.st_size;
+    if (length > TAG_READ_LIMIT && !whole_tag_unsync(index, header))
+    {
+        if (index_large_tag(fd, index, decoder, header, 0, length) == e_failure)
+            return e_failure;
+        return read_appended_tag(fd, index);
+    }
+
+    index->buffer = alloc_tag_buffer(index, length);
+    if (!index->buffer)
+    {
+        perror("ERROR: malloc failed for tag buffer");
+        return e_failure;
+    }
+    memcpy(index->buffer, header, 10);
+    long got = 10;
+    while (got < length)
+    {
+        ssize_t n = pread(fd, index->buffer + got, length - got, got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    index->buffer_len = got;
+
+    if (walk_frames(index, decoder, no_more, NULL) == e_failure)
+    {
+        free_tag_index(index);
+        return e_failure;
+    }
+    return read_appended_tag(fd, index);
+}
+
+/**
+ * Reads a tag from a stream that cannot seek, such as a pipe.
+ *
+ * @param fd Descriptor positioned at the start of the MP3 data.
+ * @param index The tag index to fill in; release it with free_tag_index().
+ * @return e_success if the tag was parsed, e_failure if there is no ID3v2 header or on error.
+ *
+ * @logic
+ * 1. Read the 10-byte header, decode the declared tag size and pick the frame decoder of its version.
+ * 2. Read exactly the declared tag; the descriptor is left at the first byte after it,
+ *    so the audio can be passed on without ever being buffered.
+ * 3. Walk the frames inside the buffer, which the index owns.
+ */
+Status stream_tag_index(int fd, TagIndex *index)
+{
+    memset(index, 0, sizeof(*index));
+    index->fd = -1;
+
+    uint8_t header[10];
+    long got = 0;
+    while (got < 10)
+    {
+        ssize_t n = read(fd, header + got, 10 - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return e_failure;
+        got += n;
+    }
+    const FrameDecoder *decoder = select_decoder(header, index);
+    if (decoder == NULL)
+    {
+        return e_failure;
+    }
+
+    long length = 10 + (long)index->header_size;
+    index->buffer = (uint8_t *)malloc(length);
+    if (!index->buffer)
+    {
+        perror("ERROR: malloc failed for tag buffer");
+        return e_failure;
+    }
+    memcpy(index->buffer, header, 10);
+    while (got < length)
+    {
+        ssize_t n = read(fd, index->buffer + got, length - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    index->buffer_len = got;
+
+    if (walk_frames(index, decoder, no_more, NULL) == e_failure)
+    {
+        free_tag_index(index);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/**
+ * Builds an index of a tag the caller has already read into memory.
+ *
+ * @param buffer The first `length` bytes of the file; must outlive the index.
+ * @param length Number of bytes in buffer, normally at least 10 plus the declared tag size.
+ * @param index The tag index to fill in; release it with free_tag_index().
+ * @param arena Arena for the frame list, or NULL to allocate it on the heap.
+ * @return e_success if the tag was parsed, e_failure if there is no ID3v2 header or on error.
+ *
+ * @logic
+ * 1. Check the header, decode the declared tag size and pick the frame decoder of its version.
+ * 2. Walk the frames inside the buffer; a frame running past its end ends the walk.
+ */
+Status index_tag_buffer(uint8_t *buffer, long length, TagIndex *index, Arena *arena)
+{
+    memset(index, 0, sizeof(*index));
+    index->arena = arena;
+    index->fd = -1;
+
+    const FrameDecoder *decoder;
+    if (length < 10 || (decoder = select_decoder(buffer, index)) == NULL)
+    {
+        return e_failure;
+    }
+    index->buffer = buffer;
+    index->buffer_len = length;
+    index->borrowed = 1;
+
+    if (walk_frames(index, decoder, no_more, NULL) == e_failure)
+    {
+        free_tag_index(index);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/**
+ * Merges the frames of an appended tag into the frame list of the prepended one.
+ *
+ * @param index The index of the prepended tag.
+ * @param appended The index of the appended tag.
+ * @return e_success, or e_failure on allocation failure.
+ *
+ * @logic
+ * 1. The appended tag is an update: each of its frames replaces the first frame with
+ *    the same ID in the prepended tag, keeping that frame's place in the list.
+ * 2. Frames the prepended tag does not have follow its own.
+ */
+static Status merge_frames(TagIndex *index, const TagIndex *appended)
+{
+    int prepended = index->frame_count;
+    size_t size = (prepended + appended->frame_count) * sizeof(FrameEntry);
+    FrameEntry *merged = (FrameEntry *)(index->arena ? arena_alloc(index->arena, size) : malloc(size));
+    if (!merged)
+    {
+        perror("ERROR: malloc failed for frame list");
+        return e_failure;
+    }
+    if (prepended)
+        memcpy(merged, index->frames, prepended * sizeof(FrameEntry));
+
+    int count = prepended;
+    for (int i = 0; i < appended->frame_count; i++)
+    {
+        const FrameEntry *update = &appended->frames[i];
+        int j = 0;
+        while (j < prepended && (merged[j].offset >= index->appended_offset || strcmp(merged[j].id, update->id) != 0))
+            j++;
+        merged[j < prepended ? j : count++] = *update;
+    }
+    if (!index->arena)
+        free(index->frames);
+    index->frames = merged;
+    index->frame_count = count;
+    return e_success;
+}
+
+/**
+ * Finds a tag appended to the end of the file and merges it into the index.
+ *
+ * @param fd Descriptor of the MP3 file.
+ * @param index The index of the prepended tag; released on failure.
+ * @return e_success if there is no appended tag or it was merged, e_failure on allocation
+ *         failure.
+ *
+ * @logic
+ * 1. Only a v2.4 tag can point to another one: its SEEK frame holds the distance from
+ *    the declared end of the tag (padding and footer included) to the next tag, which
+ *    is not always where the audio was found to start. Without a SEEK
+ *    frame nothing more is read, so an ordinary file costs no extra I/O.
+ * 2. The target must hold a v2.4 header and end inside the file; anything else is ignored.
+ * 3. Index it like a prepended tag: read whole with one pread up to TAG_READ_LIMIT,
+ *    frame by frame with `index_large_tag` beyond, keeping frame offsets absolute.
+ * 4. Merge its frames with `merge_frames`; the index takes over its frame data.
+ */
+Status read_appended_tag(int fd, TagIndex *index)
+{
+    const FrameEntry *seek = index->version == 4 ? find_frame(index, "SEEK") : NULL;
+    if (fd < 0 || !seek || seek->available < 4)
+        return e_success;
+
+    long declared_end = 10 + (long)index->header_size + ((index->buffer[5] & TAG_FLAG_FOOTER) ? 10 : 0);
+    long start = declared_end + (long)id3v2_tag_size(seek->data);
+    uint8_t header[10];
+    struct stat st;
+    if (fstat(fd, &st) != 0 || pread(fd, header, 10, start) != 10)
+        return e_success;
+
+    TagIndex appended;
+    memset(&appended, 0, sizeof(appended));
+    appended.arena = index->arena;
+    appended.fd = fd;
+    const FrameDecoder *decoder = select_decoder(header, &appended);
+    long length = 10 + (long)appended.header_size;
+    long end = start + length + ((header[5] & TAG_FLAG_FOOTER) ? 10 : 0);
+    if (!decoder || appended.version != 4 || end > st.st_size)
+        return e_success;
+
+    if (length > TAG_READ_LIMIT)
+    {
+        if (index_large_tag(fd, &appended, decoder, header, start, start + length) == e_failure)
+        {
+            free_tag_index(index);
+            return e_failure;
+        }
+    }
+    else
+    {
+        uint8_t *buffer = alloc_tag_buffer(&appended, length);
+        if (!buffer)
+        {
+            perror("ERROR: malloc failed for appended tag");
+            free_tag_index(index);
+            return e_failure;
+        }
+        if (pread(fd, buffer, length, start) != length || index_tag_buffer(buffer, length, &appended, index->arena) == e_failure)
+        {
+            if (!index->arena)
+                free(buffer);
+            return e_success;
+        }
+        appended.borrowed = index->arena != NULL;
+        for (int i = 0; i < appended.frame_count; i++)
+            appended.frames[i].offset += start;
+    }
+
+    index->appended_offset = start;
+    index->appended_end = end;
+    if (merge_frames(index, &appended) == e_failure)
+    {
+        free_tag_index(&appended);
+        free_tag_index(index);
+        return e_failure;
+    }
+    index->appended = appended.buffer;
+    appended.buffer = NULL;
+    index->decoded |= appended.decoded;
+    if (index->fd < 0 && !index->decoded)
+        index->fd = fd;
+    free_tag_index(&appended);
+    return e_success;
+}
+
+/**
+ * Looks up a frame in the tag index.
+ *
+ * @param index The tag index.
+ * @param tag The 4-byte frame ID to search for.
+ * @return A pointer to the first matching frame, or NULL if it is not present.
+ *
+ * @logic
+ * 1. Compare the ID of every indexed frame with the requested tag.
+ */
+const FrameEntry *find_frame(const TagIndex *index, const char *tag)
+{
+    for (int i = 0; i < index->frame_count; i++)
+    {
+        if (strncmp(index->frames[i].id, tag, 4) == 0)
+        {
+            return &index->frames[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Tells whether a frame only fills a slot left free by an in-place edit.
+ *
+ * @param frame The frame.
+ * @return 1 for a PRIV frame whose owner is PADDING_FRAME_OWNER, 0 otherwise.
+ */
+int is_padding_frame(const FrameEntry *frame)
+{
+    return strcmp(frame->id, "PRIV") == 0 && frame->available >= sizeof(PADDING_FRAME_OWNER) &&
+           memcmp(frame->data, PADDING_FRAME_OWNER, sizeof(PADDING_FRAME_OWNER)) == 0;
+}
+
+/**
+ * Releases the memory held by a tag index.
+ *
+ * @param index The tag index to free.
+ */
+void free_tag_index(TagIndex *index)
+{
+    if (!index->borrowed)
+        free(index->buffer);
+    if (!index->arena)
+    {
+        free(index->frames);
+        free(index->appended);
+    }
+    memset(index, 0, sizeof(*index));
+}
@@ -0,0 +1,308 @@
+#include "text.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void text_decoder_init(TextDecoder *dec, uint8_t encoding)
+{
+    memset(dec, 0, sizeof(*dec));
+    dec->encoding = encoding <= TEXT_UTF8 ? encoding : TEXT_LEGACY;
+    dec->big_endian = encoding == TEXT_UTF16BE;
+}
+
+/**
+ * Reads one UTF-8 character.
+ *
+ * @param src The input.
+ * @param len Number of input bytes.
+ * @param final Non-zero if no input follows src.
+ * @param p Position of the character; advanced past it.
+ * @param cp Receives the code point.
+ * @param legacy Non-zero to read a byte that starts no valid sequence as ISO-8859-1
+ *        instead of U+FFFD.
+ * @return 1 if a character was read, 0 if it is cut off by the end of src.
+ */
+static int next_utf8(const uint8_t *src, size_t len, int final, size_t *p, uint32_t *cp, int legacy)
+{
+    uint8_t c = src[*p];
+    size_t n = 0;
+    uint32_t v = 0, min = 0;
+    if (c < 0x80)
+    {
+        *cp = c;
+        (*p)++;
+        return 1;
+    }
+    if (c >= 0xC2 && c <= 0xDF)
+    {
+        n = 2;
+        v = c & 0x1F;
+        min = 0x80;
+    }
+    else if (c >= 0xE0 && c <= 0xEF)
+    {
+        n = 3;
+        v = c & 0x0F;
+        min = 0x800;
+    }
+    else if (c >= 0xF0 && c <= 0xF4)
+    {
+        n = 4;
+        v = c & 0x07;
+        min = 0x10000;
+    }
+
+    size_t i = 1;
+    for (; i < n && *p + i < len; i++)
+    {
+        if ((src[*p + i] & 0xC0) != 0x80)
+            break;
+        v = (v << 6) | (src[*p + i] & 0x3F);
+    }
+    if (n && i == n && v >= min && v <= 0x10FFFF && (v < 0xD800 || v > 0xDFFF))
+    {
+        *cp = v;
+        *p += n;
+        return 1;
+    }
+    if (n && i < n && *p + i == len && !final)
+        return 0;
+    *cp = legacy ? c : 0xFFFD;
+    (*p)++;
+    return 1;
+}
+
+static uint32_t utf16_unit(const TextDecoder *dec, const uint8_t *p)
+{
+    return dec->big_endian ? (uint32_t)(p[0] << 8 | p[1]) : (uint32_t)(p[1] << 8 | p[0]);
+}
+
+/**
+ * Reads one UTF-16 character, following byte order marks.
+ *
+ * @return 1 if a character was read, 0 if it is cut off by the end of src.
+ */
+static int next_utf16(TextDecoder *dec, const uint8_t *src, size_t len, int final, size_t *p, uint32_t *cp)
+{
+    if (len - *p < 2)
+    {
+        if (!final)
+            return 0;
+        // A stray last byte is dropped.
+        *cp = 0;
+        *p = len;
+        return 1;
+    }
+    uint32_t u = utf16_unit(dec, src + *p);
+    *p += 2;
+    if (u == 0xFFFE)
+    {
+        // A byte order mark read the wrong way round: every string may carry its own.
+        dec->big_endian = !dec->big_endian;
+        u = 0xFEFF;
+    }
+    else if (u >= 0xD800 && u <= 0xDBFF)
+    {
+        if (len - *p < 2 && !final)
+        {
+            *p -= 2;
+            return 0;
+        }
+        uint32_t low = len - *p >= 2 ? utf16_unit(dec, src + *p) : 0;
+        if (low >= 0xDC00 && low <= 0xDFFF)
+        {
+            u = 0x10000 + ((u - 0xD800) << 10) + (low - 0xDC00);
+            *p += 2;
+        }
+        else
+        {
+            u = 0xFFFD;
+        }
+    }
+    else if (u >= 0xDC00 && u <= 0xDFFF)
+    {
+        u = 0xFFFD;
+    }
+    *cp = u;
+    return 1;
+}
+
+/**
+ * Writes a code point as UTF-8.
+ *
+ * @return The new write position.
+ *
+ * @logic
+ * 1. A NUL ends a string: it is not written, but the next character gets a "/" in front,
+ *    so the values of a multi-string frame stay apart. Leading and trailing NULs vanish.
+ * 2. Byte order marks are dropped.
+ */
+static size_t put_char(TextDecoder *dec, uint32_t cp, uint8_t *dst, size_t w)
+{
+    if (cp == 0)
+    {
+        dec->separate = dec->started;
+        return w;
+    }
+    if (cp == 0xFEFF)
+        return w;
+    if (dec->separate)
+    {
+        dst[w++] = '/';
+        dec->separate = 0;
+    }
+    dec->started = 1;
+    if (cp < 0x80)
+    {
+        dst[w++] = cp;
+    }
+    else if (cp < 0x800)
+    {
+        dst[w++] = 0xC0 | cp >> 6;
+        dst[w++] = 0x80 | (cp & 0x3F);
+    }
+    else if (cp < 0x10000)
+    {
+        dst[w++] = 0xE0 | cp >> 12;
+        dst[w++] = 0x80 | (cp >> 6 & 0x3F);
+        dst[w++] = 0x80 | (cp & 0x3F);
+    }
+    else
+    {
+        dst[w++] = 0xF0 | cp >> 18;
+        dst[w++] = 0x80 | (cp >> 12 & 0x3F);
+        dst[w++] = 0x80 | (cp >> 6 & 0x3F);
+        dst[w++] = 0x80 | (cp & 0x3F);
+    }
+    return w;
+}
+
+#ifdef __SSE2__
+/**
+ * Copies whole 16-byte blocks of printable ASCII (0x01 to 0x7F), which read the same in
+ * ISO-8859-1 and UTF-8.
+ *
+ * @return Number of bytes copied.
+ */
+static size_t ascii_bytes_sse2(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        if (_mm_movemask_epi8(v) | _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)))
+            break;
+        _mm_storeu_si128((__m128i *)(dst + i), v);
+    }
+    return i;
+}
+
+/**
+ * Narrows whole blocks of eight UTF-16 units between 0x01 and 0x7F to ASCII.
+ *
+ * @return Number of input bytes consumed; half as many are written.
+ */
+static size_t ascii_units_sse2(const uint8_t *src, size_t len, int big_endian, uint8_t *dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i limit = _mm_set1_epi16(0x80);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        if (big_endian)
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        __m128i ok = _mm_and_si128(_mm_cmpgt_epi16(v, zero), _mm_cmplt_epi16(v, limit));
+        if (_mm_movemask_epi8(ok) != 0xFFFF)
+            break;
+        _mm_storel_epi64((__m128i *)(dst + i / 2), _mm_packus_epi16(v, v));
+    }
+    return i;
+}
+#endif
+
+/**
+ * Converts ID3v2 text to UTF-8.
+ *
+ * @param dec The decoder, carrying the byte order and pending separator between calls.
+ * @param src The encoded text.
+ * @param len Number of bytes.
+ * @param final Non-zero if no more text follows src.
+ * @param dst Receives the UTF-8 text; TEXT_EXPANSION * len bytes.
+ * @param consumed Receives the number of bytes converted; unless final, the bytes of a
+ *        character cut off by the end of src are left for the next call.
+ * @return The number of UTF-8 bytes written.
+ *
+ * @logic
+ * 1. Runs of printable ASCII, most of a typical tag, go through the SSE2 kernels 16
+ *    input bytes at a time: copied for the 8-bit encodings, narrowed for UTF-16.
+ * 2. A block holding anything else is decoded a character at a time: ISO-8859-1
+ *    directly, UTF-8 validated (U+FFFD for malformed bytes, or ISO-8859-1 for legacy
+ *    text), UTF-16 with surrogate pairs.
+ */
+size_t text_to_utf8(TextDecoder *dec, const uint8_t *src, size_t len, int final, uint8_t *dst, size_t *consumed)
+{
+    int wide = dec->encoding == TEXT_UTF16 || dec->encoding == TEXT_UTF16BE;
+    size_t p = 0, w = 0;
+    while (p < len)
+    {
+#ifdef __SSE2__
+        if (!dec->separate)
+        {
+            size_t run = wide ? ascii_units_sse2(src + p, len - p, dec->big_endian, dst + w)
+                              : ascii_bytes_sse2(src + p, len - p, dst + w);
+            if (run > 0)
+            {
+                dec->started = 1;
+                p += run;
+                w += wide ? run / 2 : run;
+                continue;
+            }
+        }
+#endif
+        size_t stop = p + 16 < len ? p + 16 : len;
+        while (p < stop)
+        {
+            uint32_t cp;
+            int read;
+            if (dec->encoding == TEXT_LATIN1)
+            {
+                cp = src[p++];
+                read = 1;
+            }
+            else if (wide)
+            {
+                read = next_utf16(dec, src, len, final, &p, &cp);
+            }
+            else
+            {
+                read = next_utf8(src, len, final, &p, &cp, dec->encoding == TEXT_LEGACY);
+            }
+            if (!read)
+            {
+                *consumed = p;
+                return w;
+            }
+            w = put_char(dec, cp, dst, w);
+        }
+    }
+    *consumed = p;
+    return w;
+}
+
+size_t text_terminator(uint8_t encoding, const uint8_t *src, size_t len)
+{
+    if (encoding == TEXT_UTF16 || encoding == TEXT_UTF16BE)
+    {
+        for (size_t i = 0; i + 1 < len; i += 2)
+        {
+            if (src[i] == 0 && src[i + 1] == 0)
+                return i + 2;
+        }
+        return len;
+    }
+    const uint8_t *nul = (const uint8_t *)memchr(src, 0, len);
+    return nul ? (size_t)(nul - src) + 1 : len;
+}
@@ -0,0 +1,1652 @@
+#define _GNU_SOURCE
+#include "transaction.h"
+#include "edit.h"
+#include "copy.h"
+#include "unsync.h"
+#include "id3v1.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+/**
+ * Returns the number of padding bytes reserved after the frames when a tag is rewritten.
+ *
+ * @return The value of the TAG_PADDING_ENV environment variable if it is a valid size,
+ * DEFAULT_TAG_PADDING otherwise.
+ */
+int tag_padding_size(void)
+{
+    const char *value = getenv(TAG_PADDING_ENV);
+    if (value != NULL && *value != '\0')
+    {
+        char *end;
+        long padding = strtol(value, &end, 10);
+        if (*end == '\0' && padding >= 0 && padding <= MAX_TAG_PADDING)
+        {
+            return (int)padding;
+        }
+        fprintf(stderr, "WARNING: Ignoring invalid %s value \"%s\".\n", TAG_PADDING_ENV, value);
+    }
+    return DEFAULT_TAG_PADDING;
+}
+
+/**
+ * Tells whether frames that outgrow a v2.4 tag may be moved to a tag appended to the file.
+ *
+ * @return 1 if the TAG_APPEND_ENV environment variable is "on", 0 if it is unset or "off".
+ */
+int tag_append_enabled(void)
+{
+    const char *value = getenv(TAG_APPEND_ENV);
+    if (value == NULL || *value == '\0' || strcmp(value, "off") == 0)
+        return 0;
+    if (strcmp(value, "on") == 0)
+        return 1;
+    fprintf(stderr, "WARNING: Ignoring invalid %s value \"%s\".\n", TAG_APPEND_ENV, value);
+    return 0;
+}
+
+/**
+ * Appends an empty frame slot to the transaction.
+ *
+ * @param txn The transaction.
+ * @return A pointer to the new slot, or NULL on allocation failure.
+ */
+static TxnFrame *append_frame(TagTransaction *txn)
+{
+    if (txn->frame_count == txn->capacity)
+    {
+        int new_capacity = txn->capacity ? txn->capacity * 2 : 16;
+        TxnFrame *grown = (TxnFrame *)realloc(txn->frames, new_capacity * sizeof(TxnFrame));
+        if (!grown)
+        {
+            perror("ERROR: realloc failed for transaction frames");
+            return NULL;
+        }
+        txn->frames = grown;
+        txn->capacity = new_capacity;
+    }
+    TxnFrame *frame = &txn->frames[txn->frame_count++];
+    memset(frame, 0, sizeof(*frame));
+    frame->src_offset = -1;
+    frame->tail_fd = -1;
+    return frame;
+}
+
+/**
+ * Finds the first frame with the given ID in the transaction.
+ *
+ * @param txn The transaction.
+ * @param tag_name 4-byte tag identifier.
+ * @return The frame, or NULL if there is none.
+ */
+static TxnFrame *find_txn_frame(TagTransaction *txn, const char *tag_name)
+{
+    for (int i = 0; i < txn->frame_count; i++)
+    {
+        if (strncmp(txn->frames[i].id, tag_name, 4) == 0)
+            return &txn->frames[i];
+    }
+    return NULL;
+}
+
+/**
+ * Removes the first frame with the given ID from the transaction, if there is one.
+ *
+ * @param txn The transaction.
+ * @param tag_name 4-byte tag identifier.
+ */
+static void remove_txn_frame(TagTransaction *txn, const char *tag_name)
+{
+    TxnFrame *frame = find_txn_frame(txn, tag_name);
+    if (!frame)
+        return;
+    if (frame->owned)
+        free(frame->data);
+    if (frame->owns_tail)
+        close(frame->tail_fd);
+    long index = frame - txn->frames;
+    memmove(frame, frame + 1, (txn->frame_count - index - 1) * sizeof(TxnFrame));
+    txn->frame_count--;
+}
+
+/**
+ * Finds the first frame with the given ID in the transaction, appending an empty one if there is none.
+ *
+ * @param txn The transaction.
+ * @param tag_name 4-byte tag identifier.
+ * @return The frame to overwrite, or NULL on allocation failure.
+ */
+static TxnFrame *frame_for_update(TagTransaction *txn, const char *tag_name)
+{
+    TxnFrame *frame = find_txn_frame(txn, tag_name);
+    if (frame)
+        return frame;
+
+    frame = append_frame(txn);
+    if (frame)
+    {
+        memcpy(frame->id, tag_name, 4);
+        frame->id[4] = '\0';
+    }
+    return frame;
+}
+
+/**
+ * Gives a frame new data owned by the transaction.
+ *
+ * @param frame The frame to update.
+ * @param data The new data (ownership is taken).
+ * @param size The size of the new data.
+ */
+static void replace_frame_data(TxnFrame *frame, uint8_t *data, size_t size)
+{
+    if (frame->owned)
+        free(frame->data);
+    if (frame->owns_tail)
+        close(frame->tail_fd);
+    frame->tail_fd = -1;
+    frame->tail_offset = 0;
+    frame->tail_size = 0;
+    frame->owns_tail = 0;
+    frame->data = data;
+    frame->size = size;
+    frame->owned = 1;
+    frame->changed = 1;
+    frame->flags[0] = 0;
+    frame->flags[1] = 0;
+}
+
+/**
+ * Copies every indexed frame into the transaction, pointing at the index buffer.
+ *
+ * @param txn The transaction; its index must already be built.
+ * @return e_success, or e_failure on allocation failure.
+ *
+ * @logic
+ * 1. ID3v2.2 tags are refused: their 6-byte frame headers are not written back.
+ * 2. The part of each frame held by the index is referenced in place.
+ * 3. The rest of a large frame the index left in the file becomes the frame's tail,
+ *    copied from the source descriptor when the tag is written.
+ * 4. Frames read from a tag appended to the file are marked to stay in it.
+ * 5. Padding frames left by earlier in-place edits are dropped: their slots are free space.
+ */
+static Status load_frames(TagTransaction *txn)
+{
+    if (txn->index.version == 2)
+    {
+        fprintf(stderr, "ERROR: Editing ID3v2.2 tags is not supported.\n");
+        return e_failure;
+    }
+    for (int i = 0; i < txn->index.frame_count; i++)
+    {
+        const FrameEntry *entry = &txn->index.frames[i];
+        if (is_padding_frame(entry))
+            continue;
+        TxnFrame *frame = append_frame(txn);
+        if (!frame)
+            return e_failure;
+        memcpy(frame->id, entry->id, 5);
+        memcpy(frame->flags, entry->flags, 2);
+        frame->data = entry->data;
+        frame->size = entry->size;
+        frame->src_offset = entry->offset;
+        frame->appended = txn->index.appended_offset && entry->offset >= txn->index.appended_offset;
+        if (entry->available < entry->size)
+        {
+            frame->tail_fd = txn->index.fd;
+            frame->tail_offset = entry->offset + entry->header_len + entry->available;
+            frame->tail_size = entry->size - entry->available;
+        }
+    }
+    return e_success;
+}
+
+/**
+ * Starts an edit transaction on an MP3 file.
+ *
+ * @param txn The transaction to initialise; release it with free_transaction().
+ * @param mp3 Original MP3 file (read binary).
+ * @return e_success if the tag was indexed, e_failure on error.
+ *
+ * @logic
+ * 1. Build the tag index of the source file.
+ * 2. Copy every indexed frame into the transaction, pointing at the index buffer.
+ */
+Status begin_transaction(TagTransaction *txn, FILE *mp3)
+{
+    memset(txn, 0, sizeof(*txn));
+    if (build_tag_index(mp3, &txn->index) == e_failure)
+    {
+        fprintf(stderr, "ERROR: Failed to read the ID3v2 tag.\n");
+        return e_failure;
+    }
+    if (load_frames(txn) == e_failure)
+    {
+        free_transaction(txn);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/**
+ * Starts an edit transaction on MP3 data read from a stream.
+ *
+ * @param txn The transaction to initialise; release it with free_transaction().
+ * @param in_fd Descriptor the MP3 data is read from (e.g. a pipe on stdin).
+ * @return e_success if the tag was read, e_failure on error.
+ *
+ * @logic
+ * 1. Read only the tag from the stream with `stream_tag_index`; the audio is left unread.
+ *    A stream that ends inside the declared tag is rejected.
+ * 2. Copy every indexed frame into the transaction.
+ */
+Status begin_stream_transaction(TagTransaction *txn, int in_fd)
+{
+    memset(txn, 0, sizeof(*txn));
+    if (stream_tag_index(in_fd, &txn->index) == e_failure)
+    {
+        fprintf(stderr, "ERROR: Failed to read the ID3v2 tag.\n");
+        return e_failure;
+    }
+    if (txn->index.buffer_len < 10 + (long)txn->index.header_size)
+    {
+        fprintf(stderr, "ERROR: The input ended inside the ID3v2 tag.\n");
+        free_transaction(txn);
+        return e_failure;
+    }
+    if (load_frames(txn) == e_failure)
+    {
+        free_transaction(txn);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/**
+ * Sets the data of a text frame.
+ *
+ * @param txn The transaction.
+ * @param tag_name 4-byte tag identifier (e.g., "TIT2").
+ * @param data New tag data.
+ * @return e_success if the frame was updated, e_failure on error.
+ *
+ * @logic
+ * 1. Find the first frame with the ID, or append a new one.
+ * 2. Copy the data into memory owned by the transaction.
+ */
+Status set_text_frame(TagTransaction *txn, const char *tag_name, const char *data)
+{
+    size_t size = strlen(data);
+    uint8_t *copy = (uint8_t *)malloc(size ? size : 1);
+    if (!copy)
+    {
+        perror("ERROR: malloc failed for frame data");
+        return e_failure;
+    }
+    memcpy(copy, data, size);
+
+    TxnFrame *frame = frame_for_update(txn, tag_name);
+    if (!frame)
+    {
+        free(copy);
+        return e_failure;
+    }
+    replace_frame_data(frame, copy, size);
+    return e_success;
+}
+
+/**
+ * Sets the picture of the APIC frame.
+ *
+ * @param txn The transaction.
+ * @param img Image file to embed (read binary).
+ * @param MIME Image type extension (e.g., "jpg").
+ * @param image_name Name of the image, stored as the description.
+ * @return e_success if the frame was updated, e_failure on error.
+ *
+ * @logic
+ * 1. Find the APIC frame, or append a new one.
+ * 2. Keep the text encoding and picture type of an existing picture.
+ * 3. Build the start of the frame data: text encoding, 10-byte "image/<MIME>" type,
+ *    picture type and description.
+ * 4. The image itself is never read into memory: the frame keeps a duplicate of the
+ *    image descriptor and the bytes are copied from it when the tag is written.
+ */
+Status set_image_frame(TagTransaction *txn, FILE *img, const char *MIME, const char *image_name)
+{
+    uint8_t text_encoding = 0;
+    uint8_t picture_type = 0;
+    const TxnFrame *old_image = find_txn_frame(txn, "APIC");
+    size_t old_head = old_image ? old_image->size - old_image->tail_size : 0;
+    if (old_head > 0)
+    {
+        size_t pos = 1;
+        while (pos < old_head && old_image->data[pos] != '\0')
+            pos++;
+        text_encoding = old_image->data[0];
+        picture_type = pos + 1 < old_head ? old_image->data[pos + 1] : 0;
+    }
+
+    int image_size = size_of_the_file(img);
+    size_t name_len = strlen(image_name) + 1;
+    size_t head = 1 + 10 + 1 + name_len;
+    uint8_t *data = (uint8_t *)malloc(head);
+    if (!data)
+    {
+        perror("ERROR: malloc failed for image data");
+        return e_failure;
+    }
+    int image_fd = dup(fileno(img));
+    if (image_fd == -1)
+    {
+        perror("ERROR: dup failed for image file");
+        free(data);
+        return e_failure;
+    }
+
+    uint8_t *p = data;
+    *p++ = text_encoding;
+    char new_MIME_type[10] = "image/";
+    strncat(new_MIME_type, MIME, sizeof(new_MIME_type) - strlen(new_MIME_type) - 1);
+    memcpy(p, new_MIME_type, 10);
+    p += 10;
+    *p++ = picture_type;
+    memcpy(p, image_name, name_len);
+
+    TxnFrame *frame = frame_for_update(txn, "APIC");
+    if (!frame)
+    {
+        free(data);
+        close(image_fd);
+        return e_failure;
+    }
+    replace_frame_data(frame, data, head + image_size);
+    frame->tail_fd = image_fd;
+    frame->tail_offset = 0;
+    frame->tail_size = image_size;
+    frame->owns_tail = 1;
+    return e_success;
+}
+
+/**
+ * Encodes the 10-byte header of a frame.
+ *
+ * @param frame The frame.
+ * @param version ID3v2 major version of the tag: frame sizes are syncsafe in v2.4.
+ * @param out Destination for the ID, size and flags.
+ */
+static void encode_frame_header(const TxnFrame *frame, uint8_t version, uint8_t out[10])
+{
+    memcpy(out, frame->id, 4);
+    if (version == 4)
+        convert_header_size(frame->size, out + 4);
+    else
+        convert_size(frame->size, out + 4);
+    memcpy(out + 8, frame->flags, 2);
+}
+
+/**
+ * Encodes the 10-byte header of the rewritten tag.
+ *
+ * @param txn The transaction.
+ * @param tag_size Size of the frames and padding.
+ * @param out Destination for the header.
+ *
+ * @logic
+ * 1. Keep the identifier, version and flags of the source tag, but clear the
+ *    extended header and footer flags: neither is written, as an extended header's
+ *    CRC would no longer match and a footer excludes padding.
+ */
+static void encode_tag_header(const TagTransaction *txn, long tag_size, uint8_t out[10])
+{
+    memcpy(out, txn->index.buffer, 6);
+    out[5] &= ~(TAG_FLAG_EXTENDED | TAG_FLAG_FOOTER);
+    convert_header_size(tag_size, out + 6);
+}
+
+/**
+ * Writes a buffer to a descriptor, retrying short writes.
+ *
+ * @return e_success if every byte was written, e_failure otherwise.
+ */
+static Status write_all(int fd, const uint8_t *p, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return e_failure;
+        }
+        p += n;
+        len -= n;
+    }
+    return e_success;
+}
+
+/**
+ * Writes one frame at the current offset of a descriptor.
+ *
+ * @param frame The frame to write.
+ * @param version ID3v2 major version of the tag.
+ * @param out_fd Destination descriptor.
+ * @return e_success if the whole frame was written, e_failure on error.
+ *
+ * @logic
+ * 1. Write the frame header and the part of the data held in memory.
+ * 2. Copy the tail (a picture) from its descriptor with `copy_fd`, which moves it
+ *    in the kernel where it can, so no buffer the size of the picture is needed.
+ */
+static Status write_frame(const TxnFrame *frame, uint8_t version, int out_fd)
+{
+    uint8_t header[10];
+    encode_frame_header(frame, version, header);
+    if (write_all(out_fd, header, 10) == e_failure ||
+        write_all(out_fd, frame->data, frame->size - frame->tail_size) == e_failure)
+    {
+        perror("ERROR: write failed for frame");
+        return e_failure;
+    }
+    if (frame->tail_size == 0)
+        return e_success;
+
+    if (lseek(frame->tail_fd, frame->tail_offset, SEEK_SET) < 0)
+    {
+        perror("ERROR: lseek failed for frame data");
+        return e_failure;
+    }
+    CopyResult result;
+    if (copy_fd(frame->tail_fd, out_fd, frame->tail_size, &result) == e_failure ||
+        result.bytes != (long long)frame->tail_size)
+    {
+        fprintf(stderr, "ERROR: Failed to copy the data of the %s frame.\n", frame->id);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/**
+ * Writes zero bytes at the current offset of a descriptor.
+ *
+ * @return e_success if every byte was written, e_failure otherwise.
+ */
+static Status write_zeros(int fd, long count)
+{
+    static const uint8_t zeros[4096];
+    for (long left = count; left > 0; left -= sizeof(zeros))
+    {
+        size_t chunk = left < (long)sizeof(zeros) ? (size_t)left : sizeof(zeros);
+        if (write_all(fd, zeros, chunk) == e_failure)
+        {
+            perror("ERROR: write failed for padding");
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+typedef struct
+{
+    int fd;       // Destination, or -1 to only count the bytes that would be written.
+    int last_ff;  // The last byte passed through was 0xFF.
+    long count;   // Bytes produced so far.
+    uint8_t *out; // 2 * UNSYNC_CHUNK + 1 bytes of scratch space.
+} UnsyncWriter;
+
+/**
+ * Passes bytes through unsynchronisation to the writer's descriptor, or only counts them.
+ *
+ * @param w The writer.
+ * @param p The plain bytes.
+ * @param len Number of bytes.
+ * @return e_success, or e_failure if a write failed.
+ *
+ * @logic
+ * 1. Encode UNSYNC_CHUNK bytes at a time with the vectorised `unsync_encode`.
+ * 2. A 0xFF ending one chunk is stuffed when the first byte of the next one calls for it.
+ */
+static Status unsync_put(UnsyncWriter *w, const uint8_t *p, size_t len)
+{
+    while (len > 0)
+    {
+        size_t chunk = len < UNSYNC_CHUNK ? len : UNSYNC_CHUNK;
+        size_t n = 0;
+        if (w->last_ff && unsync_needs_stuffing(p[0]))
+            w->out[n++] = 0x00;
+        if (w->fd < 0)
+            n += unsync_encoded_size(p, chunk);
+        else
+            n += unsync_encode(p, chunk, w->out + n);
+        if (w->fd >= 0 && write_all(w->fd, w->out, n) == e_failure)
+        {
+            perror("ERROR: write failed for tag");
+            return e_failure;
+        }
+        w->count += n;
+        w->last_ff = p[chunk - 1] == 0xFF;
+        p += chunk;
+        len -= chunk;
+    }
+    return e_success;
+}
+
+/**
+ * Ends an unsynchronised region: a trailing 0xFF gets a 0x00 so it cannot join the next byte.
+ */
+static Status unsync_end(UnsyncWriter *w)
+{
+    static const uint8_t zero = 0x00;
+    if (w->last_ff)
+    {
+        if (w->fd >= 0 && write_all(w->fd, &zero, 1) == e_failure)
+        {
+            perror("ERROR: write failed for tag");
+            return e_failure;
+        }
+        w->count++;
+    }
+    w->last_ff = 0;
+    return e_success;
+}
+
+/**
+ * Passes the data of a frame, including a tail left in a file, through an UnsyncWriter.
+ */
+static Status unsync_frame_data(UnsyncWriter *w, const TxnFrame *frame)
+{
+    if (unsync_put(w, frame->data, frame->size - frame->tail_size) == e_failure)
+        return e_failure;
+    uint8_t *chunk = w->out + UNSYNC_CHUNK + 1;
+    for (size_t done = 0; done < frame->tail_size;)
+    {
+        size_t want = frame->tail_size - done < UNSYNC_CHUNK / 2 ? frame->tail_size - done : UNSYNC_CHUNK / 2;
+        ssize_t n = pread(frame->tail_fd, chunk, want, frame->tail_offset + done);
+        if (n <= 0)
+        {
+            fprintf(stderr, "ERROR: Failed to read the data of the %s frame.\n", frame->id);
+            return e_failure;
+        }
+        if (unsync_put(w, chunk, n) == e_failure)
+            return e_failure;
+        done += n;
+    }
+    return e_success;
+}
+
+/**
+ * Writes an unsynchronised tag: header, frames and padding.
+ *
+ * @param txn The transaction; the source tag had the unsynchronisation flag set.
+ * @param out_fd Destination descriptor.
+ * @param padding Bytes of padding after the frames.
+ * @param tag_len Receives the number of bytes written, header included.
+ * @return e_success if the tag was written, e_failure on error.
+ *
+ * @logic
+ * 1. Run every frame through a counting UnsyncWriter first, so the sizes are known
+ *    before anything is written, then again to write it.
+ * 2. v2.4 unsynchronises each frame's data separately, flags it and declares the
+ *    encoded size; v2.3 unsynchronises everything after the tag header.
+ * 3. The padding is zeros, which never need stuffing.
+ */
+static Status write_unsync_tag(const TagTransaction *txn, int out_fd, int padding, long *tag_len)
+{
+    uint8_t version = txn->index.version;
+    long *sizes = (long *)calloc(txn->frame_count + 1, sizeof(long));
+    uint8_t *scratch = (uint8_t *)malloc(UNSYNC_CHUNK + 1 + UNSYNC_CHUNK);
+    if (!sizes || !scratch)
+    {
+        perror("ERROR: malloc failed for unsynchronisation");
+        free(sizes);
+        free(scratch);
+        return e_failure;
+    }
+
+    Status status = e_success;
+    UnsyncWriter counter = {-1, 0, 0, scratch};
+    long frames_size = 0;
+    for (int i = 0; i < txn->frame_count && status == e_success; i++)
+    {
+        uint8_t header[10];
+        encode_frame_header(&txn->frames[i], version, header);
+        if (version == 4)
+            counter.count = 0;
+        else
+            status = unsync_put(&counter, header, 10);
+        if (status == e_success)
+            status = unsync_frame_data(&counter, &txn->frames[i]);
+        if (status == e_success && version == 4)
+        {
+            status = unsync_end(&counter);
+            sizes[i] = counter.count;
+            frames_size += 10 + sizes[i];
+        }
+    }
+    if (status == e_success && version != 4)
+    {
+        status = unsync_end(&counter);
+        frames_size = counter.count;
+    }
+
+    uint8_t header[10];
+    encode_tag_header(txn, frames_size + padding, header);
+    if (status == e_success && write_all(out_fd, header, 10) == e_failure)
+    {
+        perror("ERROR: write failed for tag");
+        status = e_failure;
+    }
+
+    UnsyncWriter writer = {out_fd, 0, 0, scratch};
+    for (int i = 0; i < txn->frame_count && status == e_success; i++)
+    {
+        TxnFrame frame = txn->frames[i];
+        uint8_t frame_header[10];
+        if (version == 4)
+        {
+            frame.size = sizes[i];
+            frame.flags[1] |= FRAME_FLAG_UNSYNC;
+            encode_frame_header(&frame, version, frame_header);
+            if (write_all(out_fd, frame_header, 10) == e_failure)
+            {
+                perror("ERROR: write failed for tag");
+                status = e_failure;
+                break;
+            }
+        }
+        else
+        {
+            encode_frame_header(&frame, version, frame_header);
+            status = unsync_put(&writer, frame_header, 10);
+        }
+        if (status == e_success)
+            status = unsync_frame_data(&writer, &txn->frames[i]);
+        if (status == e_success && version == 4)
+            status = unsync_end(&writer);
+    }
+    if (status == e_success)
+        status = unsync_end(&writer);
+    if (status == e_success)
+        status = write_zeros(out_fd, padding);
+
+    free(sizes);
+    free(scratch);
+    *tag_len = 10 + frames_size + padding;
+    return status;
+}
+
+/**
+ * Writes the tag: header, frames and padding.
+ *
+ * @param txn The transaction.
+ * @param out_fd Destination descriptor.
+ * @param padding Bytes of padding after the frames.
+ * @param tag_len Receives the number of bytes written, header included.
+ * @return e_success if the tag was written, e_failure on error.
+ *
+ * @logic
+ * 1. A tag whose source was unsynchronised is written unsynchronised again with `write_unsync_tag`.
+ * 2. Otherwise write the header, every frame with `write_frame` (copying a picture from
+ *    its file) and the padding.
+ */
+static Status write_tag(const TagTransaction *txn, int out_fd, int padding, long *tag_len)
+{
+    if (txn->index.buffer[5] & TAG_FLAG_UNSYNC)
+        return write_unsync_tag(txn, out_fd, padding, tag_len);
+
+    long frames_size = 0;
+    for (int i = 0; i < txn->frame_count; i++)
+        frames_size += 10 + txn->frames[i].size;
+    *tag_len = 10 + frames_size + padding;
+
+    uint8_t header[10];
+    encode_tag_header(txn, frames_size + padding, header);
+    if (write_all(out_fd, header, 10) == e_failure)
+    {
+        perror("ERROR: write failed for tag");
+        return e_failure;
+    }
+    for (int i = 0; i < txn->frame_count; i++)
+    {
+        if (write_frame(&txn->frames[i], txn->index.version, out_fd) == e_failure)
+            return e_failure;
+    }
+    return write_zeros(out_fd, padding);
+}
+
+typedef struct
+{
+    long start; // First free byte.
+    long end;   // Offset just past the free bytes.
+} FreeSpan;
+
+static int by_span_start(const void *a, const void *b)
+{
+    const FreeSpan *x = (const FreeSpan *)a, *y = (const FreeSpan *)b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/**
+ * Places a frame at the start of a free span if what it leaves can still be filled.
+ *
+ * @return 1 if the frame was placed, 0 otherwise.
+ */
+static int place_frame(TxnFrame *frame, FreeSpan *span, long limit)
+{
+    long rest = span->end - span->start - (10 + (long)frame->size);
+    if (rest < 0 || (rest > 0 && rest < PADDING_FRAME_MIN && span->end != limit))
+        return 0;
+    frame->dst_offset = span->start;
+    span->start += 10 + frame->size;
+    return 1;
+}
+
+/**
+ * Tries one layout of the prepended tag that keeps the unchanged frames in place.
+ *
+ * @param txn The transaction; frames marked `appended` are left out. Sets dst_offset.
+ * @param moved Per frame, non-zero to move an unchanged frame as if it had changed.
+ * @param spans Scratch space for frame_count + 1 spans.
+ * @param moving Scratch space for frame_count frames.
+ * @param short_span Receives a span left with too few bytes for a padding frame, if that
+ *        is why the layout failed; its start is -1 otherwise.
+ * @return 1 if every frame was placed, 0 otherwise.
+ */
+static int try_layout(TagTransaction *txn, const char *moved, FreeSpan *spans, TxnFrame **moving, FreeSpan *short_span)
+{
+    long limit = txn->index.audio_offset;
+    int span_count = 0, moving_count = 0;
+    short_span->start = -1;
+    for (int i = 0; i < txn->frame_count; i++)
+    {
+        TxnFrame *frame = &txn->frames[i];
+        if (frame->appended)
+            continue;
+        if (frame->changed || frame->src_offset < 0 || moved[i])
+        {
+            moving[moving_count++] = frame;
+            continue;
+        }
+        frame->dst_offset = frame->src_offset;
+        spans[span_count].start = frame->src_offset;
+        spans[span_count++].end = frame->src_offset + 10 + frame->size;
+    }
+
+    // Turn the occupied slots, in file order, into the free spans between them.
+    qsort(spans, span_count, sizeof(*spans), by_span_start);
+    long cursor = 10;
+    int free_count = 0;
+    for (int i = 0; i < span_count; i++)
+    {
+        FreeSpan used = spans[i];
+        if (used.start > cursor)
+        {
+            spans[free_count].start = cursor;
+            spans[free_count++].end = used.start;
+        }
+        cursor = used.end;
+    }
+    if (cursor > limit)
+        return 0;
+    spans[free_count].start = cursor;
+    spans[free_count++].end = limit;
+
+    for (int i = 0; i < moving_count; i++)
+    {
+        TxnFrame *frame = moving[i];
+        frame->dst_offset = -1;
+        for (int j = 0; frame->src_offset >= 0 && j < free_count; j++)
+        {
+            if (spans[j].start <= frame->src_offset && frame->src_offset < spans[j].end)
+            {
+                place_frame(frame, &spans[j], limit);
+                break;
+            }
+        }
+    }
+    for (;;)
+    {
+        TxnFrame *largest = NULL;
+        for (int i = 0; i < moving_count; i++)
+        {
+            if (moving[i]->dst_offset < 0 && (!largest || moving[i]->size > largest->size))
+                largest = moving[i];
+        }
+        if (!largest)
+            break;
+        int fitted = 0;
+        for (int j = 0; !fitted && j < free_count; j++)
+            fitted = place_frame(largest, &spans[j], limit);
+        if (!fitted)
+            return 0;
+    }
+
+    // Report a span left too short, so a frame next to it can be moved out of the way.
+    for (int j = 0; j < free_count; j++)
+    {
+        long rest = spans[j].end - spans[j].start;
+        if (rest > 0 && rest < PADDING_FRAME_MIN && spans[j].end != limit)
+        {
+            *short_span = spans[j];
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Lays out the frames of the prepended tag for an in-place update.
+ *
+ * @param txn The transaction; frames marked `appended` are left out. Sets dst_offset.
+ * @return e_success if the frames fit before the audio, e_failure if they do not.
+ *
+ * @logic
+ * 1. Frames that did not change keep their offsets, so a large picture is never
+ *    rewritten because a title before it grew. The slots of the others, and the
+ *    padding, are free spans.
+ * 2. A changed or new frame goes back into its own slot if it fits there, otherwise
+ *    into the first span that holds it, largest frames first. The last span runs
+ *    into the padding.
+ * 3. Bytes a span has left over before the next frame become a padding frame, so
+ *    they must hold at least PADDING_FRAME_MIN bytes. When they do not, move the
+ *    smaller unchanged frame next to them as well, which merges their slots, and
+ *    lay the frames out again. Frames whose tail is in the source file never move.
+ * 4. As a last resort, lay the frames out end to end from offset 10, as long as
+ *    no frame whose tail is in the source file has to move.
+ */
+static Status plan_in_place(TagTransaction *txn)
+{
+    int count = txn->frame_count ? txn->frame_count : 1;
+    FreeSpan *spans = (FreeSpan *)malloc((count + 1) * sizeof(FreeSpan));
+    TxnFrame **moving = (TxnFrame **)malloc(count * sizeof(TxnFrame *));
+    char *moved = (char *)calloc(count, 1);
+    if (!spans || !moving || !moved)
+    {
+        perror("ERROR: malloc failed for the tag layout");
+        free(spans);
+        free(moving);
+        free(moved);
+        return e_failure;
+    }
+
+    FreeSpan short_span;
+    int placed;
+    while (!(placed = try_layout(txn, moved, spans, moving, &short_span)) && short_span.start >= 0)
+    {
+        int neighbour = -1;
+        for (int i = 0; i < txn->frame_count; i++)
+        {
+            const TxnFrame *frame = &txn->frames[i];
+            if (frame->appended || frame->changed || frame->src_offset < 0 || moved[i] ||
+                (frame->tail_size > 0 && !frame->owns_tail))
+                continue;
+            long end = frame->src_offset + 10 + (long)frame->size;
+            if ((frame->src_offset == short_span.end || end == short_span.start) &&
+                (neighbour < 0 || frame->size < txn->frames[neighbour].size))
+                neighbour = i;
+        }
+        if (neighbour < 0)
+            break;
+        moved[neighbour] = 1;
+    }
+    free(spans);
+    free(moving);
+    free(moved);
+    if (placed)
+        return e_success;
+
+    long pos = 10;
+    for (int i = 0; i < txn->frame_count; i++)
+    {
+        TxnFrame *frame = &txn->frames[i];
+        if (frame->appended)
+            continue;
+        if (frame->tail_size > 0 && !frame->owns_tail && frame->src_offset != pos)
+            return e_failure;
+        frame->dst_offset = pos;
+        pos += 10 + frame->size;
+    }
+    return pos <= txn->index.audio_offset ? e_success : e_failure;
+}
+
+/**
+ * Tells whether a span of the source tag is exactly one padding frame already.
+ */
+static int source_is_padding(const TagIndex *index, long start, long end)
+{
+    for (int i = 0; i < index->frame_count; i++)
+    {
+        const FrameEntry *entry = &index->frames[i];
+        if (entry->offset == start)
+            return is_padding_frame(entry) && start + entry->header_len + (long)entry->size == end;
+    }
+    return 0;
+}
+
+static int by_destination(const void *a, const void *b)
+{
+    const TxnFrame *x = *(const TxnFrame *const *)a, *y = *(const TxnFrame *const *)b;
+    return x->dst_offset < y->dst_offset ? -1 : x->dst_offset > y->dst_offset;
+}
+
+/**
+ * Writes a padding frame over a slot left free inside the tag.
+ *
+ * @return e_success if the whole slot was written, e_failure otherwise.
+ *
+ * @logic
+ * 1. Write the frame header and owner, then zero the rest of the slot, so the bytes of
+ *    the frame that lived there (an edited-away comment, say) do not stay in the file.
+ */
+static Status write_padding_frame(int fd, uint8_t version, long offset, long length)
+{
+    TxnFrame padding;
+    memset(&padding, 0, sizeof(padding));
+    memcpy(padding.id, "PRIV", 5);
+    padding.size = length - 10;
+
+    uint8_t bytes[PADDING_FRAME_MIN];
+    encode_frame_header(&padding, version, bytes);
+    memcpy(bytes + 10, PADDING_FRAME_OWNER, sizeof(PADDING_FRAME_OWNER));
+    if (pwrite(fd, bytes, sizeof(bytes), offset) != (ssize_t)sizeof(bytes))
+    {
+        perror("ERROR: pwrite failed for padding frame");
+        return e_failure;
+    }
+    if (lseek(fd, offset + PADDING_FRAME_MIN, SEEK_SET) < 0)
+    {
+        perror("lseek failed");
+        return e_failure;
+    }
+    return write_zeros(fd, length - PADDING_FRAME_MIN);
+}
+
+/**
+ * Writes the frames of the prepended tag that changed or moved, each at the offset
+ * chosen by `plan_in_place`.
+ *
+ * @param txn The transaction, laid out by `plan_in_place`; frames marked `appended` are left out.
+ * @param fd The MP3 file, opened for writing.
+ * @param written Incremented by the number of bytes written.
+ * @return e_success if the tag was patched, e_failure on error.
+ *
+ * @logic
+ * 1. Write only the frames that changed or moved.
+ * 2. Walk the frames in file order and fill each gap between two of them with a
+ *    zeroed padding frame, unless the gap was already one.
+ * 3. Zero-fill from the last frame up to the old end of the frames, so it becomes padding.
+ * 4. Rewrite the header size only if the declared size does not already cover the padding.
+ */
+static Status write_in_place(const TagTransaction *txn, int fd, long *written)
+{
+    const TagIndex *index = &txn->index;
+    const TxnFrame **order = (const TxnFrame **)malloc((txn->frame_count ? txn->frame_count : 1) * sizeof(TxnFrame *));
+    if (!order)
+    {
+        perror("ERROR: malloc failed for the tag layout");
+        return e_failure;
+    }
+    int count = 0;
+    Status status = e_success;
+    for (int i = 0; status == e_success && i < txn->frame_count; i++)
+    {
+        const TxnFrame *frame = &txn->frames[i];
+        if (frame->appended)
+            continue;
+        order[count++] = frame;
+        if (frame->changed || frame->src_offset != frame->dst_offset)
+        {
+            if (lseek(fd, frame->dst_offset, SEEK_SET) < 0)
+            {
+                perror("lseek failed");
+                status = e_failure;
+                break;
+            }
+            status = write_frame(frame, index->version, fd);
+            *written += 10 + frame->size;
+        }
+    }
+    qsort(order, count, sizeof(*order), by_destination);
+
+    long pos = 10;
+    for (int i = 0; status == e_success && i < count; i++)
+    {
+        if (order[i]->dst_offset > pos && !source_is_padding(index, pos, order[i]->dst_offset))
+        {
+            status = write_padding_frame(fd, index->version, pos, order[i]->dst_offset - pos);
+            *written += order[i]->dst_offset - pos;
+        }
+        pos = order[i]->dst_offset + 10 + order[i]->size;
+    }
+    free(order);
+    if (status == e_success && pos < index->frames_end)
+    {
+        if (lseek(fd, pos, SEEK_SET) < 0)
+        {
+            perror("lseek failed");
+            return e_failure;
+        }
+        if (write_zeros(fd, index->frames_end - pos) == e_failure)
+            return e_failure;
+        *written += index->frames_end - pos;
+    }
+    if (status == e_failure)
+        return e_failure;
+
+    if (index->audio_offset != 10 + (long)index->header_size)
+    {
+        uint8_t encoded_header[4];
+        convert_header_size(index->audio_offset - 10, encoded_header);
+        if (pwrite(fd, encoded_header, 4, 6) != 4)
+        {
+            perror("pwrite failed");
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+/**
+ * Writes the changed part of the tag into the existing tag region.
+ *
+ * @param txn The transaction, laid out by `plan_in_place`.
+ * @param file_name Original MP3 filename.
+ * @return e_success if the tag was patched, e_failure on error.
+ *
+ * @logic
+ * 1. Return early if no frame changed or moved.
+ * 2. Otherwise patch the tag with `write_in_place`.
+ */
+static Status commit_in_place(const TagTransaction *txn, const char *file_name)
+{
+    int dirty = 0;
+    for (int i = 0; i < txn->frame_count; i++)
+    {
+        const TxnFrame *frame = &txn->frames[i];
+        dirty |= frame->changed || frame->src_offset != frame->dst_offset;
+    }
+    if (!dirty)
+    {
+        fprintf(stdout, "LOG: The tag is unchanged.\n");
+        return e_success;
+    }
+
+    char mp3__file[MAX_PATH_LENGTH];
+    strcpy(mp3__file, MP3_FILES_PATH);
+    strcat(mp3__file, file_name);
+
+    int fd = open(mp3__file, O_WRONLY);
+    if (fd == -1)
+    {
+        perror("open failed");
+        return e_failure;
+    }
+
+    long written = 0;
+    Status status = write_in_place(txn, fd, &written);
+    if (close(fd) != 0)
+    {
+        perror("close failed");
+        status = e_failure;
+    }
+    if (status == e_success)
+        fprintf(stdout, "LOG: Updated the tag in place, wrote %ld bytes.\n", written);
+    return status;
+}
+
+/**
+ * Returns the size a frame had in the source tag, or 0 for a new frame.
+ */
+static size_t source_size(const TagTransaction *txn, const TxnFrame *frame)
+{
+    for (int i = 0; i < txn->index.frame_count; i++)
+    {
+        if (txn->index.frames[i].offset == frame->src_offset)
+            return txn->index.frames[i].size;
+    }
+    return 0;
+}
+
+/**
+ * Points the SEEK frame of the prepended tag at the appended tag, adding the frame if needed.
+ * The distance is counted from the declared end of the prepended tag, which is plain and
+ * which `write_in_place` declares up to the start of the audio.
+ *
+ * @param txn The transaction.
+ * @param start File offset of the appended tag.
+ * @return e_success, or e_failure on allocation failure.
+ */
+static Status set_seek_frame(TagTransaction *txn, long start)
+{
+    uint8_t *data = (uint8_t *)malloc(SEEK_FRAME_SIZE);
+    if (!data)
+    {
+        perror("ERROR: malloc failed for frame data");
+        return e_failure;
+    }
+    long declared_end = txn->index.audio_offset;
+    convert_size(start - declared_end, data);
+
+    TxnFrame *frame = frame_for_update(txn, "SEEK");
+    if (!frame)
+    {
+        free(data);
+        return e_failure;
+    }
+    frame->appended = 0;
+    if (frame->size == SEEK_FRAME_SIZE && frame->tail_size == 0 && memcmp(frame->data, data, SEEK_FRAME_SIZE) == 0)
+    {
+        free(data);
+        return e_success;
+    }
+    replace_frame_data(frame, data, SEEK_FRAME_SIZE);
+    return e_success;
+}
+
+/**
+ * Decides which frames go to the tag appended to the file, so the rest fits in place.
+ *
+ * @param txn The transaction, with its SEEK frame already set.
+ * @return e_success if the prepended frames fit before the audio, e_failure if the
+ *         file has to be rewritten.
+ *
+ * @logic
+ * 1. Frames read from an appended tag stay there; new frames and frames that grew join them.
+ *    The SEEK frame always stays in the prepended tag.
+ * 2. Lay the prepended frames out with `plan_in_place`.
+ * 3. While they do not fit before the audio, move the largest one and lay them out again.
+ */
+static Status plan_append(TagTransaction *txn)
+{
+    for (int i = 0; i < txn->frame_count; i++)
+    {
+        TxnFrame *frame = &txn->frames[i];
+        if (strcmp(frame->id, "SEEK") == 0)
+            frame->appended = 0;
+        else if (frame->changed && frame->size > source_size(txn, frame))
+            frame->appended = 1;
+    }
+
+    for (;;)
+    {
+        if (plan_in_place(txn) == e_success)
+            return e_success;
+
+        TxnFrame *largest = NULL;
+        for (int i = 0; i < txn->frame_count; i++)
+        {
+            TxnFrame *frame = &txn->frames[i];
+            if (!frame->appended && strcmp(frame->id, "SEEK") != 0 && (!largest || frame->size > largest->size))
+                largest = frame;
+        }
+        if (!largest)
+            return e_failure;
+        largest->appended = 1;
+    }
+}
+
+static int by_source_offset(const void *a, const void *b)
+{
+    const TxnFrame *x = *(const TxnFrame *const *)a, *y = *(const TxnFrame *const *)b;
+    return x->src_offset < y->src_offset ? -1 : x->src_offset > y->src_offset;
+}
+
+/**
+ * Writes the frames marked `appended` to a v2.4 tag at the end of the file and the others in place.
+ *
+ * @param txn The transaction, planned with `plan_append`.
+ * @param start Offset of the appended tag: where the old one starts, or where the audio ends.
+ * @param trailer_from Offset of what follows the tag (an ID3v1 tag) and is kept after it.
+ * @param file_name Original MP3 filename.
+ * @return e_success if the file was updated, e_failure on error.
+ *
+ * @logic
+ * 1. Read the trailer first, as the new tag may overwrite it.
+ * 2. Frames left unchanged in the old appended tag go first, in their old order: each
+ *    stays where it is, and is not rewritten, or moves towards the start of the file, so
+ *    copying it never overwrites bytes still to be read.
+ * 3. The other frames follow. The header and "3DI" footer frame the tag (a footer rules
+ *    out padding), the trailer goes after it and the file is cut there.
+ * 4. Finally patch the prepended tag, SEEK frame included, with `write_in_place`:
+ *    the audio is never moved.
+ */
+static Status commit_append(const TagTransaction *txn, long start, long trailer_from, const char *file_name)
+{
+    char mp3__file[MAX_PATH_LENGTH];
+    strcpy(mp3__file, MP3_FILES_PATH);
+    strcat(mp3__file, file_name);
+
+    int fd = open(mp3__file, O_RDWR);
+    if (fd == -1)
+    {
+        perror("open failed");
+        return e_failure;
+    }
+
+    Status status = e_failure;
+    long trailer_len = 0, written = 0;
+    uint8_t *trailer = NULL;
+    const TxnFrame **order = (const TxnFrame **)malloc((txn->frame_count ? txn->frame_count : 1) * sizeof(TxnFrame *));
+    struct stat st;
+    if (!order)
+        perror("ERROR: malloc failed for appended frames");
+    else if (fstat(fd, &st) != 0)
+        perror("fstat failed");
+    else if ((trailer_len = st.st_size - trailer_from) > 0 &&
+             ((trailer = (uint8_t *)malloc(trailer_len)) == NULL || pread(fd, trailer, trailer_len, trailer_from) != trailer_len))
+        perror("ERROR: Failed to read the end of the file");
+    else
+        status = e_success;
+
+    int kept = 0, count = 0;
+    for (int i = 0; status == e_success && i < txn->frame_count; i++)
+    {
+        const TxnFrame *frame = &txn->frames[i];
+        if (frame->appended && !frame->changed && frame->src_offset >= start)
+            order[kept++] = frame;
+    }
+    if (status == e_success)
+        qsort(order, kept, sizeof(*order), by_source_offset);
+    count = kept;
+    for (int i = 0; status == e_success && i < txn->frame_count; i++)
+    {
+        const TxnFrame *frame = &txn->frames[i];
+        if (frame->appended && (frame->changed || frame->src_offset < start))
+            order[count++] = frame;
+    }
+
+    long pos = start + 10;
+    for (int i = 0; status == e_success && i < count; i++)
+    {
+        if (i >= kept || order[i]->src_offset != pos)
+        {
+            if (lseek(fd, pos, SEEK_SET) < 0)
+            {
+                perror("lseek failed");
+                status = e_failure;
+                break;
+            }
+            status = write_frame(order[i], txn->index.version, fd);
+            written += 10 + order[i]->size;
+        }
+        pos += 10 + order[i]->size;
+    }
+
+    if (status == e_success)
+    {
+        uint8_t header[10] = {'I', 'D', '3', txn->index.version, 0, TAG_FLAG_FOOTER};
+        convert_header_size(pos - start - 10, header + 6);
+        uint8_t footer[10];
+        memcpy(footer, header, 10);
+        memcpy(footer, "3DI", 3);
+        if (pwrite(fd, header, 10, start) != 10 || pwrite(fd, footer, 10, pos) != 10 ||
+            (trailer_len > 0 && pwrite(fd, trailer, trailer_len, pos + 10) != trailer_len) ||
+            ftruncate(fd, pos + 10 + trailer_len) != 0)
+        {
+            perror("ERROR: write failed for appended tag");
+            status = e_failure;
+        }
+        written += 20;
+    }
+    if (status == e_success)
+        status = write_in_place(txn, fd, &written);
+
+    if (close(fd) != 0)
+    {
+        perror("close failed");
+        status = e_failure;
+    }
+    if (status == e_success)
+        fprintf(stdout, "LOG: Wrote %d frames to a %ld byte tag appended at offset %ld, wrote %ld bytes.\n", count, pos + 10 - start, start, written);
+    free(trailer);
+    free(order);
+    return status;
+}
+
+/**
+ * Resizes the tag by inserting or removing whole filesystem blocks at the start of the
+ * file, then writes the whole tag over the old one.
+ *
+ * @param txn The transaction; the offsets of frame tails left in the source file are
+ *            moved along with the data.
+ * @param file_name Original MP3 filename.
+ * @param status Receives the result if the file was changed.
+ * @return Non-zero if the file was changed (resized, or left changed by an error), 0 if it
+ *         was not touched and must be rewritten.
+ *
+ * @logic
+ * 1. Round the change in tag size to whole blocks of the filesystem (`fstatfs`, since
+ *    `st_blksize` is only the preferred I/O size): a tag that grows
+ *    gets at least `tag_padding_size` bytes of padding, a tag that shrinks gives back
+ *    only whole blocks, and one that changes by less than a block keeps its size.
+ * 2. Frames are written from the start of the file while their tails are copied from
+ *    further on, so give up if a tail would be overwritten before it is read.
+ * 3. Insert or collapse the blocks at offset 0 with fallocate, which moves the extents of
+ *    the file instead of the audio (ext4, XFS). Give up if the filesystem refuses.
+ * 4. Write the header, frames and padding with `write_tag`, ending where the audio now starts.
+ * 5. If the write fails, undo the resize with the opposite fallocate so the audio is back
+ *    where the old header says it is. Bytes already written stay changed, and a crash
+ *    between steps 3 and 4 leaves a tag whose header does not match its size, a window
+ *    the rewrite through a temporary file does not have.
+ */
+static int resize_in_place(TagTransaction *txn, const char *file_name, Status *status)
+{
+#if defined(FALLOC_FL_INSERT_RANGE) && defined(FALLOC_FL_COLLAPSE_RANGE)
+    if (txn->index.appended_offset || (txn->index.buffer[5] & TAG_FLAG_UNSYNC))
+        return 0;
+
+    char mp3__file[MAX_PATH_LENGTH];
+    strcpy(mp3__file, MP3_FILES_PATH);
+    strcat(mp3__file, file_name);
+
+    int fd = open(mp3__file, O_RDWR);
+    struct statfs fs;
+    if (fd == -1 || fstatfs(fd, &fs) != 0 || fs.f_bsize <= 0)
+    {
+        if (fd != -1)
+            close(fd);
+        return 0;
+    }
+
+    long block = fs.f_bsize;
+    long frames_size = 0;
+    for (int i = 0; i < txn->frame_count; i++)
+        frames_size += 10 + txn->frames[i].size;
+    long old_end = txn->index.audio_offset;
+    long needed = 10 + frames_size + tag_padding_size();
+    long delta = needed > old_end ? (needed - old_end + block - 1) / block * block
+                                  : -((old_end - needed) / block * block);
+
+    long pos = 10;
+    for (int i = 0; i < txn->frame_count; i++)
+    {
+        const TxnFrame *frame = &txn->frames[i];
+        pos += 10 + frame->size;
+        if (frame->tail_size > 0 && !frame->owns_tail && pos - (long)frame->tail_size > (long)frame->tail_offset + delta)
+        {
+            close(fd);
+            return 0;
+        }
+    }
+
+    if (delta != 0 && fallocate(fd, delta > 0 ? FALLOC_FL_INSERT_RANGE : FALLOC_FL_COLLAPSE_RANGE, 0, labs(delta)) != 0)
+    {
+        fprintf(stdout, "LOG: Cannot resize the tag with fallocate (%s), rewriting the file.\n", strerror(errno));
+        close(fd);
+        return 0;
+    }
+    for (int i = 0; i < txn->frame_count; i++)
+    {
+        TxnFrame *frame = &txn->frames[i];
+        if (frame->tail_size > 0 && !frame->owns_tail)
+            frame->tail_offset += delta;
+    }
+
+    long tag_len = 0;
+    *status = e_success;
+    if (lseek(fd, 0, SEEK_SET) < 0)
+    {
+        perror("lseek failed");
+        *status = e_failure;
+    }
+    else
+    {
+        *status = write_tag(txn, fd, old_end + delta - 10 - frames_size, &tag_len);
+    }
+    if (*status == e_failure && delta != 0)
+    {
+        if (fallocate(fd, delta > 0 ? FALLOC_FL_COLLAPSE_RANGE : FALLOC_FL_INSERT_RANGE, 0, labs(delta)) != 0)
+            fprintf(stderr, "ERROR: Cannot undo the resize of %s (%s), the tag is damaged.\n", file_name, strerror(errno));
+        for (int i = 0; i < txn->frame_count; i++)
+        {
+            TxnFrame *frame = &txn->frames[i];
+            if (frame->tail_size > 0 && !frame->owns_tail)
+                frame->tail_offset -= delta;
+        }
+    }
+    if (close(fd) != 0)
+    {
+        perror("close failed");
+        *status = e_failure;
+    }
+    if (*status == e_success)
+        fprintf(stdout, "LOG: Resized the tag by %ld bytes in place, wrote %ld bytes.\n", delta, tag_len);
+    return 1;
+#else
+    (void)txn;
+    (void)file_name;
+    (void)status;
+    return 0;
+#endif
+}
+
+/**
+ * Writes the new tag and the audio data to the output file in a single pass.
+ *
+ * @param txn The transaction.
+ * @param mp3 Original MP3 file (read binary).
+ * @param new_mp3 Output file (write binary).
+ * @return e_success if the output was written, e_failure on error.
+ *
+ * @logic
+ * 1. Write the tag with `write_tag` straight to the output descriptor.
+ * 2. Copy the audio data from the source audio offset. The frames of an appended tag
+ *    are part of the new tag, so copy the audio before it and what follows it apart.
+ */
+static Status commit_rewrite(const TagTransaction *txn, FILE *mp3, FILE *new_mp3)
+{
+    int padding = tag_padding_size();
+    int out_fd = fileno(new_mp3);
+    if (fflush(new_mp3) != 0)
+    {
+        perror("fflush failed");
+        return e_failure;
+    }
+
+    long tag_len;
+    if (write_tag(txn, out_fd, padding, &tag_len) == e_failure)
+        return e_failure;
+
+    long out_pos = tag_len;
+    long audio_from = txn->index.audio_offset;
+    if (txn->index.appended_offset)
+    {
+        long length = txn->index.appended_offset - audio_from;
+        CopyResult result;
+        if (lseek(fileno(mp3), audio_from, SEEK_SET) < 0 || lseek(out_fd, out_pos, SEEK_SET) < 0)
+        {
+            perror("lseek failed");
+            return e_failure;
+        }
+        if (copy_fd(fileno(mp3), out_fd, length, &result) == e_failure || result.bytes != length)
+        {
+            fprintf(stderr, "ERROR: Failed to copy the audio data.\n");
+            return e_failure;
+        }
+        out_pos += length;
+        audio_from = txn->index.appended_end;
+    }
+
+    if (fseek(new_mp3, out_pos, SEEK_SET) != 0 ||
+        fseek(mp3, audio_from, SEEK_SET) != 0)
+    {
+        perror("fseek failed");
+        return e_failure;
+    }
+    if (copy_remaining_bits(mp3, new_mp3) == e_failure)
+    {
+        return e_failure;
+    }
+
+    fprintf(stdout, "LOG: Wrote a %ld byte tag with %d bytes of padding.\n", tag_len, padding);
+    return e_success;
+}
+
+/**
+ * Commits an edit transaction.
+ *
+ * @param txn The transaction.
+ * @param mp3 Original MP3 file (read binary); closed by this function.
+ * @param new_mp3 Temporary "new.mp3" file (write binary); closed by this function.
+ * @param file_name Original MP3 filename.
+ * @return e_success if the edit was written, e_failure on error.
+ *
+ * @logic
+ * 1. If the tag has no extended header or footer, was not unsynchronised and
+ *    `plan_in_place` fits the frames before the audio data, patch the tag in place
+ *    and discard "new.mp3".
+ * 2. Otherwise, for such a v2.4 tag with an appended tag, or with appending enabled by
+ *    TAG_APPEND, point the SEEK frame at the appended tag and, if `plan_append` fits the
+ *    rest in place, write the frames that do not fit there with `commit_append`.
+ * 3. Otherwise drop the SEEK frame of any appended tag. Without one, try to make room
+ *    for the whole tag with `resize_in_place`.
+ * 4. Otherwise write the header, frames, padding and audio to "new.mp3" in one pass
+ *    and rename it over the original file, merging any appended tag.
+ */
+Status commit_transaction(TagTransaction *txn, FILE *mp3, FILE *new_mp3, const char *file_name)
+{
+    char temp__mp3__file[MAX_PATH_LENGTH];
+    strcpy(temp__mp3__file, MP3_FILES_PATH);
+    strcat(temp__mp3__file, "new.mp3");
+
+    int plain = !(txn->index.buffer[5] & (TAG_FLAG_EXTENDED | TAG_FLAG_FOOTER)) && !txn->index.decoded;
+    if (plain && !txn->index.appended_offset && plan_in_place(txn) == e_success)
+    {
+        fclose(mp3);
+        fclose(new_mp3);
+        remove(temp__mp3__file);
+
+        return commit_in_place(txn, file_name);
+    }
+
+    int appendable = plain && txn->index.version == 4 && (txn->index.appended_offset || tag_append_enabled());
+    if (appendable)
+    {
+        long start = txn->index.appended_offset, trailer_from = txn->index.appended_end;
+        if (!start)
+        {
+            struct stat st;
+            if (fstat(fileno(mp3), &st) != 0)
+            {
+                perror("fstat failed");
+                fclose(mp3);
+                fclose(new_mp3);
+                return e_failure;
+            }
+            start = trailer_from = id3v1_offset(fileno(mp3), txn->index.audio_offset, st.st_size);
+        }
+        if (set_seek_frame(txn, start) == e_failure)
+        {
+            fclose(mp3);
+            fclose(new_mp3);
+            return e_failure;
+        }
+        if (plan_append(txn) == e_success)
+        {
+            fclose(new_mp3);
+            remove(temp__mp3__file);
+            // The source stays open until the end: frame tails are copied from it.
+            Status status = commit_append(txn, start, trailer_from, file_name);
+            fclose(mp3);
+            return status;
+        }
+    }
+    if (txn->index.appended_offset || appendable)
+        remove_txn_frame(txn, "SEEK");
+
+    Status status;
+    if (resize_in_place(txn, file_name, &status))
+    {
+        fclose(mp3);
+        fclose(new_mp3);
+        remove(temp__mp3__file);
+        return status;
+    }
+
+    status = commit_rewrite(txn, mp3, new_mp3);
+    fclose(mp3);
+    if (fclose(new_mp3) != 0)
+    {
+        perror("fclose failed");
+        status = e_failure;
+    }
+    if (status == e_failure)
+        return e_failure;
+
+    return replace_file(file_name);
+}
+
+/**
+ * Commits a stream transaction by writing the edited MP3 data to another stream.
+ *
+ * @param txn The transaction started with begin_stream_transaction().
+ * @param in_fd Descriptor the source was read from, positioned after the tag.
+ * @param out_fd Descriptor the edited MP3 data is written to (e.g. a pipe on stdout).
+ * @return e_success if the whole stream was written, e_failure on error.
+ *
+ * @logic
+ * 1. Write the tag with `write_tag`.
+ * 2. Write the bytes already read past the old frames that are not padding, and drop
+ *    the footer of a v2.4 tag.
+ * 3. Pass the rest of the input through with `copy_fd` (splice between pipes),
+ *    so memory use does not depend on the length of the audio.
+ */
+Status commit_stream(TagTransaction *txn, int in_fd, int out_fd)
+{
+    long tag_len;
+    if (write_tag(txn, out_fd, tag_padding_size(), &tag_len) == e_failure)
+        return e_failure;
+
+    const TagIndex *index = &txn->index;
+    if (!index->decoded && index->buffer_len > index->audio_offset &&
+        write_all(out_fd, index->buffer + index->audio_offset, index->buffer_len - index->audio_offset) == e_failure)
+    {
+        perror("ERROR: write failed for output stream");
+        return e_failure;
+    }
+    // A v2.4 footer is still unread; it is dropped along with the old tag.
+    uint8_t footer[10];
+    long consumed = 10 + (long)index->header_size;
+    if (index->audio_offset > consumed && index->audio_offset - consumed <= (long)sizeof(footer))
+    {
+        size_t skip = index->audio_offset - consumed, got = 0;
+        while (got < skip)
+        {
+            ssize_t n = read(in_fd, footer + got, skip - got);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            got += n;
+        }
+    }
+
+    CopyResult result;
+    if (copy_fd(in_fd, out_fd, -1, &result) == e_failure)
+        return e_failure;
+
+    fprintf(stderr, "LOG: Wrote a %ld byte tag and %lld bytes of audio (%s).\n", tag_len, result.bytes, copy_strategy_name(result.strategy));
+    return e_success;
+}
+
+/**
+ * Releases the memory held by a transaction.
+ *
+ * @param txn The transaction to free.
+ */
+void free_transaction(TagTransaction *txn)
+{
+    for (int i = 0; i < txn->frame_count; i++)
+    {
+        if (txn->frames[i].owned)
+            free(txn->frames[i].data);
+        if (txn->frames[i].owns_tail)
+            close(txn->frames[i].tail_fd);
+    }
+    free(txn->frames);
+    free_tag_index(&txn->index);
+    memset(txn, 0, sizeof(*txn));
+}
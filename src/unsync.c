@@ -0,0 +1,234 @@
+#include "unsync.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UNSYNC_X86 1
+#endif
+
+int unsync_needs_stuffing(uint8_t next)
+{
+    return next == 0x00 || next >= 0xE0;
+}
+
+/**
+ * Decodes bytes one at a time from `r` until `stop`, writing at `w`.
+ *
+ * @return The new write position; *r is advanced past what was consumed, which may
+ *         be one byte beyond `stop` when a stuffed 0x00 straddles it.
+ */
+static size_t decode_scalar(uint8_t *buf, size_t len, size_t *r, size_t stop, size_t w)
+{
+    while (*r < stop)
+    {
+        uint8_t c = buf[(*r)++];
+        buf[w++] = c;
+        if (c == 0xFF && *r < len && buf[*r] == 0x00)
+            (*r)++;
+    }
+    return w;
+}
+
+/**
+ * Encodes bytes one at a time from `i` until `stop`, writing at `w`.
+ *
+ * @return The new write position.
+ */
+static size_t encode_scalar(const uint8_t *src, size_t len, size_t i, size_t stop, uint8_t *dst, size_t w)
+{
+    for (; i < stop; i++)
+    {
+        dst[w++] = src[i];
+        if (src[i] == 0xFF && i + 1 < len && unsync_needs_stuffing(src[i + 1]))
+            dst[w++] = 0x00;
+    }
+    return w;
+}
+
+#ifdef UNSYNC_X86
+/**
+ * AVX2 decode: 32-byte blocks without 0xFF are moved down with one load and store;
+ * blocks holding one are finished by the scalar loop.
+ */
+__attribute__((target("avx2"))) static size_t decode_avx2(uint8_t *buf, size_t len)
+{
+    const __m256i ff = _mm256_set1_epi8((char)0xFF);
+    size_t r = 0, w = 0;
+    while (r + 32 <= len)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + r));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, ff)) == 0)
+        {
+            if (w != r)
+                _mm256_storeu_si256((__m256i *)(buf + w), v);
+            r += 32;
+            w += 32;
+            continue;
+        }
+        w = decode_scalar(buf, len, &r, r + 32, w);
+    }
+    return decode_scalar(buf, len, &r, len, w);
+}
+
+__attribute__((target("avx2"))) static size_t encode_avx2(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    const __m256i ff = _mm256_set1_epi8((char)0xFF);
+    size_t i = 0, w = 0;
+    while (i + 32 <= len)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, ff)) == 0)
+        {
+            _mm256_storeu_si256((__m256i *)(dst + w), v);
+            i += 32;
+            w += 32;
+            continue;
+        }
+        w = encode_scalar(src, len, i, i + 32, dst, w);
+        i += 32;
+    }
+    return encode_scalar(src, len, i, len, dst, w);
+}
+
+__attribute__((target("avx2"))) static size_t count_avx2(const uint8_t *src, size_t len)
+{
+    const __m256i ff = _mm256_set1_epi8((char)0xFF);
+    size_t i = 0, extra = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, ff));
+        while (mask)
+        {
+            size_t at = i + __builtin_ctz(mask);
+            extra += at + 1 < len && unsync_needs_stuffing(src[at + 1]);
+            mask &= mask - 1;
+        }
+    }
+    for (; i < len; i++)
+        extra += src[i] == 0xFF && i + 1 < len && unsync_needs_stuffing(src[i + 1]);
+    return len + extra;
+}
+
+/**
+ * SSE2 decode, the baseline of every x86-64 CPU: the same scheme on 16-byte blocks.
+ */
+static size_t decode_sse2(uint8_t *buf, size_t len)
+{
+    const __m128i ff = _mm_set1_epi8((char)0xFF);
+    size_t r = 0, w = 0;
+    while (r + 16 <= len)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + r));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, ff)) == 0)
+        {
+            if (w != r)
+                _mm_storeu_si128((__m128i *)(buf + w), v);
+            r += 16;
+            w += 16;
+            continue;
+        }
+        w = decode_scalar(buf, len, &r, r + 16, w);
+    }
+    return decode_scalar(buf, len, &r, len, w);
+}
+
+static size_t encode_sse2(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    const __m128i ff = _mm_set1_epi8((char)0xFF);
+    size_t i = 0, w = 0;
+    while (i + 16 <= len)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, ff)) == 0)
+        {
+            _mm_storeu_si128((__m128i *)(dst + w), v);
+            i += 16;
+            w += 16;
+            continue;
+        }
+        w = encode_scalar(src, len, i, i + 16, dst, w);
+        i += 16;
+    }
+    return encode_scalar(src, len, i, len, dst, w);
+}
+
+static size_t count_sse2(const uint8_t *src, size_t len)
+{
+    const __m128i ff = _mm_set1_epi8((char)0xFF);
+    size_t i = 0, extra = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, ff));
+        while (mask)
+        {
+            size_t at = i + __builtin_ctz(mask);
+            extra += at + 1 < len && unsync_needs_stuffing(src[at + 1]);
+            mask &= mask - 1;
+        }
+    }
+    for (; i < len; i++)
+        extra += src[i] == 0xFF && i + 1 < len && unsync_needs_stuffing(src[i + 1]);
+    return len + extra;
+}
+
+static int has_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+/**
+ * Removes unsynchronisation from a buffer in place.
+ *
+ * @param buf The unsynchronised bytes.
+ * @param len Number of bytes.
+ * @return The decoded length; the decoded bytes are at the start of buf.
+ *
+ * @logic
+ * 1. Pick the AVX2 or SSE2 kernel on x86, the scalar loop elsewhere.
+ * 2. The kernels test a whole block for 0xFF at once; as 0xFF is rare outside
+ *    pictures, most blocks are copied (or left alone, before the first 0xFF) untouched.
+ */
+size_t unsync_decode(uint8_t *buf, size_t len)
+{
+#ifdef UNSYNC_X86
+    return has_avx2() ? decode_avx2(buf, len) : decode_sse2(buf, len);
+#else
+    size_t r = 0;
+    return decode_scalar(buf, len, &r, len, 0);
+#endif
+}
+
+/**
+ * Applies unsynchronisation to a buffer.
+ *
+ * @param src The plain bytes.
+ * @param len Number of bytes.
+ * @param dst Destination of at least 2 * len bytes.
+ * @return The encoded length.
+ *
+ * @logic
+ * 1. Insert 0x00 after a 0xFF followed by 0x00 or a byte >= 0xE0 (a false MPEG sync).
+ * 2. A 0xFF in the last byte is left to the caller, who knows the byte that follows.
+ */
+size_t unsync_encode(const uint8_t *src, size_t len, uint8_t *dst)
+{
+#ifdef UNSYNC_X86
+    return has_avx2() ? encode_avx2(src, len, dst) : encode_sse2(src, len, dst);
+#else
+    return encode_scalar(src, len, 0, len, dst, 0);
+#endif
+}
+
+size_t unsync_encoded_size(const uint8_t *src, size_t len)
+{
+#ifdef UNSYNC_X86
+    return has_avx2() ? count_avx2(src, len) : count_sse2(src, len);
+#else
+    size_t extra = 0;
+    for (size_t i = 0; i + 1 < len; i++)
+        extra += src[i] == 0xFF && unsync_needs_stuffing(src[i + 1]);
+    return len + extra;
+#endif
+}
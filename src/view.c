@@ -1,405 +1,673 @@
 #include "view.h"
+#include "copy.h"
+#include "text.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Per-thread scratch space for frame data: a VIEW_CHUNK_SIZE chunk plus the bytes of a
+// character cut off by the previous one, followed by their UTF-8 conversion. Frames
+// are shown by every --scan worker at once, and none of them allocates per frame.
+static _Thread_local uint8_t view_scratch[(VIEW_CHUNK_SIZE + 4) * (1 + TEXT_EXPANSION)];
 
 /**
- * Displays the content of a single ID3v2 tag.
+ * Writes the data of a frame from `from` to its end.
  *
- * @param mp3 File pointer to the MP3 file (positioned at the start of a tag).
- * @return e_success if the tag is successfully displayed, e_failure on error.
+ * @param index The tag index the frame belongs to.
+ * @param frame The frame.
+ * @param from Offset in the frame data to start at.
+ * @param dst Stream the data is written to.
+ * @return e_success if every byte was written, e_failure on error.
  *
  * @logic
- * 1. Reads the 4-byte tag name.
- * 2. Validates the tag name and retrieves its description.
- * 3. If the tag is "APIC", calls the `read_apic` function.
- * 4. Prints the tag name and its description.
- * 5. Reads the 4-byte tag size.
- * 6. Prints the tag size.
- * 7. Reads the tag data based on the size.
- * 8. Prints the tag data as a string.
+ * 1. Write the part of the data held in memory.
+ * 2. Read the rest (a large picture left in the file) from index->fd in
+ *    VIEW_CHUNK_SIZE chunks of the per-thread `view_scratch`, so memory use does not
+ *    depend on the frame size and nothing is allocated per frame.
  */
-Status display_tag(FILE *mp3)
+static Status write_frame_data(const TagIndex *index, const FrameEntry *frame, unsigned int from, FILE *dst)
 {
-    if (!mp3)
+    if (from < frame->available &&
+        fwrite(frame->data + from, 1, frame->available - from, dst) != frame->available - from)
     {
-        fprintf(stderr, "ERROR: Invalid file pointer.\n");
+        perror("ERROR: fwrite failed while writing frame data");
         return e_failure;
     }
-
-    char tag[4];
-    if (fread(tag, 1, 4, mp3) != 4)
+    if (frame->available >= frame->size)
+        return e_success;
+    if (index->fd < 0)
     {
-        perror("ERROR: fread failed while reading tag name");
+        fprintf(stderr, "ERROR: %s frame data is not loaded\n", frame->id);
         return e_failure;
     }
 
-    int tag_index;
-    if (is_valid_tag_W_index(tag, &tag_index) == e_failure)
+    uint8_t *chunk = view_scratch;
+    long pos = frame->offset + frame->header_len + (from > frame->available ? from : frame->available);
+    long end = frame->offset + frame->header_len + (long)frame->size;
+    Status status = e_success;
+    while (pos < end && status == e_success)
     {
-        return e_failure;
+        size_t want = end - pos < VIEW_CHUNK_SIZE ? end - pos : VIEW_CHUNK_SIZE;
+        ssize_t n = pread(index->fd, chunk, want, pos);
+        if (n <= 0)
+        {
+            fprintf(stderr, "ERROR: Failed to read %s frame data\n", frame->id);
+            status = e_failure;
+        }
+        else if (fwrite(chunk, 1, n, dst) != (size_t)n)
+        {
+            perror("ERROR: fwrite failed while writing frame data");
+            status = e_failure;
+        }
+        else
+        {
+            pos += n;
+        }
     }
+    return status;
+}
 
-    if (strncmp(tag, "APIC", 4) == 0)
+/**
+ * Copies frame data into a buffer, from memory or from the file.
+ *
+ * @param index The tag index the frame belongs to.
+ * @param frame The frame.
+ * @param pos Offset in the frame data.
+ * @param buf Destination.
+ * @param want Largest number of bytes to copy.
+ * @return Number of bytes copied, or -1 on error.
+ */
+static ssize_t read_frame_bytes(const TagIndex *index, const FrameEntry *frame, unsigned int pos, uint8_t *buf, size_t want)
+{
+    if (pos < frame->available)
+    {
+        size_t n = frame->available - pos < want ? frame->available - pos : want;
+        memcpy(buf, frame->data + pos, n);
+        return n;
+    }
+    if (index->fd < 0)
+    {
+        fprintf(stderr, "ERROR: %s frame data is not loaded\n", frame->id);
+        return -1;
+    }
+    ssize_t n = pread(index->fd, buf, want, frame->offset + frame->header_len + pos);
+    if (n <= 0)
     {
-        if (fseek(mp3, -4, SEEK_CUR) != 0)
+        fprintf(stderr, "ERROR: Failed to read %s frame data\n", frame->id);
+        return -1;
+    }
+    return n;
+}
+
+/**
+ * Writes the text of a frame from `from` to its end as UTF-8.
+ *
+ * @param index The tag index the frame belongs to.
+ * @param frame The frame.
+ * @param from Offset of the text in the frame data.
+ * @param dec Decoder set up for the encoding of the text.
+ * @param dst Stream the text is written to.
+ * @return e_success if the text was written, e_failure on error.
+ *
+ * @logic
+ * 1. Take up to VIEW_CHUNK_SIZE bytes at a time, from memory or the file, behind the
+ *    bytes of a character the previous chunk cut off.
+ * 2. Convert each chunk with `text_to_utf8` into the per-thread `view_scratch` and
+ *    write it with a single fwrite; nothing is allocated.
+ */
+static Status write_frame_text(const TagIndex *index, const FrameEntry *frame, unsigned int from, TextDecoder *dec, FILE *dst)
+{
+    size_t cap = from < frame->size && frame->size - from < VIEW_CHUNK_SIZE ? frame->size - from : VIEW_CHUNK_SIZE;
+    uint8_t *chunk = view_scratch;
+    uint8_t *utf8 = chunk + cap + 4;
+
+    Status status = e_success;
+    size_t carried = 0;
+    unsigned int pos = from < frame->size ? from : frame->size;
+    for (;;)
+    {
+        size_t want = frame->size - pos < cap ? frame->size - pos : cap;
+        ssize_t n = want ? read_frame_bytes(index, frame, pos, chunk + carried, want) : 0;
+        if (n < 0)
         {
-            perror("ERROR: fseek failed while rewinding for APIC");
-            return e_failure;
+            status = e_failure;
+            break;
         }
-        if (read_apic(mp3, IMAGE_OUTPUT_PATH) == e_failure)
+        pos += n;
+        int final = pos >= frame->size;
+        size_t used, len = text_to_utf8(dec, chunk, carried + n, final, utf8, &used);
+        if (len > 0 && fwrite(utf8, 1, len, dst) != len)
         {
-            fprintf(stderr, "ERROR: Failed to read APIC tag.\n");
-            return e_failure;
+            perror("ERROR: fwrite failed while writing frame text");
+            status = e_failure;
+            break;
         }
-        return e_success;
+        if (final)
+            break;
+        carried = carried + n - used;
+        memmove(chunk, chunk + used, carried);
+    }
+    return status;
+}
+
+/**
+ * Finds where the text of a frame starts and how it is encoded.
+ *
+ * @param frame The frame.
+ * @param from Offset of the encoding byte, if there is one.
+ * @param dec Receives a decoder for the text.
+ * @return Offset of the text in the frame data.
+ *
+ * @logic
+ * 1. A valid encoding byte selects the encoding and is skipped.
+ * 2. Anything else is text written without one, by this tool among others: it is
+ *    decoded as TEXT_LEGACY from `from`.
+ */
+static unsigned int text_start(const FrameEntry *frame, unsigned int from, TextDecoder *dec)
+{
+    if (from < frame->available && frame->data[from] <= TEXT_UTF8)
+    {
+        text_decoder_init(dec, frame->data[from]);
+        return from + 1;
     }
+    text_decoder_init(dec, TEXT_LEGACY);
+    return from;
+}
+
+/**
+ * Prints the tag ID, description and size lines shared by every text display.
+ */
+static void display_frame_heading(const FrameEntry *frame, int tag_index, FILE *out)
+{
+    fprintf(out, "\nThe tag is %.*s : %s\n", 4, frame->id, tagMappings[tag_index].description);
+    fprintf(out, "The size of the tag is %d bytes\n", frame->size);
+}
 
-    printf("\nThe tag is %.*s : %s\n", 4, tag, tagMappings[tag_index].description);
+/**
+ * Displays a text information frame, or the user-defined URL frame (WXXX), as UTF-8.
+ *
+ * @param index The tag index the frame belongs to.
+ * @param frame The indexed frame.
+ * @param tag_index Index of the frame ID in `tagMappings`.
+ * @param out Stream the tag is printed to.
+ * @param image_path Unused.
+ * @return e_success if the tag is displayed, e_failure on error.
+ */
+static Status display_text_frame(const TagIndex *index, const FrameEntry *frame, int tag_index, FILE *out, const char *image_path)
+{
+    (void)image_path;
+    display_frame_heading(frame, tag_index, out);
 
-    uint8_t tag_size_bytes[4];
-    if (fread(&tag_size_bytes, 1, 4, mp3) != 4)
+    TextDecoder dec;
+    unsigned int from = text_start(frame, 0, &dec);
+    fprintf(out, "The %.*s is ", 4, frame->id);
+    if (write_frame_text(index, frame, from, &dec, out) == e_failure)
     {
-        perror("ERROR: fread failed while reading tag size");
         return e_failure;
     }
+    fprintf(out, "\n");
+    return e_success;
+}
 
-    int size = id3v2_tag_size(tag_size_bytes);
-    printf("The size of the tag is %d bytes\n", size);
-
-    if (fseek(mp3, 2, SEEK_CUR) != 0)
+/**
+ * Displays a URL link frame: an ISO-8859-1 URL with no encoding byte.
+ */
+static Status display_url_frame(const TagIndex *index, const FrameEntry *frame, int tag_index, FILE *out, const char *image_path)
+{
+    if (strncmp(frame->id, "WXXX", 4) == 0)
+        return display_text_frame(index, frame, tag_index, out, image_path);
+
+    display_frame_heading(frame, tag_index, out);
+    TextDecoder dec;
+    text_decoder_init(&dec, TEXT_LATIN1);
+    fprintf(out, "The %.*s is ", 4, frame->id);
+    if (write_frame_text(index, frame, 0, &dec, out) == e_failure)
     {
-        perror("ERROR: fseek failed while skipping tag flags");
         return e_failure;
     }
+    fprintf(out, "\n");
+    return e_success;
+}
 
-    uint8_t *tag_data = (uint8_t *)malloc(size);
-    if (!tag_data)
+/**
+ * Displays a language-tagged text frame (COMM, USLT, USER) as UTF-8.
+ *
+ * @param index The tag index the frame belongs to.
+ * @param frame The indexed frame.
+ * @param tag_index Index of the frame ID in `tagMappings`.
+ * @param out Stream the tag is printed to.
+ * @param image_path Unused.
+ * @return e_success if the tag is displayed, e_failure on error.
+ *
+ * @logic
+ * 1. After the encoding byte come a 3-byte language code and, except in USER, a
+ *    description terminated in the frame's encoding; both are printed when present.
+ *    The description is converted in `view_scratch`, so only its first VIEW_CHUNK_SIZE
+ *    bytes are shown.
+ * 2. The rest of the frame is the text. A frame without a valid encoding byte is
+ *    printed whole as legacy text.
+ */
+static Status display_comment_frame(const TagIndex *index, const FrameEntry *frame, int tag_index, FILE *out, const char *image_path)
+{
+    (void)image_path;
+    display_frame_heading(frame, tag_index, out);
+
+    TextDecoder dec;
+    unsigned int from = 0;
+    if (frame->available >= 4 && frame->data[0] <= TEXT_UTF8)
+    {
+        uint8_t encoding = frame->data[0];
+        fprintf(out, "The language of the %.*s is %.3s\n", 4, frame->id, (const char *)frame->data + 1);
+        from = 4;
+        if (strncmp(frame->id, "USER", 4) != 0)
+        {
+            size_t length = text_terminator(encoding, frame->data + 4, frame->available - 4);
+            size_t shown = length < VIEW_CHUNK_SIZE ? length : VIEW_CHUNK_SIZE;
+            size_t used;
+            text_decoder_init(&dec, encoding);
+            size_t n = text_to_utf8(&dec, frame->data + 4, shown, 1, view_scratch, &used);
+            if (n > 0)
+                fprintf(out, "The description of the %.*s is %.*s\n", 4, frame->id, (int)n, (const char *)view_scratch);
+            from += length;
+        }
+        text_decoder_init(&dec, encoding);
+    }
+    else
+    {
+        text_decoder_init(&dec, TEXT_LEGACY);
+    }
+
+    fprintf(out, "The %.*s is ", 4, frame->id);
+    if (write_frame_text(index, frame, from, &dec, out) == e_failure)
     {
-        perror("ERROR: malloc failed for tag data");
         return e_failure;
     }
+    fprintf(out, "\n");
+    return e_success;
+}
 
-    if (fread(tag_data, 1, size, mp3) != size)
+/**
+ * Displays a frame this tool does not interpret by writing its data as it is stored.
+ * A SEEK frame is shown as the offset it holds instead.
+ */
+static Status display_binary_frame(const TagIndex *index, const FrameEntry *frame, int tag_index, FILE *out, const char *image_path)
+{
+    (void)image_path;
+    display_frame_heading(frame, tag_index, out);
+
+    if (strncmp(frame->id, "SEEK", 4) == 0 && frame->available >= 4)
+    {
+        fprintf(out, "The SEEK is %u bytes after the end of the tag\n", id3v2_tag_size(frame->data));
+        return e_success;
+    }
+    fprintf(out, "The %.*s is ", 4, frame->id);
+    if (write_frame_data(index, frame, 0, out) == e_failure)
     {
-        perror("ERROR: fread failed while reading tag data");
-        free(tag_data);
         return e_failure;
     }
+    fprintf(out, "\n");
+    return e_success;
+}
 
-    printf("The %.*s is ", 4, tag);
-    for (int i = 0; i < size; i++)
+/**
+ * Displays an APIC frame with `read_apic`, extracting the image if image_path is given.
+ */
+static Status display_picture_frame(const TagIndex *index, const FrameEntry *frame, int tag_index, FILE *out, const char *image_path)
+{
+    (void)tag_index;
+    if (read_apic(index, frame, out, image_path) == e_failure)
     {
-        printf("%c", tag_data[i]);
+        fprintf(stderr, "ERROR: Failed to read APIC tag.\n");
+        return e_failure;
     }
-    printf("\n");
-    free(tag_data);
     return e_success;
 }
 
+typedef Status (*FrameDisplay)(const TagIndex *index, const FrameEntry *frame, int tag_index, FILE *out, const char *image_path);
+
+// Display handler of each frame kind.
+static const FrameDisplay frame_displays[] = {
+    [e_frame_text] = display_text_frame,
+    [e_frame_url] = display_url_frame,
+    [e_frame_apic] = display_picture_frame,
+    [e_frame_comment] = display_comment_frame,
+    [e_frame_binary] = display_binary_frame};
+
 /**
- * Displays detailed information about the ID3v2 tags in an MP3 file.
+ * Displays the content of a single ID3v2 tag.
  *
- * @param mp3 File pointer to the MP3 file (opened in read binary mode).
- * @return e_success if the details are displayed successfully, e_failure on error.
+ * @param index The tag index the frame belongs to.
+ * @param frame The indexed frame to display.
+ * @param out Stream the tag is printed to.
+ * @param image_path Directory an APIC image is extracted to, or NULL to only describe it.
+ * @return e_success if the tag is successfully displayed, e_failure on error.
  *
  * @logic
- * 1. Seeks to the position of the header size within the ID3v2 header (6 bytes from the start).
- * 2. Reads the 4-byte header size.
- * 3. Prints the calculated header size.
- * 4. Repeatedly calls the `display_tag` function to display individual tags until `display_tag` returns e_failure (indicating the end of the tags).
- * 5. Prints a message indicating the end of the header.
+ * 1. Looks the frame ID up with `tag_lookup`.
+ * 2. Calls the display handler of its frame kind from `frame_displays`.
  */
-Status display_deets(FILE *mp3)
+Status display_tag(const TagIndex *index, const FrameEntry *frame, FILE *out, const char *image_path)
 {
-    if (!mp3)
+    if (!frame)
     {
-        fprintf(stderr, "ERROR: Invalid file pointer.\n");
+        fprintf(stderr, "ERROR: Invalid frame.\n");
         return e_failure;
     }
 
-    if (fseek(mp3, 6, SEEK_SET) != 0)
+    int tag_index = tag_lookup(frame->id);
+    if (tag_index < 0)
     {
-        perror("ERROR: fseek failed while seeking header size");
         return e_failure;
     }
+    return frame_displays[tag_kind(tag_index)](index, frame, tag_index, out, image_path);
+}
 
-    char header_size_bytes[4];
-    if (fread(header_size_bytes, 1, 4, mp3) != 4)
+/**
+ * Displays detailed information about the ID3v2 tags in an MP3 file.
+ *
+ * @param index The tag index built from the MP3 file.
+ * @param out Stream the details are printed to.
+ * @param image_path Directory an APIC image is extracted to, or NULL to only describe it.
+ * @return e_success if the details are displayed successfully, e_failure on error.
+ *
+ * @logic
+ * 1. Prints the header size recorded in the index.
+ * 2. Dispatches every indexed frame to the display handler of its kind, skipping frames this tool does not know
+ *    and the padding frames left by in-place edits.
+ * 3. Prints a message indicating the end of the header.
+ */
+Status display_deets(const TagIndex *index, FILE *out, const char *image_path)
+{
+    if (!index)
     {
-        perror("ERROR: fread failed while reading header size");
+        fprintf(stderr, "ERROR: Invalid tag index.\n");
         return e_failure;
     }
-    printf("\nThe size of the Header is %u\n", id3v2_header_size(header_size_bytes));
 
-    while (display_tag(mp3) != e_failure)
+    fprintf(out, "\nThe size of the Header is %u\n", index->header_size);
+
+    for (int i = 0; i < index->frame_count; i++)
     {
-        if (ferror(mp3))
+        const FrameEntry *frame = &index->frames[i];
+        int tag_index = tag_lookup(frame->id);
+        if (tag_index < 0 || is_padding_frame(frame))
+            continue;
+        if (frame_displays[tag_kind(tag_index)](index, frame, tag_index, out, image_path) == e_failure)
         {
-            perror("ERROR: Error occurred while displaying tags");
-            return e_failure;
+            break;
         }
     }
 
-    fprintf(stdout, "\n\nEnd of the header.\n\n");
+    fprintf(out, "\n\nEnd of the header.\n\n");
     return e_success;
 }
 
 /**
  * Reads and displays the content of a specific ID3v2 tag.
  *
- * @param mp3 File pointer to the MP3 file (opened in read binary mode).
+ * @param index The tag index built from the MP3 file.
  * @param given_tag The 4-byte tag name to search for.
+ * @param out Stream the tag is printed to.
+ * @param image_path Directory an APIC image is extracted to, or NULL to only describe it.
  * @return e_success if the tag is found and displayed, e_failure otherwise.
  *
  * @logic
- * 1. Seeks to the beginning of the tag data area (10 bytes from the start).
- * 2. Enters a loop to read and check tags.
- * 3. Reads a 4-byte tag name.
- * 4. Checks if the read tag is a valid ID3v2 tag. If not, breaks the loop (end of tags).
- * 5. Compares the read tag with the `given_tag`.
- * 6. If they match, sets a flag, moves the file pointer back by 4 bytes, calls `display_tag` to display the tag, and returns e_success.
- * 7. If they don't match, reads the 4-byte tag size and skips the flags and tag data.
- * 8. After the loop, if the flag is still 0 (tag not found), prints an error message and returns e_failure.
+ * 1. Looks up the tag in the index.
+ * 2. If it is not present, prints an error message and returns e_failure.
+ * 3. Otherwise calls `display_tag` to display it.
  */
-Status read_one_tag(FILE *mp3, const char *given_tag)
+Status read_one_tag(const TagIndex *index, const char *given_tag, FILE *out, const char *image_path)
 {
-    if (!mp3 || !given_tag)
+    if (!index || !given_tag)
     {
         fprintf(stderr, "ERROR: Invalid input arguments.\n");
         return e_failure;
     }
 
-    if (fseek(mp3, 10, SEEK_SET) != 0)
+    const FrameEntry *frame = find_frame(index, given_tag);
+    if (frame == NULL)
     {
-        perror("ERROR: fseek failed while seeking tag area");
+        fprintf(stderr, "ERROR: Tag '%s' Not Found\n", given_tag);
         return e_failure;
     }
 
-    int flag = 0;
-    while (1)
+    if (display_tag(index, frame, out, image_path) == e_failure)
     {
-        char tag[4];
-        if (fread(tag, 1, 4, mp3) != 4)
-        {
-            if (feof(mp3))
-            {
-                break; // End of file reached
-            }
-            perror("ERROR: fread failed while reading tag name");
-            return e_failure;
-        }
-
-        if (is_valid_tag(tag) == e_failure)
-        {
-            break; // Invalid tag, likely end of header
-        }
+        fprintf(stderr, "ERROR: Failed to display tag '%s'.\n", given_tag);
+        return e_failure;
+    }
+    return e_success;
+}
 
-        if (strncmp(tag, given_tag, 4) == 0)
+/**
+ * Reads a NUL-terminated string from APIC frame data into a fixed-size buffer.
+ *
+ * @param data The frame data.
+ * @param size The size of the frame data.
+ * @param pos Position to start reading from; advanced past the terminator.
+ * @param out Destination buffer of 100 bytes.
+ * @return e_success if a terminator was found inside the frame, e_failure otherwise.
+ */
+static Status read_apic_string(const uint8_t *data, unsigned int size, unsigned int *pos, char out[100])
+{
+    int i = 0;
+    while (*pos < size)
+    {
+        char c = data[(*pos)++];
+        if (i < 99)
+            out[i++] = c;
+        if (c == '\0')
         {
-            flag = 1;
-            if (fseek(mp3, -4, SEEK_CUR) != 0)
-            {
-                perror("ERROR: fseek failed while rewinding for display");
-                return e_failure;
-            }
-            if (display_tag(mp3) == e_failure)
-            {
-                fprintf(stderr, "ERROR: Failed to display tag '%s'.\n", given_tag);
-                return e_failure;
-            }
+            out[i] = '\0';
             return e_success;
         }
-        else
-        {
-            uint8_t tag_size_bytes[4];
-            if (fread(&tag_size_bytes, 1, 4, mp3) != 4)
-            {
-                perror("ERROR: fread failed while reading tag size");
-                return e_failure;
-            }
-            int size = id3v2_tag_size(tag_size_bytes);
-            if (fseek(mp3, 2 + size, SEEK_CUR) != 0)
-            {
-                perror("ERROR: fseek failed while skipping tag data");
-                return e_failure;
-            }
-        }
     }
-
-    if (flag == 0)
-    {
-        fprintf(stderr, "ERROR: Tag '%s' Not Found\n", given_tag);
-        return e_failure;
-    }
-    return e_success;
+    out[i] = '\0';
+    return e_failure;
 }
 
 /**
- * Reads and extracts the embedded picture (APIC frame) from an MP3 file.
+ * Finds where the picture data of an APIC frame starts.
  *
- * @param mp3 File pointer to the MP3 file (positioned at the start of the APIC tag).
- * @return e_success if the APIC frame is successfully read and the image saved, e_failure on error.
+ * @param frame The indexed APIC frame.
+ * @param MIME_type Receives the MIME type.
+ * @param picture_type Receives the picture type byte.
+ * @param discription Receives the description.
+ * @param payload Receives the offset of the picture in the frame data.
+ * @return e_success if the frame header fields fit in the loaded data, e_failure otherwise.
  *
  * @logic
- * 1. Reads the 4-byte tag name and verifies it's "APIC".
- * 2. Reads the 4-byte tag size.
- * 3. Skips the 2-byte flags.
- * 4. Reads the text encoding byte.
- * 5. Reads the MIME type string until a null terminator.
- * 6. Reads the picture type byte.
- * 7. Reads the description string until a null terminator.
- * 8. Calculates the actual image data size.
- * 9. Allocates memory for the image data.
- * 10. Creates a new file using the description as the filename in write binary mode.
- * 11. Reads the image data from the MP3 file.
- * 12. Writes the image data to the newly created file.
- * 13. Closes the image file and frees the allocated memory.
- * 14. Prints a success message.
+ * 1. Skips the text encoding byte.
+ * 2. Reads the MIME type string, the picture type byte and the description string.
+ * 3. The picture starts right after the description terminator.
  */
-Status read_apic(FILE *mp3, const char *output_path)
+Status parse_apic(const FrameEntry *frame, char MIME_type[100], char *picture_type, char discription[100], unsigned int *payload)
 {
-    if (!mp3)
+    unsigned int tag_size = frame->available;
+    unsigned int pos = 1; // Skip the text encoding byte.
+
+    if (read_apic_string(frame->data, tag_size, &pos, MIME_type) == e_failure)
     {
-        fprintf(stderr, "ERROR: Invalid file pointer.\n");
+        fprintf(stderr, "ERROR: APIC frame ended while reading MIME type\n");
         return e_failure;
     }
-
-    char tag[5];
-    if (fread(tag, 1, 4, mp3) != 4)
+    if (pos >= tag_size)
     {
-        perror("ERROR: fread failed while reading tag name");
+        fprintf(stderr, "ERROR: APIC frame ended while reading picture type\n");
         return e_failure;
     }
-    tag[4] = '\0';
-    printf("\nThe tag is %s\n", tag);
+    *picture_type = frame->data[pos++];
+    if (read_apic_string(frame->data, tag_size, &pos, discription) == e_failure)
+    {
+        fprintf(stderr, "ERROR: APIC frame ended while reading description\n");
+        return e_failure;
+    }
+    *payload = pos;
+    return e_success;
+}
 
-    if (strncmp(tag, "APIC", 4) == 0)
+/**
+ * Copies the picture of an APIC frame to a descriptor.
+ *
+ * @param index The tag index the frame belongs to.
+ * @param frame The indexed APIC frame.
+ * @param payload Offset of the picture in the frame data.
+ * @param out_fd Destination descriptor (an image file or stdout).
+ * @return e_success if the whole picture was written, e_failure on error.
+ *
+ * @logic
+ * 1. If the MP3 file is open, seek its descriptor to the picture and let `copy_fd` move
+ *    the bytes file to file (copy_file_range) or file to pipe (sendfile), never through
+ *    a user buffer.
+ * 2. Otherwise (a tag read from stdin) the picture is in memory and is written directly.
+ */
+static Status copy_apic_payload(const TagIndex *index, const FrameEntry *frame, unsigned int payload, int out_fd)
+{
+    long long length = (long long)frame->size - payload;
+    if (index->fd >= 0)
     {
-        unsigned char size_bytes[4];
-        if (fread(&size_bytes, 1, 4, mp3) != 4)
+        if (lseek(index->fd, frame->offset + frame->header_len + payload, SEEK_SET) < 0)
         {
-            perror("ERROR: fread failed while reading tag size");
+            perror("ERROR: lseek failed for APIC image data");
             return e_failure;
         }
-        unsigned int tag_size = id3v2_tag_size(size_bytes);
-        printf("The size of the Tag is %u\n", tag_size);
-
-        if (fseek(mp3, 2, SEEK_CUR) != 0)
+        CopyResult result;
+        if (copy_fd(index->fd, out_fd, length, &result) == e_failure || result.bytes != length)
         {
-            perror("ERROR: fseek failed while skipping tag flags");
+            fprintf(stderr, "ERROR: Failed to copy the APIC image data\n");
             return e_failure;
         }
-        int frame_size_pos = ftell(mp3);
+        return e_success;
+    }
 
-        char text_encoding;
-        if (fread(&text_encoding, 1, 1, mp3) != 1)
+    if (frame->available < frame->size)
+    {
+        fprintf(stderr, "ERROR: APIC image data is not loaded\n");
+        return e_failure;
+    }
+    const uint8_t *p = frame->data + payload;
+    while (length > 0)
+    {
+        ssize_t n = write(out_fd, p, length);
+        if (n < 0)
         {
-            perror("ERROR: fread failed while reading text encoding");
+            if (errno == EINTR)
+                continue;
+            perror("ERROR: write failed for APIC image data");
             return e_failure;
         }
+        p += n;
+        length -= n;
+    }
+    return e_success;
+}
 
-        char MIME_type[100];
-        int i = 0;
-        while (i < 99)
-        {
-            if (fread(&MIME_type[i], 1, 1, mp3) != 1)
-            {
-                perror("ERROR: fread failed while reading MIME type");
-                return e_failure;
-            }
-            if (MIME_type[i] == '\0')
-            {
-                MIME_type[i + 1] = '\0';
-                break;
-            }
-            i++;
-        }
-        if (i == 99)
-            MIME_type[99] = '\0';
-        printf("the mime type is %s\n", MIME_type);
+/**
+ * Reads and extracts the embedded picture (APIC frame) from an MP3 file.
+ *
+ * @param index The tag index the frame belongs to.
+ * @param frame The indexed APIC frame.
+ * @param out Stream the frame details are printed to.
+ * @param output_path Directory the image file is written to, or NULL to skip extraction.
+ * @return e_success if the APIC frame is successfully read and the image saved, e_failure on error.
+ *
+ * @logic
+ * 1. Verifies the frame is "APIC".
+ * 2. Parses the MIME type, picture type and description with `parse_apic`, which also
+ *    gives the offset of the picture in the frame.
+ * 3. Calculates the actual image data size.
+ * 4. If an output path is given, creates a new file using the description as the filename.
+ * 5. Copies the picture into it with `copy_apic_payload`, straight from the MP3 file.
+ * 6. Prints a success message.
+ */
+Status read_apic(const TagIndex *index, const FrameEntry *frame, FILE *out, const char *output_path)
+{
+    if (!frame)
+    {
+        fprintf(stderr, "ERROR: Invalid frame.\n");
+        return e_failure;
+    }
 
-        char picture_type;
-        if (fread(&picture_type, 1, 1, mp3) != 1)
-        {
-            perror("ERROR: fread failed while reading picture type");
-            return e_failure;
-        }
-        printf("the pic type is %#x\n", picture_type);
+    fprintf(out, "\nThe tag is %s\n", frame->id);
 
-        char discription[100];
-        i = 0;
-        while (i < 99)
-        {
-            if (fread(&discription[i], 1, 1, mp3) != 1)
-            {
-                perror("ERROR: fread failed while reading description");
-                return e_failure;
-            }
-            if (discription[i] == '\0')
-            {
-                discription[i + 1] = '\0';
-                break;
-            }
-            i++;
-        }
-        if (i == 99)
-            discription[99] = '\0';
-        printf("\nthe description of the image is - %s\n", discription);
+    if (strncmp(frame->id, "APIC", 4) != 0)
+    {
+        fprintf(stderr, "ERROR: Expected APIC tag, but found %s\n", frame->id);
+        return e_failure;
+    }
 
-        int actual_size = tag_size - (ftell(mp3) - frame_size_pos);
-        if (actual_size < 0)
-        {
-            fprintf(stderr, "ERROR: Calculated image size is negative.\n");
-            return e_failure;
-        }
+    fprintf(out, "The size of the Tag is %u\n", frame->size);
 
-        char *image_data = (char *)malloc(actual_size);
-        if (!image_data)
-        {
-            perror("ERROR: malloc failed for image data");
-            return e_failure;
-        }
+    char MIME_type[100], discription[100], picture_type;
+    unsigned int pos;
+    if (parse_apic(frame, MIME_type, &picture_type, discription, &pos) == e_failure)
+    {
+        return e_failure;
+    }
+    fprintf(out, "the mime type is %s\n", MIME_type);
+    fprintf(out, "the pic type is %#x\n", picture_type);
+    fprintf(out, "\nthe description of the image is - %s\n", discription);
 
-        char image__file[256];
-        strcpy(image__file, output_path);
-        strcat(image__file, discription);
+    int actual_size = frame->size - pos;
+    if (output_path == NULL)
+    {
+        fprintf(out, "The image is %d bytes\n", actual_size);
+        return e_success;
+    }
 
-        FILE *image = fopen(image__file, "wb");
-        if (!image)
-        {
-            perror("ERROR: fopen failed to create image file");
-            free(image_data);
-            return e_failure;
-        }
+    char image__file[256];
+    strcpy(image__file, output_path);
+    strcat(image__file, discription);
 
-        if (fread(image_data, 1, actual_size, mp3) != actual_size)
-        {
-            perror("ERROR: fread failed while reading image data");
-            fclose(image);
-            free(image_data);
-            return e_failure;
-        }
+    int image = open(image__file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (image == -1)
+    {
+        perror("ERROR: open failed to create image file");
+        return e_failure;
+    }
 
-        if (fwrite(image_data, 1, actual_size, image) != actual_size)
-        {
-            perror("ERROR: fwrite failed while writing image data");
-            fclose(image);
-            free(image_data);
-            return e_failure;
-        }
+    if (copy_apic_payload(index, frame, pos, image) == e_failure)
+    {
+        close(image);
+        return e_failure;
+    }
 
-        if (fclose(image) != 0)
-        {
-            perror("ERROR: fclose failed for image file");
-            free(image_data);
-            return e_failure;
-        }
-        free(image_data);
+    if (close(image) != 0)
+    {
+        perror("ERROR: close failed for image file");
+        return e_failure;
+    }
 
-        fprintf(stdout, "The image file named \"%s\" is Successfully created.\n", discription);
-        return e_success;
+    fprintf(out, "The image file named \"%s\" is Successfully created.\n", discription);
+    return e_success;
+}
+
+/**
+ * Writes the raw picture of the APIC frame to a descriptor, with nothing else.
+ *
+ * @param index The tag index built from the MP3 file.
+ * @param out_fd Destination descriptor, usually stdout piped to another program.
+ * @return e_success if the picture was written, e_failure if there is none or on error.
+ *
+ * @logic
+ * 1. Looks up the APIC frame in the index.
+ * 2. Finds the picture offset with `parse_apic`.
+ * 3. Copies the picture with `copy_apic_payload`.
+ */
+Status write_apic_image(const TagIndex *index, int out_fd)
+{
+    const FrameEntry *frame = find_frame(index, "APIC");
+    if (frame == NULL)
+    {
+        fprintf(stderr, "ERROR: Tag 'APIC' Not Found\n");
+        return e_failure;
     }
-    else
+
+    char MIME_type[100], discription[100], picture_type;
+    unsigned int pos;
+    if (parse_apic(frame, MIME_type, &picture_type, discription, &pos) == e_failure)
     {
-        fprintf(stderr, "ERROR: Expected APIC tag, but found %s\n", tag);
         return e_failure;
     }
+    return copy_apic_payload(index, frame, pos, out_fd);
 }
\ No newline at end of file
@@ -0,0 +1,624 @@
+#define _GNU_SOURCE
+#include "watch.h"
+#include "tag_index.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WATCH_DIR_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+static volatile sig_atomic_t watch_stopping;
+
+static void stop_watching(int signo)
+{
+    (void)signo;
+    watch_stopping = 1;
+}
+
+static long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static size_t hash_path(const char *path)
+{
+    uint64_t hash = 1469598103934665603ULL;
+    for (; *path; path++)
+        hash = (hash ^ (uint8_t)*path) * 1099511628211ULL;
+    return hash;
+}
+
+/**
+ * Returns non-zero if a path is prefix itself or lies under the directory prefix.
+ */
+static int under_path(const char *path, const char *prefix)
+{
+    size_t len = strlen(prefix);
+    return strncmp(path, prefix, len) == 0 && (path[len] == '\0' || path[len] == '/');
+}
+
+/**
+ * Doubles the number of buckets of the file table.
+ *
+ * @param watcher The watcher.
+ * @return e_success, or e_failure if the new buckets could not be allocated.
+ */
+static Status grow_files(Watcher *watcher)
+{
+    size_t count = watcher->bucket_count ? watcher->bucket_count * 2 : 1024;
+    WatchFile **buckets = (WatchFile **)calloc(count, sizeof(WatchFile *));
+    if (!buckets)
+    {
+        perror("ERROR: calloc failed for watch table");
+        return e_failure;
+    }
+    for (size_t i = 0; i < watcher->bucket_count; i++)
+    {
+        WatchFile *file = watcher->buckets[i];
+        while (file)
+        {
+            WatchFile *next = file->next;
+            size_t bucket = hash_path(file->path) & (count - 1);
+            file->next = buckets[bucket];
+            buckets[bucket] = file;
+            file = next;
+        }
+    }
+    free(watcher->buckets);
+    watcher->buckets = buckets;
+    watcher->bucket_count = count;
+    return e_success;
+}
+
+/**
+ * Looks up a file by path, adding it to the table if it is not known yet.
+ *
+ * @param watcher The watcher.
+ * @param path Path of the file.
+ * @return The file, or NULL on allocation failure.
+ */
+static WatchFile *find_file(Watcher *watcher, const char *path)
+{
+    if (watcher->bucket_count)
+    {
+        for (WatchFile *file = watcher->buckets[hash_path(path) & (watcher->bucket_count - 1)]; file; file = file->next)
+            if (strcmp(file->path, path) == 0)
+                return file;
+    }
+    if (watcher->file_count >= watcher->bucket_count && grow_files(watcher) == e_failure)
+        return NULL;
+
+    size_t len = strlen(path) + 1;
+    WatchFile *file = (WatchFile *)calloc(1, sizeof(WatchFile) + len);
+    if (!file)
+    {
+        perror("ERROR: calloc failed for watched file");
+        return NULL;
+    }
+    memcpy(file->path, path, len);
+    size_t bucket = hash_path(path) & (watcher->bucket_count - 1);
+    file->next = watcher->buckets[bucket];
+    watcher->buckets[bucket] = file;
+    watcher->file_count++;
+    return file;
+}
+
+static void drop_file(Watcher *watcher, WatchFile *file)
+{
+    WatchFile **link = &watcher->buckets[hash_path(file->path) & (watcher->bucket_count - 1)];
+    while (*link != file)
+        link = &(*link)->next;
+    *link = file->next;
+    watcher->file_count--;
+    free(file);
+}
+
+static void mark_file(Watcher *watcher, WatchFile *file)
+{
+    if (file->dirty)
+        return;
+    file->dirty = 1;
+    file->dirty_next = watcher->dirty;
+    watcher->dirty = file;
+    watcher->dirty_count++;
+}
+
+static void mark_path(Watcher *watcher, const char *path)
+{
+    WatchFile *file = find_file(watcher, path);
+    if (file)
+        mark_file(watcher, file);
+}
+
+/**
+ * Marks every known file under a directory as changed; used when the directory
+ * is deleted or moved away, and after the event queue overflows.
+ */
+static void mark_tree(Watcher *watcher, const char *prefix)
+{
+    for (size_t i = 0; i < watcher->bucket_count; i++)
+        for (WatchFile *file = watcher->buckets[i]; file; file = file->next)
+            if (!prefix || under_path(file->path, prefix))
+                mark_file(watcher, file);
+}
+
+/**
+ * Adds an inotify watch on a directory and remembers its path.
+ *
+ * @param watcher The watcher.
+ * @param path Path of the directory.
+ * @return e_success if the directory is watched, e_failure otherwise.
+ */
+static Status add_dir_watch(Watcher *watcher, const char *path)
+{
+    int wd = inotify_add_watch(watcher->fd, path, WATCH_DIR_EVENTS);
+    if (wd == -1)
+    {
+        if (errno == ENOSPC)
+            fprintf(stderr, "ERROR: Cannot watch %s: out of inotify watches (see /proc/sys/fs/inotify/max_user_watches)\n", path);
+        else if (errno != ENOENT && errno != ENOTDIR)
+            fprintf(stderr, "ERROR: Cannot watch %s: %s\n", path, strerror(errno));
+        return e_failure;
+    }
+    if (wd >= watcher->dir_capacity)
+    {
+        int capacity = watcher->dir_capacity ? watcher->dir_capacity : 256;
+        while (capacity <= wd)
+            capacity *= 2;
+        char **dirs = (char **)realloc(watcher->dirs, capacity * sizeof(char *));
+        if (!dirs)
+        {
+            perror("ERROR: realloc failed for watch list");
+            inotify_rm_watch(watcher->fd, wd);
+            return e_failure;
+        }
+        memset(dirs + watcher->dir_capacity, 0, (capacity - watcher->dir_capacity) * sizeof(char *));
+        watcher->dirs = dirs;
+        watcher->dir_capacity = capacity;
+    }
+    char *copy = strdup(path);
+    if (!copy)
+    {
+        perror("ERROR: strdup failed for watched directory");
+        inotify_rm_watch(watcher->fd, wd);
+        return e_failure;
+    }
+    free(watcher->dirs[wd]);
+    watcher->dirs[wd] = copy;
+    return e_success;
+}
+
+/**
+ * Stops watching a directory and every directory under it.
+ */
+static void remove_dir_watches(Watcher *watcher, const char *prefix)
+{
+    for (int wd = 0; wd < watcher->dir_capacity; wd++)
+    {
+        if (watcher->dirs[wd] && under_path(watcher->dirs[wd], prefix))
+        {
+            inotify_rm_watch(watcher->fd, wd);
+            free(watcher->dirs[wd]);
+            watcher->dirs[wd] = NULL;
+        }
+    }
+}
+
+/**
+ * Watches a directory tree and marks every regular file in it as changed.
+ *
+ * @param watcher The watcher.
+ * @param path Directory to walk; symbolic links are not followed.
+ *
+ * @logic
+ * 1. Add the watch before listing the directory, so a file created in between is
+ *    reported by an event if the listing misses it.
+ * 2. Mark the regular files and recurse into the subdirectories.
+ */
+static void watch_tree(Watcher *watcher, const char *path)
+{
+    if (add_dir_watch(watcher, path) == e_failure)
+        return;
+    DIR *dir = opendir(path);
+    if (!dir)
+    {
+        if (errno != ENOENT)
+            fprintf(stderr, "ERROR: Cannot read directory %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        char child[PATH_MAX];
+        if (snprintf(child, sizeof(child), "%s/%s", path, entry->d_name) >= (int)sizeof(child))
+        {
+            fprintf(stderr, "ERROR: Path too long: %s/%s\n", path, entry->d_name);
+            continue;
+        }
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN)
+        {
+            struct stat st;
+            if (lstat(child, &st) != 0)
+                continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type == DT_DIR)
+            watch_tree(watcher, child);
+        else if (type == DT_REG)
+            mark_path(watcher, child);
+    }
+    closedir(dir);
+}
+
+/**
+ * Parses a file with the frame walker and records its tag in the cache.
+ *
+ * @param watcher The watcher.
+ * @param path Path of the file.
+ * @param st Status of the file taken before it was opened.
+ * @return e_success if the file was indexed, e_failure if it could not be opened.
+ */
+static Status index_file(Watcher *watcher, const char *path, const struct stat *st)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        if (errno != ENOENT)
+            fprintf(stderr, "ERROR: Cannot open %s: %s\n", path, strerror(errno));
+        return e_failure;
+    }
+    TagIndex index;
+    if (read_tag_index(fd, &index, NULL) == e_failure)
+    {
+        cache_put(&watcher->cache, st, NULL);
+    }
+    else
+    {
+        cache_put(&watcher->cache, st, &index);
+        free_tag_index(&index);
+    }
+    close(fd);
+    return e_success;
+}
+
+static int compare_keys(const void *a, const void *b)
+{
+    const uint64_t *x = a, *y = b;
+    if (x[0] != y[0])
+        return x[0] < y[0] ? -1 : 1;
+    return x[1] < y[1] ? -1 : x[1] > y[1];
+}
+
+/**
+ * Brings the cache up to date with every file changed since the last batch.
+ *
+ * @param watcher The watcher.
+ * @param verbose Non-zero to log each file that is indexed or removed.
+ *
+ * @logic
+ * 1. Stat every changed file, dropping the paths that are gone and collecting the
+ *    identities (device, inode) that their paths no longer name.
+ * 2. Remove those identities from the cache unless another changed path now names them,
+ *    so a file renamed within the tree keeps its entry without being parsed again.
+ * 3. Re-parse only the files whose cache entry is missing or stale (size or mtime changed);
+ *    a burst of events on the same file costs one parse.
+ * 4. Save the cache once for the whole batch and map the new file.
+ */
+static void index_changes(Watcher *watcher, int verbose)
+{
+    int count = watcher->dirty_count ? watcher->dirty_count : 1;
+    WatchFile **files = (WatchFile **)malloc(count * sizeof(WatchFile *));
+    struct stat *stats = (struct stat *)malloc(count * sizeof(struct stat));
+    uint64_t (*gone)[2] = malloc(count * sizeof(*gone));
+    if (!files || !stats || !gone)
+    {
+        perror("ERROR: malloc failed for watch batch");
+        free(files);
+        free(stats);
+        free(gone);
+        return;
+    }
+
+    int live = 0, gone_count = 0;
+    WatchFile *file = watcher->dirty;
+    watcher->dirty = NULL;
+    watcher->dirty_count = 0;
+    while (file)
+    {
+        WatchFile *next = file->dirty_next;
+        file->dirty = 0;
+        struct stat st;
+        int exists = lstat(file->path, &st) == 0 && S_ISREG(st.st_mode);
+        if (file->ino && (!exists || file->dev != (uint64_t)st.st_dev || file->ino != (uint64_t)st.st_ino))
+        {
+            gone[gone_count][0] = file->dev;
+            gone[gone_count++][1] = file->ino;
+        }
+        if (exists)
+        {
+            file->dev = st.st_dev;
+            file->ino = st.st_ino;
+            files[live] = file;
+            stats[live++] = st;
+        }
+        else
+        {
+            if (file->ino)
+            {
+                watcher->removed++;
+                if (verbose)
+                    fprintf(stdout, "LOG: Removed %s\n", file->path);
+            }
+            drop_file(watcher, file);
+        }
+        file = next;
+    }
+
+    qsort(gone, gone_count, sizeof(*gone), compare_keys);
+    for (int i = 0; i < live; i++)
+    {
+        uint64_t key[2] = {files[i]->dev, files[i]->ino};
+        uint64_t *match = bsearch(key, gone, gone_count, sizeof(*gone), compare_keys);
+        if (match)
+            match[0] = match[1] = 0;
+    }
+    for (int i = 0; i < gone_count; i++)
+        if (gone[i][1])
+            cache_forget(&watcher->cache, gone[i][0], gone[i][1]);
+
+    for (int i = 0; i < live; i++)
+    {
+        if (cache_lookup(&watcher->cache, &stats[i]))
+            continue;
+        if (index_file(watcher, files[i]->path, &stats[i]) == e_success)
+        {
+            watcher->updated++;
+            if (verbose)
+                fprintf(stdout, "LOG: Indexed %s\n", files[i]->path);
+        }
+    }
+    free(files);
+    free(stats);
+    free(gone);
+
+    if (watcher->cache.pending_count > 0)
+    {
+        save_tag_cache(&watcher->cache);
+        close_tag_cache(&watcher->cache);
+        open_tag_cache(&watcher->cache);
+    }
+    fflush(stdout);
+}
+
+/**
+ * Handles one inotify event.
+ *
+ * @param watcher The watcher.
+ * @param root Root of the watched tree.
+ * @param event The event.
+ * @return e_success, or e_failure once the root itself has gone away.
+ *
+ * @logic
+ * 1. A file written, moved in, moved out or deleted is marked as changed; the batch decides
+ *    what happened by looking at the file again.
+ * 2. A directory created or moved in is watched and walked, since its files may predate the watch.
+ * 3. A directory deleted or moved out loses its watches, and its files are marked so they are
+ *    dropped from the cache.
+ * 4. On queue overflow, every known file is marked and the tree walked again.
+ */
+static Status handle_event(Watcher *watcher, const char *root, const struct inotify_event *event)
+{
+    if (event->mask & IN_Q_OVERFLOW)
+    {
+        fprintf(stderr, "ERROR: inotify queue overflowed, rescanning %s\n", root);
+        mark_tree(watcher, NULL);
+        watch_tree(watcher, root);
+        return e_success;
+    }
+    if (event->wd < 0 || event->wd >= watcher->dir_capacity || !watcher->dirs[event->wd])
+        return e_success;
+    const char *dir = watcher->dirs[event->wd];
+
+    if (event->mask & IN_IGNORED)
+    {
+        free(watcher->dirs[event->wd]);
+        watcher->dirs[event->wd] = NULL;
+        return e_success;
+    }
+    if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+    {
+        if (strcmp(dir, root) != 0)
+            return e_success;
+        fprintf(stderr, "ERROR: %s was removed or moved\n", root);
+        mark_tree(watcher, NULL);
+        return e_failure;
+    }
+    if (event->len == 0)
+        return e_success;
+
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/%s", dir, event->name) >= (int)sizeof(path))
+        return e_success;
+
+    if (event->mask & IN_ISDIR)
+    {
+        if (event->mask & (IN_CREATE | IN_MOVED_TO))
+        {
+            watch_tree(watcher, path);
+        }
+        else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+        {
+            remove_dir_watches(watcher, path);
+            mark_tree(watcher, path);
+        }
+    }
+    else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE))
+    {
+        mark_path(watcher, path);
+    }
+    return e_success;
+}
+
+/**
+ * Keeps the tag cache of a directory tree up to date from inotify events.
+ *
+ * @param root Directory to watch recursively.
+ * @return e_success when stopped by SIGINT or SIGTERM, e_failure on error.
+ *
+ * @logic
+ * 1. Watch every directory of the tree and index the files whose cache entry is stale.
+ * 2. Wait for events with SIGINT and SIGTERM blocked outside ppoll, so a signal can't
+ *    slip in between the stop check and the wait.
+ * 3. Changed paths are collected into a set; the batch is indexed once the tree has been
+ *    quiet for WATCH_SETTLE_MS, or WATCH_MAX_DELAY_MS after its first event, so a bulk copy
+ *    is re-indexed in a few batches rather than once per event.
+ * 4. On exit, index the last batch and release everything.
+ */
+Status watch_library(const char *root)
+{
+    Watcher watcher = {.fd = -1};
+    struct stat st;
+    if (stat(root, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        fprintf(stderr, "ERROR: %s is not a directory\n", root);
+        return e_failure;
+    }
+    if (open_tag_cache(&watcher.cache) == e_failure)
+    {
+        fprintf(stderr, "ERROR: --watch keeps the tag cache up to date; it can't run with %s=off\n", TAG_CACHE_ENV);
+        return e_failure;
+    }
+    watcher.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher.fd == -1)
+    {
+        perror("ERROR: inotify_init1 failed");
+        close_tag_cache(&watcher.cache);
+        return e_failure;
+    }
+    char *events = (char *)malloc(WATCH_EVENT_BUFFER);
+    if (!events)
+    {
+        perror("ERROR: malloc failed for inotify events");
+        close(watcher.fd);
+        close_tag_cache(&watcher.cache);
+        return e_failure;
+    }
+
+    sigset_t blocked, waiting;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    sigprocmask(SIG_BLOCK, &blocked, &waiting);
+    sigdelset(&waiting, SIGINT);
+    sigdelset(&waiting, SIGTERM);
+    struct sigaction action = {.sa_handler = stop_watching};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    watch_stopping = 0;
+
+    Status status = e_success;
+    watch_tree(&watcher, root);
+    index_changes(&watcher, 0);
+    int watched = 0;
+    for (int wd = 0; wd < watcher.dir_capacity; wd++)
+        watched += watcher.dirs[wd] != NULL;
+    fprintf(stdout, "LOG: Watching %d directories and %zu files under %s, %ld re-indexed.\n", watched, watcher.file_count, root, watcher.updated);
+    fflush(stdout);
+
+    long first_event = 0, last_event = 0, event_count = 0;
+    while (!watch_stopping && status == e_success)
+    {
+        struct timespec timeout, *wait = NULL;
+        if (watcher.dirty_count > 0)
+        {
+            long now = now_ms();
+            long due = last_event + WATCH_SETTLE_MS;
+            if (due > first_event + WATCH_MAX_DELAY_MS)
+                due = first_event + WATCH_MAX_DELAY_MS;
+            long left = due > now ? due - now : 0;
+            timeout.tv_sec = left / 1000;
+            timeout.tv_nsec = (left % 1000) * 1000000L;
+            wait = &timeout;
+        }
+        struct pollfd pfd = {.fd = watcher.fd, .events = POLLIN};
+        int ready = ppoll(&pfd, 1, wait, &waiting);
+        if (ready == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("ERROR: ppoll failed");
+            status = e_failure;
+            break;
+        }
+        if (ready == 0)
+        {
+            watcher.updated = watcher.removed = 0;
+            index_changes(&watcher, 1);
+            fprintf(stdout, "LOG: Re-indexed %ld files and removed %ld after %ld events.\n", watcher.updated, watcher.removed, event_count);
+            fflush(stdout);
+            event_count = 0;
+            continue;
+        }
+
+        ssize_t n;
+        while ((n = read(watcher.fd, events, WATCH_EVENT_BUFFER)) > 0)
+        {
+            for (char *p = events; p < events + n && status == e_success;)
+            {
+                const struct inotify_event *event = (const struct inotify_event *)p;
+                int was_dirty = watcher.dirty_count;
+                status = handle_event(&watcher, root, event);
+                if (watcher.dirty_count > was_dirty)
+                {
+                    last_event = now_ms();
+                    if (was_dirty == 0)
+                        first_event = last_event;
+                    event_count++;
+                }
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        if (n == -1 && errno != EAGAIN && errno != EINTR)
+        {
+            perror("ERROR: read failed on inotify descriptor");
+            status = e_failure;
+        }
+    }
+
+    if (watcher.dirty_count > 0)
+        index_changes(&watcher, 1);
+    fprintf(stdout, "LOG: Stopped watching %s.\n", root);
+
+    sigprocmask(SIG_UNBLOCK, &blocked, NULL);
+    free(events);
+    close(watcher.fd);
+    for (int wd = 0; wd < watcher.dir_capacity; wd++)
+        free(watcher.dirs[wd]);
+    free(watcher.dirs);
+    for (size_t i = 0; i < watcher.bucket_count; i++)
+    {
+        WatchFile *file = watcher.buckets[i];
+        while (file)
+        {
+            WatchFile *next = file->next;
+            free(file);
+            file = next;
+        }
+    }
+    free(watcher.buckets);
+    close_tag_cache(&watcher.cache);
+    return status;
+}
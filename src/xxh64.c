@@ -0,0 +1,150 @@
+#include "xxh64.h"
+
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotl(uint64_t x, int n)
+{
+    return (x << n) | (x >> (64 - n));
+}
+
+static uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static uint64_t round64(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    return rotl(acc, 31) * PRIME1;
+}
+
+static uint64_t merge64(uint64_t acc, uint64_t lane)
+{
+    acc ^= round64(0, lane);
+    return acc * PRIME1 + PRIME4;
+}
+
+/**
+ * Mixes whole 32-byte stripes into the four lanes.
+ *
+ * @return Number of bytes consumed (a multiple of 32).
+ *
+ * @logic
+ * 1. The lanes are independent, so the compiler keeps them in registers and the
+ *    multiplies of one stripe overlap: this loop is where the time goes on large reads.
+ */
+static size_t consume_stripes(uint64_t acc[4], const uint8_t *p, size_t len)
+{
+    uint64_t a = acc[0], b = acc[1], c = acc[2], d = acc[3];
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        a = round64(a, read64(p + i));
+        b = round64(b, read64(p + i + 8));
+        c = round64(c, read64(p + i + 16));
+        d = round64(d, read64(p + i + 24));
+    }
+    acc[0] = a;
+    acc[1] = b;
+    acc[2] = c;
+    acc[3] = d;
+    return i;
+}
+
+void xxh64_init(Xxh64 *ctx, uint64_t seed)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->seed = seed;
+    ctx->acc[0] = seed + PRIME1 + PRIME2;
+    ctx->acc[1] = seed + PRIME2;
+    ctx->acc[2] = seed;
+    ctx->acc[3] = seed - PRIME1;
+}
+
+/**
+ * Adds data to the hash.
+ *
+ * @param ctx The hash state.
+ * @param data The bytes to add.
+ * @param len Number of bytes.
+ *
+ * @logic
+ * 1. Top up a partial stripe left by the previous call.
+ * 2. Consume whole stripes straight from data, without copying.
+ * 3. Keep the remainder for the next call or for `xxh64_final`.
+ */
+void xxh64_update(Xxh64 *ctx, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    ctx->length += len;
+    if (ctx->stripe_len > 0)
+    {
+        size_t take = 32 - ctx->stripe_len < len ? 32 - ctx->stripe_len : len;
+        memcpy(ctx->stripe + ctx->stripe_len, p, take);
+        ctx->stripe_len += take;
+        p += take;
+        len -= take;
+        if (ctx->stripe_len < 32)
+            return;
+        consume_stripes(ctx->acc, ctx->stripe, 32);
+        ctx->stripe_len = 0;
+    }
+    size_t used = consume_stripes(ctx->acc, p, len);
+    memcpy(ctx->stripe, p + used, len - used);
+    ctx->stripe_len = len - used;
+}
+
+uint64_t xxh64_final(const Xxh64 *ctx)
+{
+    uint64_t h;
+    if (ctx->length >= 32)
+    {
+        h = rotl(ctx->acc[0], 1) + rotl(ctx->acc[1], 7) + rotl(ctx->acc[2], 12) + rotl(ctx->acc[3], 18);
+        for (int i = 0; i < 4; i++)
+            h = merge64(h, ctx->acc[i]);
+    }
+    else
+    {
+        h = ctx->seed + PRIME5;
+    }
+    h += ctx->length;
+
+    const uint8_t *p = ctx->stripe;
+    size_t len = ctx->stripe_len;
+    for (; len >= 8; p += 8, len -= 8)
+        h = rotl(h ^ round64(0, read64(p)), 27) * PRIME1 + PRIME4;
+    if (len >= 4)
+    {
+        h = rotl(h ^ (uint64_t)read32(p) * PRIME1, 23) * PRIME2 + PRIME3;
+        p += 4;
+        len -= 4;
+    }
+    for (; len > 0; p++, len--)
+        h = rotl(h ^ *p * PRIME5, 11) * PRIME1;
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}